@@ -0,0 +1,721 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Micro-benchmarks for the hot paths of the client. Every benchmark runs
+	on a dataset generated from a fixed seed, so runs are comparable, and
+	reports nanoseconds, allocations and allocated bytes per operation.
+
+	Usage: http-client-bench [filter] [min_ms] [scalar|sse2|avx2]
+*/
+#ifndef HTTP_ALLOC_STATS
+	#define HTTP_ALLOC_STATS
+#endif
+#include "http-client-c.h"
+
+#define BENCH_URLS 256
+#define BENCH_STRINGS 64
+#define BENCH_RESPONSES 9
+
+/*
+	Represents a benchmark, op is called with the iteration number
+*/
+struct bench
+{
+	const char *name;
+	void (*op)(int i);
+};
+
+/* Datasets */
+char *bench_urls[BENCH_URLS];
+char *bench_plain[BENCH_STRINGS];
+char *bench_base64[BENCH_STRINGS];
+char *bench_text[BENCH_STRINGS];
+char *bench_encoded[BENCH_STRINGS];
+char *bench_responses[BENCH_RESPONSES];
+size_t bench_response_lens[BENCH_RESPONSES];
+char bench_req_url[BENCH_RESPONSES][64];
+int bench_port = 0;
+struct http_template *bench_template;
+struct http_response *bench_headers;
+
+/* Keeps the compiler from dropping results */
+volatile size_t bench_sink = 0;
+
+/*
+	Returns a monotonic timestamp in nanoseconds
+*/
+long long bench_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+	Deterministic pseudo random numbers, so datasets are the same on every run
+*/
+unsigned int bench_seed = 42;
+unsigned int bench_rand()
+{
+	bench_seed = bench_seed * 1103515245u + 12345u;
+	return (bench_seed >> 16) & 0x7fff;
+}
+
+/*
+	Appends n random characters from the given alphabet
+*/
+void bench_rand_chars(struct str_buffer *buf, const char *alphabet, int n)
+{
+	size_t len = strlen(alphabet);
+	int i;
+	for(i = 0; i < n; i++)
+		str_buffer_append(buf, &alphabet[bench_rand() % len], 1);
+}
+
+/*
+	Builds the url corpus: a mix of paths, queries, ports, credentials and
+	fragments, the shapes seen in real traffic. Hosts resolve locally.
+*/
+void bench_make_urls()
+{
+	const char *hosts[] = { "127.0.0.1", "localhost" };
+	const char *segment = "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	const char *value = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789%";
+	int i, j;
+	for(i = 0; i < BENCH_URLS; i++)
+	{
+		struct str_buffer url;
+		char port[16];
+		str_buffer_init(&url);
+		str_buffer_append_str(&url, "http://");
+		if(bench_rand() % 8 == 0)
+			str_buffer_append_str(&url, "user:secret@");
+		str_buffer_append_str(&url, hosts[bench_rand() % 2]);
+		if(bench_rand() % 4 == 0)
+		{
+			sprintf(port, ":%d", 1024 + bench_rand() % 60000);
+			str_buffer_append_str(&url, port);
+		}
+		int segments = bench_rand() % 6;
+		for(j = 0; j < segments; j++)
+		{
+			str_buffer_append_str(&url, "/");
+			bench_rand_chars(&url, segment, 3 + bench_rand() % 12);
+		}
+		if(segments == 0)
+			str_buffer_append_str(&url, "/");
+		int params = bench_rand() % 5;
+		for(j = 0; j < params; j++)
+		{
+			str_buffer_append_str(&url, j == 0 ? "?" : "&");
+			bench_rand_chars(&url, segment, 2 + bench_rand() % 8);
+			str_buffer_append_str(&url, "=");
+			bench_rand_chars(&url, value, 1 + bench_rand() % 24);
+		}
+		if(bench_rand() % 8 == 0)
+		{
+			str_buffer_append_str(&url, "#");
+			bench_rand_chars(&url, segment, 4 + bench_rand() % 8);
+		}
+		bench_urls[i] = url.data;
+	}
+}
+
+/*
+	Builds the string datasets: credentials sized plain text, its base64
+	form, and form values with spaces and reserved characters with their
+	encoded form
+*/
+void bench_make_strings()
+{
+	const char *plain = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789:._-";
+	const char *text = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ 0123456789 &=?/:;+,%#";
+	int i;
+	for(i = 0; i < BENCH_STRINGS; i++)
+	{
+		struct str_buffer buf;
+		str_buffer_init(&buf);
+		bench_rand_chars(&buf, plain, 8 + bench_rand() % 88);
+		bench_plain[i] = buf.data;
+		bench_base64[i] = base64_encode(bench_plain[i]);
+
+		str_buffer_init(&buf);
+		bench_rand_chars(&buf, text, 16 + bench_rand() % 112);
+		bench_text[i] = buf.data;
+		bench_encoded[i] = urlencode(bench_text[i]);
+	}
+}
+
+/*
+	Builds the canned responses, from an empty body up to a megabyte, a
+	chunked one, and a JSON listing both as it is and gzipped when zlib is
+	there
+*/
+void bench_make_responses()
+{
+	size_t sizes[5] = { 0, 1024, 16384, 262144, 1048576 };
+	char header[256];
+	int i;
+	for(i = 0; i < 5; i++)
+	{
+		struct str_buffer buf;
+		str_buffer_init(&buf);
+		sprintf(header, "HTTP/1.1 200 OK\r\nServer: bench\r\nContent-Type: application/octet-stream\r\nCache-Control: no-cache\r\nContent-Length: %lu\r\n\r\n", (unsigned long)sizes[i]);
+		str_buffer_append_str(&buf, header);
+		str_buffer_reserve(&buf, sizes[i]);
+		bench_rand_chars(&buf, "0123456789abcdef", (int)sizes[i]);
+		bench_responses[i] = buf.data;
+		bench_response_lens[i] = buf.len;
+	}
+
+	struct str_buffer buf;
+	str_buffer_init(&buf);
+	str_buffer_append_str(&buf, "HTTP/1.1 200 OK\r\nServer: bench\r\nTransfer-Encoding: chunked\r\n\r\n");
+	for(i = 0; i < 16; i++)
+	{
+		str_buffer_append_str(&buf, "1000\r\n");
+		bench_rand_chars(&buf, "0123456789abcdef", 4096);
+		str_buffer_append_str(&buf, "\r\n");
+	}
+	str_buffer_append_str(&buf, "0\r\n\r\n");
+	bench_responses[5] = buf.data;
+	bench_response_lens[5] = buf.len;
+
+	struct str_buffer json;
+	str_buffer_init(&json);
+	str_buffer_append_str(&json, "[");
+	while(json.len < 65536)
+	{
+		sprintf(header, "{\"id\":%u,\"name\":\"user-", bench_rand());
+		str_buffer_append_str(&json, header);
+		bench_rand_chars(&json, "abcdefghijklmnopqrstuvwxyz", 8);
+		sprintf(header, "\",\"active\":%s,\"score\":%u},", bench_rand() % 2 ? "true" : "false", bench_rand() % 1000);
+		str_buffer_append_str(&json, header);
+	}
+	json.data[json.len - 1] = ']';
+	for(i = 6; i < 8; i++)
+	{
+		const char *body = json.data;
+		size_t body_len = json.len;
+		const char *coding = "";
+		#ifdef HTTP_USE_ZLIB
+			unsigned char *gz = NULL;
+			if(i == 7)
+			{
+				z_stream z;
+				memset(&z, 0, sizeof(z));
+				deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+				gz = (unsigned char*)malloc(deflateBound(&z, json.len));
+				z.next_in = (Bytef*)json.data;
+				z.avail_in = (uInt)json.len;
+				z.next_out = gz;
+				z.avail_out = (uInt)deflateBound(&z, json.len);
+				deflate(&z, Z_FINISH);
+				body = (const char*)gz;
+				body_len = z.total_out;
+				deflateEnd(&z);
+				coding = "Content-Encoding: gzip\r\n";
+			}
+		#endif
+		str_buffer_init(&buf);
+		sprintf(header, "HTTP/1.1 200 OK\r\nServer: bench\r\nContent-Type: application/json\r\n%sContent-Length: %lu\r\n\r\n", coding, (unsigned long)body_len);
+		str_buffer_append_str(&buf, header);
+		str_buffer_append(&buf, body, body_len);
+		bench_responses[i] = buf.data;
+		bench_response_lens[i] = buf.len;
+		#ifdef HTTP_USE_ZLIB
+			free(gz);
+		#endif
+	}
+	str_buffer_free(&json);
+
+	/* A small API response behind many headers */
+	str_buffer_init(&buf);
+	str_buffer_append_str(&buf, "HTTP/1.1 200 OK\r\n"
+		"Date: Mon, 12 Oct 2026 09:41:07 GMT\r\n"
+		"Content-Type: application/json; charset=utf-8\r\n"
+		"Content-Length: 15\r\n"
+		"Connection: keep-alive\r\n"
+		"Server: bench\r\n"
+		"Cache-Control: private, no-cache, no-store, must-revalidate\r\n"
+		"ETag: W/\"5f3a-9c1e2b7d4a60\"\r\n"
+		"Vary: Accept-Encoding, Origin, Authorization\r\n"
+		"Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n"
+		"X-Content-Type-Options: nosniff\r\n"
+		"X-Frame-Options: DENY\r\n"
+		"X-Request-Id: 7f0c8a4e-2b1d-4c9a-8e3f-5d6b7a8c9d0e\r\n"
+		"X-RateLimit-Limit: 5000\r\n"
+		"X-RateLimit-Remaining: 4987\r\n"
+		"X-RateLimit-Reset: 1791798067\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Access-Control-Expose-Headers: ETag, Link, X-RateLimit-Limit, X-RateLimit-Remaining\r\n"
+		"Content-Security-Policy: default-src 'none'; frame-ancestors 'none'\r\n"
+		"Set-Cookie: session=3q2+7w==; Path=/; Secure; HttpOnly; SameSite=Lax\r\n"
+		"Last-Modified: Mon, 12 Oct 2026 09:40:55 GMT\r\n"
+		"\r\n"
+		"{\"status\":\"ok\"}");
+	bench_responses[8] = buf.data;
+	bench_response_lens[8] = buf.len;
+}
+
+/*
+	Serves the canned responses on one connection. The request path selects
+	the response: GET /3 gets bench_responses[3].
+*/
+void* bench_server_conn(void *arg)
+{
+	int sock = (int)(long)arg;
+	struct str_buffer in;
+	str_buffer_init(&in);
+	for(;;)
+	{
+		char *end;
+		while((end = strstr(in.data != NULL ? in.data : "", "\r\n\r\n")) == NULL)
+		{
+			str_buffer_reserve(&in, 4096);
+			int n = recv(sock, in.data + in.len, in.cap - in.len - 1, 0);
+			if(n <= 0)
+			{
+				str_buffer_free(&in);
+				close(sock);
+				return NULL;
+			}
+			str_buffer_commit(&in, n);
+		}
+		int which = atoi(in.data + 5) % BENCH_RESPONSES;
+		http_send_all(sock, bench_responses[which], bench_response_lens[which]);
+		str_buffer_consume(&in, end + 4 - in.data);
+	}
+}
+
+/*
+	Listens on an ephemeral loopback port, one thread per connection
+*/
+void* bench_server(void *arg)
+{
+	int listener = *(int*)arg;
+	for(;;)
+	{
+		pthread_t thread;
+		int sock = accept(listener, NULL, NULL);
+		if(sock < 0)
+			return NULL;
+		pthread_create(&thread, NULL, bench_server_conn, (void*)(long)sock);
+		pthread_detach(thread);
+	}
+}
+
+/*
+	Starts the canned response server
+*/
+int bench_start_server()
+{
+	static int listener;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	pthread_t thread;
+	int i;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0)
+		return -1;
+	getsockname(listener, (struct sockaddr*)&addr, &len);
+	bench_port = ntohs(addr.sin_port);
+	for(i = 0; i < BENCH_RESPONSES; i++)
+		sprintf(bench_req_url[i], "http://127.0.0.1:%d/%d", bench_port, i);
+	return pthread_create(&thread, NULL, bench_server, &listener);
+}
+
+/* The benchmarked operations */
+
+void bench_parse_url(int i)
+{
+	struct parsed_url *purl = parse_url(bench_urls[i % BENCH_URLS]);
+	bench_sink += purl->path != NULL;
+	parsed_url_free(purl);
+}
+
+void bench_url_parse(int i)
+{
+	struct url_view view;
+	const char *url = bench_urls[i % BENCH_URLS];
+	url_parse(url, strlen(url), &view);
+	bench_sink += view.path.len;
+}
+
+void bench_str_replace(int i)
+{
+	char *out = str_replace(" ", "%20", bench_text[i % BENCH_STRINGS]);
+	bench_sink += out[0];
+	http_free(out);
+}
+
+void bench_get_until(int i)
+{
+	char *out = get_until(bench_text[i % BENCH_STRINGS], "=");
+	bench_sink += out[0];
+	http_free(out);
+}
+
+void bench_str_contains(int i)
+{
+	bench_sink += str_contains(bench_text[i % BENCH_STRINGS], "?/:");
+}
+
+void bench_base64_encode(int i)
+{
+	char *out = base64_encode(bench_plain[i % BENCH_STRINGS]);
+	bench_sink += out[0];
+	http_free(out);
+}
+
+void bench_base64_decode(int i)
+{
+	char *out = base64_decode(bench_base64[i % BENCH_STRINGS]);
+	bench_sink += out[0];
+	http_free(out);
+}
+
+/*
+	Encodes and decodes 64k of binary data into a buffer, the way a large
+	upload payload is prepared
+*/
+void bench_base64_encode_64k(int i)
+{
+	(void)i;
+	static char out[(65536 + 2) / 3 * 4];
+	bench_sink += base64_encode_to(out, bench_responses[3] + 1024, 65536);
+}
+
+void bench_base64_decode_64k(int i)
+{
+	(void)i;
+	static char in[(65536 + 2) / 3 * 4];
+	static unsigned char out[65536];
+	static size_t len = 0;
+	if(len == 0)
+		len = base64_encode_to(in, bench_responses[3] + 1024, 65536);
+	bench_sink += base64_decode_to(out, in, len);
+}
+
+void bench_urlencode(int i)
+{
+	char *out = urlencode(bench_text[i % BENCH_STRINGS]);
+	bench_sink += out[0];
+	http_free(out);
+}
+
+void bench_urldecode(int i)
+{
+	static char out[512];
+	const char *in = bench_encoded[i % BENCH_STRINGS];
+	bench_sink += url_decode_to(out, in, strlen(in), 1);
+}
+
+/*
+	Builds a query string of 24 parameters into a reused buffer
+*/
+void bench_url_query(int i)
+{
+	static struct str_buffer query;
+	int j;
+	query.len = 0;
+	for(j = 0; j < 24; j++)
+		url_query_add(&query, bench_plain[(i + j) % BENCH_STRINGS], bench_text[(i + j) % BENCH_STRINGS]);
+	bench_sink += query.len;
+}
+
+/*
+	Encodes 64k of mostly unreserved text, like a long token or id list
+*/
+void bench_urlencode_64k(int i)
+{
+	(void)i;
+	static char out[65536 * 3];
+	static char in[65536];
+	if(in[0] == '\0')
+	{
+		int j;
+		for(j = 0; j < 65536; j++)
+			in[j] = j % 61 == 60 ? ',' : bench_plain[0][j % strlen(bench_plain[0])];
+	}
+	bench_sink += url_encode_to(out, in, sizeof(in), 1);
+}
+
+/*
+	Parses a canned response in memory, the way http_req does minus the socket
+*/
+void bench_parse_response(int which)
+{
+	struct http_response *hresp = (struct http_response*)http_calloc(1, sizeof(struct http_response));
+	struct str_buffer body;
+	struct http_parser parser;
+	struct http_stream stream;
+	struct http_stream_ctx ctx;
+	str_buffer_init(&body);
+	stream.data = &body;
+	stream.on_headers = NULL;
+	stream.on_body = http_req_collect_body;
+	ctx.hresp = hresp;
+	ctx.stream = &stream;
+	ctx.decoder = NULL;
+	http_parser_init(&parser, 0);
+	parser.on_headers_complete = http_stream_on_headers_complete;
+	parser.on_body = http_stream_on_body;
+	parser.data = &ctx;
+	http_parser_execute(&parser, bench_responses[which], bench_response_lens[which]);
+	http_stream_finish(hresp, &parser, bench_responses[which]);
+	str_buffer_append(&body, "", 0);
+	hresp->body = body.data;
+	hresp->body_len = body.len;
+	bench_sink += hresp->body_len;
+	http_response_free(hresp);
+}
+
+void bench_parse_0(int i) { (void)i; bench_parse_response(0); }
+void bench_parse_1k(int i) { (void)i; bench_parse_response(1); }
+void bench_parse_16k(int i) { (void)i; bench_parse_response(2); }
+void bench_parse_256k(int i) { (void)i; bench_parse_response(3); }
+void bench_parse_1m(int i) { (void)i; bench_parse_response(4); }
+void bench_parse_chunked(int i) { (void)i; bench_parse_response(5); }
+void bench_parse_headers(int i) { (void)i; bench_parse_response(8); }
+
+/*
+	Full http_req round trip over a pooled loopback connection
+*/
+void bench_http_req(int which)
+{
+	struct parsed_url *purl = parse_url(bench_req_url[which]);
+	char *http_headers = http_build_request("GET", purl, NULL);
+	struct http_response *hresp = http_req(http_headers, purl);
+	if(hresp == NULL)
+	{
+		printf("Request to the bench server failed\n");
+		exit(1);
+	}
+	bench_sink += hresp->body_len;
+	http_response_free(hresp);
+}
+
+/*
+	Building the headers of a request, from the url up and from a template
+*/
+void bench_build_request(int i)
+{
+	char url[96];
+	sprintf(url, "%s?page=%d", bench_req_url[1], i & 7);
+	struct parsed_url *purl = parse_url(url);
+	char *http_headers = http_build_request("GET", purl, "Accept:*/*\r\n");
+	bench_sink += strlen(http_headers);
+	http_free(http_headers);
+	parsed_url_free(purl);
+}
+
+void bench_build_template(int i)
+{
+	char query[16];
+	sprintf(query, "page=%d", i & 7);
+	char *http_headers = http_template_render(bench_template, query, -1);
+	bench_sink += strlen(http_headers);
+	http_free(http_headers);
+}
+
+/*
+	Round trip of a request made from a template
+*/
+void bench_req_template(int i)
+{
+	(void)i;
+	struct http_response *hresp = http_template_req(bench_template, NULL, NULL, 0);
+	if(hresp == NULL)
+	{
+		printf("Request to the bench server failed\n");
+		exit(1);
+	}
+	bench_sink += hresp->body_len;
+	http_response_free(hresp);
+}
+
+/*
+	Looking up a response header, by scanning the header block, through a
+	header map built for the lookup and through one built before
+*/
+void bench_header_scan(int i)
+{
+	(void)i;
+	char *value = http_header_value(bench_headers->response_headers, "Content-Length");
+	bench_sink += value[0];
+	http_free(value);
+}
+
+void bench_header_build(int i)
+{
+	(void)i;
+	size_t len;
+	bench_headers->headers.built = 0;
+	const char *value = http_header_get(bench_headers, "Content-Length", &len);
+	bench_sink += value[0];
+}
+
+void bench_header_map(int i)
+{
+	(void)i;
+	size_t len;
+	const char *value = http_header_get(bench_headers, "Content-Length", &len);
+	bench_sink += value[0];
+}
+
+/*
+	Round trip of a JSON listing, as it is and gzipped, with decompression
+	asked for
+*/
+void bench_req_json(int which)
+{
+	struct http_request_opts opts = http_default_opts;
+	opts.decompress = 1;
+	struct http_response *hresp = http_get_opts(bench_req_url[which], NULL, &opts);
+	if(hresp == NULL)
+	{
+		printf("Request to the bench server failed\n");
+		exit(1);
+	}
+	bench_sink += hresp->body_len;
+	http_response_free(hresp);
+}
+
+void bench_req_json_plain(int i) { (void)i; bench_req_json(6); }
+void bench_req_json_gzip(int i) { (void)i; bench_req_json(7); }
+
+void bench_req_0(int i) { (void)i; bench_http_req(0); }
+void bench_req_1k(int i) { (void)i; bench_http_req(1); }
+void bench_req_16k(int i) { (void)i; bench_http_req(2); }
+void bench_req_256k(int i) { (void)i; bench_http_req(3); }
+void bench_req_1m(int i) { (void)i; bench_http_req(4); }
+void bench_req_chunked(int i) { (void)i; bench_http_req(5); }
+
+struct bench benches[] = {
+	{ "parse_url", bench_parse_url },
+	{ "url_parse", bench_url_parse },
+	{ "str_replace", bench_str_replace },
+	{ "get_until", bench_get_until },
+	{ "str_contains", bench_str_contains },
+	{ "base64_encode", bench_base64_encode },
+	{ "base64_decode", bench_base64_decode },
+	{ "base64_encode/64k", bench_base64_encode_64k },
+	{ "base64_decode/64k", bench_base64_decode_64k },
+	{ "urlencode", bench_urlencode },
+	{ "urldecode", bench_urldecode },
+	{ "urlencode/64k", bench_urlencode_64k },
+	{ "url_query/24", bench_url_query },
+	{ "parse_response/0", bench_parse_0 },
+	{ "parse_response/1k", bench_parse_1k },
+	{ "parse_response/16k", bench_parse_16k },
+	{ "parse_response/256k", bench_parse_256k },
+	{ "parse_response/1m", bench_parse_1m },
+	{ "parse_response/chunked64k", bench_parse_chunked },
+	{ "parse_response/headers20", bench_parse_headers },
+	{ "http_req/0", bench_req_0 },
+	{ "http_req/1k", bench_req_1k },
+	{ "http_req/16k", bench_req_16k },
+	{ "http_req/256k", bench_req_256k },
+	{ "http_req/1m", bench_req_1m },
+	{ "http_req/chunked64k", bench_req_chunked },
+	{ "build_request/parse", bench_build_request },
+	{ "build_request/template", bench_build_template },
+	{ "http_req/template1k", bench_req_template },
+	{ "http_req/json64k", bench_req_json_plain },
+	{ "http_req/json64k-gzip", bench_req_json_gzip },
+	{ "header_lookup/scan", bench_header_scan },
+	{ "header_lookup/build", bench_header_build },
+	{ "header_lookup/map", bench_header_map },
+	{ NULL, NULL }
+};
+
+/*
+	Runs a benchmark with a doubling number of iterations until one run
+	takes at least min_ns, and reports that run
+*/
+void bench_run(struct bench *b, long long min_ns)
+{
+	long long iterations = 1;
+	long long elapsed;
+	size_t count, bytes;
+	b->op(0);
+	for(;;)
+	{
+		long long i;
+		http_alloc_count = 0;
+		http_alloc_bytes = 0;
+		long long start = bench_now_ns();
+		for(i = 0; i < iterations; i++)
+			b->op((int)i);
+		elapsed = bench_now_ns() - start;
+		count = http_alloc_count;
+		bytes = http_alloc_bytes;
+		if(elapsed >= min_ns || iterations >= (1LL << 30))
+			break;
+		iterations *= 2;
+	}
+	printf("%-28s %12lld %12.1f ns/op %8.2f allocs/op %12.1f B/op\n", b->name, iterations,
+		(double)elapsed / iterations, (double)count / iterations, (double)bytes / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = argc > 1 ? argv[1] : "";
+	long long min_ns = (argc > 2 ? atoll(argv[2]) : 200) * 1000000LL;
+	const char *simd = argc > 3 ? argv[3] : NULL;
+	const char *simd_names[] = { "scalar", "sse2", "avx2" };
+	struct bench *b;
+	int i;
+
+	http_scanner_select();
+	for(i = 0; simd != NULL && i < 3; i++)
+	{
+		if(strcmp(simd, simd_names[i]) == 0 && http_scanner_use((enum http_simd)i) < 0)
+		{
+			printf("This CPU does not support %s\n", simd);
+			return 1;
+		}
+	}
+	printf("scanner: %s\n", simd_names[http_scanner.simd]);
+
+	bench_make_urls();
+	bench_make_strings();
+	bench_make_responses();
+	if(bench_start_server() != 0)
+	{
+		printf("Could not start the bench server\n");
+		return 1;
+	}
+	bench_template = http_template_new("GET", bench_req_url[1], "Accept:*/*\r\n");
+	bench_headers = http_get(bench_req_url[1], NULL);
+
+	for(b = benches; b->name != NULL; b++)
+	{
+		if(strstr(b->name, filter) != NULL)
+			bench_run(b, min_ns);
+	}
+	return 0;
+}
@@ -0,0 +1,533 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	End-to-end load test. Starts a stub HTTP/1.1 server on 127.0.0.1 and
+	drives http_get/http_post/http_head against it from a number of threads,
+	then reports throughput and latency percentiles, split by phase through
+	the metrics hook.
+
+	The stub server routes:
+		/size/N				N bytes with a Content-Length
+		/chunked/N/C		N bytes in chunks of C bytes
+		/drip/N/MS			N bytes in 16 byte chunks, MS milliseconds apart
+		/redirect/K			K redirects before landing on /size/16
+	POST requests have their body read and get the same responses.
+
+	Usage: http-client-loadtest [-c concurrency] [-n requests | -d seconds]
+		[-m GET|POST|HEAD] [-b post_bytes] [-p path] [-u url] [-s]
+*/
+#include "http-client-c.h"
+#include <netinet/tcp.h>
+
+#define LT_PATTERN_SIZE 65536
+#define LT_PHASES 6
+
+const char *lt_phase_names[LT_PHASES] = { "dns", "connect", "send", "ttfb", "body", "total" };
+
+/*
+	Represents the load test settings
+*/
+struct lt_config
+{
+	int concurrency;
+	long long requests;
+	long long duration_ms;
+	const char *method;
+	int post_bytes;
+	const char *path;
+	const char *url;
+	int serve_only;
+};
+
+struct lt_config lt_cfg = { 8, 0, 5000, "GET", 256, "/size/1024", NULL, 0 };
+
+/*
+	Represents the latency samples of one phase
+*/
+struct lt_samples
+{
+	long long *values;
+	size_t count;
+	size_t cap;
+};
+
+/*
+	Represents one worker thread. The phase durations of the responses to a
+	call, redirects included, are summed in current by the metrics hook.
+*/
+struct lt_worker
+{
+	pthread_t thread;
+	struct lt_samples phases[LT_PHASES];
+	long long current[LT_PHASES];
+	long long errors;
+	long long bytes;
+};
+
+char lt_url[512];
+int lt_port = 0;
+char *lt_post_data = NULL;
+char lt_pattern[LT_PATTERN_SIZE];
+long long lt_issued = 0;
+long long lt_deadline = 0;
+long long lt_conn_events[HTTP_CONN_CLOSED + 1];
+http_mutex lt_lock = HTTP_MUTEX_INIT;
+HTTP_THREAD_LOCAL struct lt_worker *lt_self = NULL;
+
+/*
+	Returns a monotonic timestamp in nanoseconds
+*/
+long long lt_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+	Sends a status line and headers
+*/
+int lt_send_head(int sock, int status, const char *reason, const char *headers)
+{
+	char head[512];
+	int len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nServer: loadtest\r\n%s\r\n", status, reason, headers);
+	return http_send_all(sock, head, len);
+}
+
+/*
+	Sends n bytes of the body pattern
+*/
+int lt_send_pattern(int sock, long long n)
+{
+	while(n > 0)
+	{
+		int len = n > LT_PATTERN_SIZE ? LT_PATTERN_SIZE : (int)n;
+		if(http_send_all(sock, lt_pattern, len) < 0)
+			return -1;
+		n -= len;
+	}
+	return 0;
+}
+
+/*
+	Sends n bytes of the body pattern as chunks of size bytes, pausing
+	delay_ms between chunks
+*/
+int lt_send_chunked(int sock, long long n, long long size, int delay_ms)
+{
+	char line[32];
+	if(size <= 0 || size > LT_PATTERN_SIZE)
+		size = LT_PATTERN_SIZE;
+	while(n > 0)
+	{
+		long long len = n > size ? size : n;
+		int line_len = sprintf(line, "%llx\r\n", len);
+		if(http_send_all(sock, line, line_len) < 0 || http_send_all(sock, lt_pattern, (size_t)len) < 0 || http_send_all(sock, "\r\n", 2) < 0)
+			return -1;
+		n -= len;
+		if(delay_ms > 0 && n > 0)
+			usleep(delay_ms * 1000);
+	}
+	return http_send_all(sock, "0\r\n\r\n", 5);
+}
+
+/*
+	Answers one request of the stub server
+*/
+int lt_respond(int sock, const char *path, int is_head)
+{
+	char headers[256];
+	long long a = 0, b = 0, c = 0;
+
+	if(sscanf(path, "/size/%lld", &a) == 1)
+	{
+		sprintf(headers, "Content-Length: %lld\r\n", a);
+		if(lt_send_head(sock, 200, "OK", headers) < 0)
+			return -1;
+		return is_head ? 0 : lt_send_pattern(sock, a);
+	}
+	if(sscanf(path, "/chunked/%lld/%lld", &a, &b) == 2 || sscanf(path, "/drip/%lld/%lld", &a, &c) == 2)
+	{
+		if(lt_send_head(sock, 200, "OK", "Transfer-Encoding: chunked\r\n") < 0)
+			return -1;
+		if(is_head)
+			return 0;
+		return c > 0 ? lt_send_chunked(sock, a, 16, (int)c) : lt_send_chunked(sock, a, b, 0);
+	}
+	if(sscanf(path, "/redirect/%lld", &a) == 1)
+	{
+		if(a > 0)
+			sprintf(headers, "Location: http://127.0.0.1:%d/redirect/%lld\r\nContent-Length: 0\r\n", lt_port, a - 1);
+		else
+			sprintf(headers, "Location: http://127.0.0.1:%d/size/16\r\nContent-Length: 0\r\n", lt_port);
+		return lt_send_head(sock, 302, "Found", headers);
+	}
+	return lt_send_head(sock, 404, "Not Found", "Content-Length: 0\r\n");
+}
+
+/*
+	Serves the requests of one connection of the stub server
+*/
+void* lt_server_conn(void *arg)
+{
+	int sock = (int)(long)arg;
+	struct str_buffer in;
+	str_buffer_init(&in);
+	for(;;)
+	{
+		char *end;
+		char method[16], path[256];
+		while((end = strstr(in.data != NULL ? in.data : "", "\r\n\r\n")) == NULL)
+		{
+			int n;
+			str_buffer_reserve(&in, 4096);
+			n = recv(sock, in.data + in.len, in.cap - in.len - 1, 0);
+			if(n <= 0)
+				goto done;
+			str_buffer_commit(&in, n);
+		}
+		size_t head_len = end + 4 - in.data;
+		if(sscanf(in.data, "%15s %255s", method, path) != 2)
+			goto done;
+
+		/* Read and drop a request body */
+		long long body = 0;
+		char *length = strstr(in.data, "Content-Length:");
+		if(length != NULL && length < end)
+			body = atoll(length + strlen("Content-Length:"));
+		while((long long)(in.len - head_len) < body)
+		{
+			int n;
+			str_buffer_reserve(&in, 65536);
+			n = recv(sock, in.data + in.len, in.cap - in.len - 1, 0);
+			if(n <= 0)
+				goto done;
+			str_buffer_commit(&in, n);
+		}
+		if(lt_respond(sock, path, strcmp(method, "HEAD") == 0) < 0)
+			goto done;
+		str_buffer_consume(&in, head_len + body);
+	}
+done:
+	str_buffer_free(&in);
+	http_close_socket(sock);
+	return NULL;
+}
+
+/*
+	Accepts connections of the stub server, one thread each
+*/
+void* lt_server(void *arg)
+{
+	int listener = (int)(long)arg;
+	for(;;)
+	{
+		pthread_t thread;
+		int one = 1;
+		int sock = accept(listener, NULL, NULL);
+		if(sock < 0)
+			continue;
+
+		/* Heads and bodies go out in separate writes, do not hold them back */
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if(pthread_create(&thread, NULL, lt_server_conn, (void*)(long)sock) != 0)
+		{
+			http_close_socket(sock);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+/*
+	Starts the stub server on an ephemeral port, returns the port
+*/
+int lt_start_server()
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	pthread_t thread;
+	int one = 1;
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener < 0)
+		return -1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, SOMAXCONN) < 0)
+		return -1;
+	getsockname(listener, (struct sockaddr*)&addr, &len);
+	lt_port = ntohs(addr.sin_port);
+	if(pthread_create(&thread, NULL, lt_server, (void*)(long)listener) != 0)
+		return -1;
+	pthread_detach(thread);
+	return lt_port;
+}
+
+/*
+	Records a latency sample
+*/
+void lt_record(struct lt_samples *samples, long long ns)
+{
+	if(samples->count == samples->cap)
+	{
+		size_t cap = samples->cap > 0 ? samples->cap * 2 : 4096;
+		long long *values = (long long*)realloc(samples->values, cap * sizeof(long long));
+		if(values == NULL)
+			return;
+		samples->values = values;
+		samples->cap = cap;
+	}
+	samples->values[samples->count++] = ns;
+}
+
+/*
+	Metrics hook, adds the phases of a response to the calling worker
+*/
+void lt_on_response(const struct http_response *hresp, void *data)
+{
+	(void)data;
+	if(lt_self == NULL)
+		return;
+	lt_self->current[0] += hresp->timing.dns;
+	lt_self->current[1] += hresp->timing.connect;
+	lt_self->current[2] += hresp->timing.send;
+	lt_self->current[3] += hresp->timing.ttfb;
+	lt_self->current[4] += hresp->timing.body;
+}
+
+/*
+	Metrics hook, counts connection events
+*/
+void lt_on_conn(enum http_conn_event event, const char *host, int port, void *data)
+{
+	(void)host;
+	(void)port;
+	(void)data;
+	http_mutex_lock(&lt_lock);
+	lt_conn_events[event]++;
+	http_mutex_unlock(&lt_lock);
+}
+
+/*
+	Takes the next request, returns 0 once the run is over
+*/
+int lt_take()
+{
+	int more;
+	if(lt_cfg.requests <= 0)
+		return lt_now_ns() < lt_deadline;
+	http_mutex_lock(&lt_lock);
+	more = lt_issued < lt_cfg.requests;
+	if(more)
+		lt_issued++;
+	http_mutex_unlock(&lt_lock);
+	return more;
+}
+
+/*
+	Worker thread, issues requests until the run is over
+*/
+void* lt_work(void *arg)
+{
+	struct lt_worker *worker = (struct lt_worker*)arg;
+	lt_self = worker;
+	while(lt_take())
+	{
+		struct http_response *hresp;
+		int i;
+		memset(worker->current, 0, sizeof(worker->current));
+		long long start = lt_now_ns();
+		if(strcmp(lt_cfg.method, "POST") == 0)
+			hresp = http_post(lt_url, NULL, lt_post_data);
+		else if(strcmp(lt_cfg.method, "HEAD") == 0)
+			hresp = http_head(lt_url, NULL);
+		else
+			hresp = http_get(lt_url, NULL);
+		long long elapsed = lt_now_ns() - start;
+
+		if(hresp == NULL || hresp->status_code_int >= 400)
+		{
+			worker->errors++;
+		}
+		else
+		{
+			worker->current[LT_PHASES - 1] = elapsed;
+			for(i = 0; i < LT_PHASES; i++)
+				lt_record(&worker->phases[i], worker->current[i]);
+			worker->bytes += hresp->body_len;
+		}
+		http_response_free(hresp);
+	}
+	return NULL;
+}
+
+int lt_compare(const void *a, const void *b)
+{
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+	Returns the p-th percentile of sorted samples, in milliseconds
+*/
+double lt_percentile(long long *sorted, size_t count, double p)
+{
+	if(count == 0)
+		return 0;
+	size_t index = (size_t)(p * count);
+	if(index >= count)
+		index = count - 1;
+	return sorted[index] / 1e6;
+}
+
+void lt_usage()
+{
+	printf("Usage: http-client-loadtest [-c concurrency] [-n requests | -d seconds]\n");
+	printf("\t[-m GET|POST|HEAD] [-b post_bytes] [-p path] [-u url] [-s]\n");
+	printf("Paths: /size/N /chunked/N/C /drip/N/MS /redirect/K\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	for(i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if(strcmp(arg, "-s") == 0)
+		{
+			lt_cfg.serve_only = 1;
+			continue;
+		}
+		if(value == NULL)
+		{
+			lt_usage();
+			return 1;
+		}
+		i++;
+		if(strcmp(arg, "-c") == 0)
+			lt_cfg.concurrency = atoi(value);
+		else if(strcmp(arg, "-n") == 0)
+			lt_cfg.requests = atoll(value);
+		else if(strcmp(arg, "-d") == 0)
+			lt_cfg.duration_ms = (long long)(atof(value) * 1000);
+		else if(strcmp(arg, "-m") == 0)
+			lt_cfg.method = value;
+		else if(strcmp(arg, "-b") == 0)
+			lt_cfg.post_bytes = atoi(value);
+		else if(strcmp(arg, "-p") == 0)
+			lt_cfg.path = value;
+		else if(strcmp(arg, "-u") == 0)
+			lt_cfg.url = value;
+		else
+		{
+			lt_usage();
+			return 1;
+		}
+	}
+	if(lt_cfg.concurrency < 1)
+		lt_cfg.concurrency = 1;
+
+	for(i = 0; i < LT_PATTERN_SIZE; i++)
+		lt_pattern[i] = 'a' + i % 26;
+	lt_post_data = (char*)malloc(lt_cfg.post_bytes + 1);
+	memset(lt_post_data, 'x', lt_cfg.post_bytes);
+	lt_post_data[lt_cfg.post_bytes] = '\0';
+
+	/* Target the stub server unless a url is given */
+	if(lt_cfg.url != NULL)
+	{
+		snprintf(lt_url, sizeof(lt_url), "%s", lt_cfg.url);
+	}
+	else
+	{
+		int port = lt_start_server();
+		if(port < 0)
+		{
+			printf("Could not start the stub server\n");
+			return 1;
+		}
+		snprintf(lt_url, sizeof(lt_url), "http://127.0.0.1:%d%s", port, lt_cfg.path);
+		if(lt_cfg.serve_only)
+		{
+			printf("Serving on http://127.0.0.1:%d\n", port);
+			for(;;)
+				pause();
+		}
+	}
+
+	/* Keep a connection per worker in the pool */
+	http_pool_configure(lt_cfg.concurrency, 30000);
+	http_set_metrics_hook(lt_on_response, lt_on_conn, NULL);
+
+	struct lt_worker *workers = (struct lt_worker*)calloc(lt_cfg.concurrency, sizeof(struct lt_worker));
+	long long start = lt_now_ns();
+	lt_deadline = start + lt_cfg.duration_ms * 1000000LL;
+	for(i = 0; i < lt_cfg.concurrency; i++)
+		pthread_create(&workers[i].thread, NULL, lt_work, &workers[i]);
+
+	/* Merge the samples, phase by phase */
+	long long errors = 0, bytes = 0;
+	for(i = 0; i < lt_cfg.concurrency; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		errors += workers[i].errors;
+		bytes += workers[i].bytes;
+	}
+	double elapsed = (lt_now_ns() - start) / 1e9;
+	size_t count = 0;
+	for(i = 0; i < lt_cfg.concurrency; i++)
+		count += workers[i].phases[0].count;
+
+	printf("%s %s, concurrency %d\n", lt_cfg.method, lt_url, lt_cfg.concurrency);
+	printf("requests %lu, errors %lld, %.2f s\n", (unsigned long)count, errors, elapsed);
+	printf("throughput %.1f req/s, %.2f MB/s\n", count / elapsed, bytes / elapsed / 1048576.0);
+	printf("connections opened %lld, reused %lld, stale %lld\n", lt_conn_events[HTTP_CONN_OPENED],
+		lt_conn_events[HTTP_CONN_REUSED], lt_conn_events[HTTP_CONN_STALE]);
+	printf("%-10s %10s %10s %10s %10s   (ms)\n", "phase", "p50", "p99", "p999", "max");
+
+	long long *samples = (long long*)malloc((count > 0 ? count : 1) * sizeof(long long));
+	int phase;
+	for(phase = 0; phase < LT_PHASES; phase++)
+	{
+		size_t n = 0;
+		for(i = 0; i < lt_cfg.concurrency; i++)
+		{
+			struct lt_samples *own = &workers[i].phases[phase];
+			memcpy(samples + n, own->values, own->count * sizeof(long long));
+			n += own->count;
+			free(own->values);
+		}
+		qsort(samples, n, sizeof(long long), lt_compare);
+		printf("%-10s %10.3f %10.3f %10.3f %10.3f\n", lt_phase_names[phase],
+			lt_percentile(samples, n, 0.50), lt_percentile(samples, n, 0.99),
+			lt_percentile(samples, n, 0.999), n > 0 ? samples[n - 1] / 1e6 : 0.0);
+	}
+
+	free(samples);
+	free(workers);
+	free(lt_post_data);
+	http_pool_flush();
+	return errors > 0;
+}
@@ -0,0 +1,402 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Arena allocator. While an arena is active on a thread, every allocation
+	the library makes for a request (parsed url, headers, response, body)
+	comes out of the arena's blocks. Freeing such memory is a no-op, all of
+	it is released at once by http_arena_reset. Without an active arena the
+	library allocates from the heap as usual.
+*/
+#define HTTP_ARENA_ALIGN 16
+#define HTTP_ARENA_BLOCK_HEADER ((sizeof(struct http_arena_block) + HTTP_ARENA_ALIGN - 1) & ~(size_t)(HTTP_ARENA_ALIGN - 1))
+
+/*
+	Represents a block of arena memory, its data follows the header
+*/
+struct http_arena_block
+{
+	struct http_arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+/*
+	Represents a slot of the arena's block index: a granule of the address
+	space and a block that overlaps it. A granule two blocks share has a
+	slot for each.
+*/
+struct http_arena_slot
+{
+	size_t granule;
+	struct http_arena_block *block;		/* NULL for an empty slot */
+};
+
+/*
+	Represents an arena
+*/
+struct http_arena
+{
+	struct http_arena_block *blocks;	/* block being filled first */
+	size_t block_size;
+	char *last;							/* latest allocation, may grow in place */
+	struct http_arena_slot *index;		/* finds the block of a pointer, open addressing */
+	size_t index_cap;					/* a power of two, kept at least twice index_count */
+	size_t index_count;
+	unsigned int granule_shift;			/* granules are the block size rounded up to a power of two */
+};
+
+HTTP_THREAD_LOCAL struct http_arena *http_current_arena = NULL;
+
+/*
+	Allocation counters for this thread, kept when built with
+	HTTP_ALLOC_STATS. Used by the benchmarks to report allocations per call.
+*/
+#ifdef HTTP_ALLOC_STATS
+	HTTP_THREAD_LOCAL size_t http_alloc_count = 0;
+	HTTP_THREAD_LOCAL size_t http_alloc_bytes = 0;
+	#define HTTP_ALLOC_COUNT(size) (http_alloc_count++, http_alloc_bytes += (size))
+#else
+	#define HTTP_ALLOC_COUNT(size)
+#endif
+
+/*
+	Creates an arena that allocates in blocks of block_size bytes
+*/
+struct http_arena* http_arena_new(size_t block_size)
+{
+	struct http_arena *arena = (struct http_arena*)malloc(sizeof(struct http_arena));
+	if(arena == NULL)
+		return NULL;
+	arena->blocks = NULL;
+	arena->block_size = block_size > 0 ? block_size : 16384;
+	arena->last = NULL;
+	arena->index = NULL;
+	arena->index_cap = 0;
+	arena->index_count = 0;
+	arena->granule_shift = 12;
+	while(((size_t)1 << arena->granule_shift) < arena->block_size)
+		arena->granule_shift++;
+	return arena;
+}
+
+/*
+	Makes the arena the one the library allocates from on this thread
+*/
+void http_arena_begin(struct http_arena *arena)
+{
+	http_current_arena = arena;
+}
+
+/*
+	Goes back to heap allocation on this thread
+*/
+void http_arena_end()
+{
+	http_current_arena = NULL;
+}
+
+/*
+	Returns the data area of a block
+*/
+char* http_arena_block_data(struct http_arena_block *block)
+{
+	return (char*)block + HTTP_ARENA_BLOCK_HEADER;
+}
+
+/*
+	Tells whether a pointer lies in the data area of a block
+*/
+int http_arena_block_has(struct http_arena_block *block, const void *ptr)
+{
+	char *data = http_arena_block_data(block);
+	return (const char*)ptr >= data && (const char*)ptr < data + block->size;
+}
+
+/*
+	Returns the first slot to probe for a granule
+*/
+size_t http_arena_slot_of(struct http_arena *arena, size_t granule)
+{
+	return (size_t)(((unsigned long long)granule * 0x9E3779B97F4A7C15ULL) >> 32) & (arena->index_cap - 1);
+}
+
+/*
+	Adds a slot to the index, which has room for it
+*/
+void http_arena_index_put(struct http_arena *arena, size_t granule, struct http_arena_block *block)
+{
+	size_t i = http_arena_slot_of(arena, granule);
+	while(arena->index[i].block != NULL)
+		i = (i + 1) & (arena->index_cap - 1);
+	arena->index[i].granule = granule;
+	arena->index[i].block = block;
+	arena->index_count++;
+}
+
+/*
+	Adds the granules a block overlaps to the index, growing it first so
+	adding cannot fail halfway. Returns -1 if the index could not grow.
+*/
+int http_arena_index_add(struct http_arena *arena, struct http_arena_block *block)
+{
+	size_t first = (size_t)http_arena_block_data(block) >> arena->granule_shift;
+	size_t last = ((size_t)http_arena_block_data(block) + block->size - 1) >> arena->granule_shift;
+	size_t need = (arena->index_count + last - first + 1) * 2;
+	if(need > arena->index_cap)
+	{
+		size_t cap = arena->index_cap > 0 ? arena->index_cap : 64;
+		while(cap < need)
+			cap *= 2;
+		struct http_arena_slot *old = arena->index;
+		size_t old_cap = arena->index_cap;
+		struct http_arena_slot *index = (struct http_arena_slot*)calloc(cap, sizeof(struct http_arena_slot));
+		if(index == NULL)
+			return -1;
+		arena->index = index;
+		arena->index_cap = cap;
+		arena->index_count = 0;
+		size_t i;
+		for(i = 0; i < old_cap; i++)
+		{
+			if(old[i].block != NULL)
+				http_arena_index_put(arena, old[i].granule, old[i].block);
+		}
+		free(old);
+	}
+	size_t granule;
+	for(granule = first; granule <= last; granule++)
+		http_arena_index_put(arena, granule, block);
+	return 0;
+}
+
+/*
+	Finds the block of the arena a pointer was allocated from, NULL if the
+	pointer does not belong to the arena. The block being filled is checked
+	first, the others are found through the index without walking them.
+*/
+struct http_arena_block* http_arena_owner(struct http_arena *arena, const void *ptr)
+{
+	if(arena->blocks == NULL)
+		return NULL;
+	if(http_arena_block_has(arena->blocks, ptr))
+		return arena->blocks;
+	size_t granule = (size_t)ptr >> arena->granule_shift;
+	size_t i = http_arena_slot_of(arena, granule);
+	while(arena->index[i].block != NULL)
+	{
+		if(arena->index[i].granule == granule && http_arena_block_has(arena->index[i].block, ptr))
+			return arena->index[i].block;
+		i = (i + 1) & (arena->index_cap - 1);
+	}
+	return NULL;
+}
+
+/*
+	Allocates from the arena. Each allocation is preceded by its size so it
+	can be reallocated. Allocations larger than a block get a block of their
+	own, kept behind the block being filled.
+*/
+void* http_arena_alloc(struct http_arena *arena, size_t size)
+{
+	size_t need = HTTP_ARENA_ALIGN + ((size + HTTP_ARENA_ALIGN - 1) & ~(size_t)(HTTP_ARENA_ALIGN - 1));
+	struct http_arena_block *block = arena->blocks;
+	if(block == NULL || block->used + need > block->size)
+	{
+		size_t block_size = need > arena->block_size ? need : arena->block_size;
+		struct http_arena_block *fresh = (struct http_arena_block*)malloc(HTTP_ARENA_BLOCK_HEADER + block_size);
+		if(fresh == NULL)
+			return NULL;
+		fresh->size = block_size;
+		fresh->used = 0;
+		if(http_arena_index_add(arena, fresh) < 0)
+		{
+			free(fresh);
+			return NULL;
+		}
+		if(block != NULL && need > arena->block_size)
+		{
+			fresh->next = block->next;
+			block->next = fresh;
+		}
+		else
+		{
+			fresh->next = block;
+			arena->blocks = fresh;
+		}
+		block = fresh;
+	}
+	char *p = http_arena_block_data(block) + block->used;
+	*(size_t*)p = size;
+	block->used += need;
+	arena->last = p + HTTP_ARENA_ALIGN;
+	return arena->last;
+}
+
+/*
+	Releases everything allocated from the arena. The first block is kept
+	so the arena can be reused for the next request without new mallocs.
+*/
+void http_arena_reset(struct http_arena *arena)
+{
+	struct http_arena_block *keep = NULL;
+	struct http_arena_block *block = arena->blocks;
+	while(block != NULL)
+	{
+		struct http_arena_block *next = block->next;
+		if(keep == NULL && block->size == arena->block_size)
+		{
+			keep = block;
+			keep->used = 0;
+			keep->next = NULL;
+		}
+		else
+		{
+			free(block);
+		}
+		block = next;
+	}
+	arena->blocks = keep;
+	arena->last = NULL;
+
+	/* The index has room for the kept block, it had it before */
+	if(arena->index != NULL)
+	{
+		memset(arena->index, 0, arena->index_cap * sizeof(struct http_arena_slot));
+		arena->index_count = 0;
+		if(keep != NULL)
+			http_arena_index_add(arena, keep);
+	}
+}
+
+/*
+	Frees an arena and all memory allocated from it
+*/
+void http_arena_free(struct http_arena *arena)
+{
+	if(arena != NULL)
+	{
+		if(http_current_arena == arena)
+			http_current_arena = NULL;
+		http_arena_reset(arena);
+		free(arena->blocks);
+		free(arena->index);
+		free(arena);
+	}
+}
+
+/*
+	Allocates memory for a request, from the active arena if there is one
+*/
+void* http_malloc(size_t size)
+{
+	HTTP_ALLOC_COUNT(size);
+	if(http_current_arena != NULL)
+		return http_arena_alloc(http_current_arena, size);
+	return malloc(size);
+}
+
+/*
+	Allocates zeroed memory for a request
+*/
+void* http_calloc(size_t count, size_t size)
+{
+	HTTP_ALLOC_COUNT(count * size);
+	if(http_current_arena != NULL)
+	{
+		void *ptr = http_arena_alloc(http_current_arena, count * size);
+		if(ptr != NULL)
+			memset(ptr, 0, count * size);
+		return ptr;
+	}
+	return calloc(count, size);
+}
+
+/*
+	Resizes memory allocated with http_malloc. The latest arena allocation
+	grows in place when its block has room, others are copied.
+*/
+void* http_realloc(void *ptr, size_t size)
+{
+	HTTP_ALLOC_COUNT(size);
+	struct http_arena *arena = http_current_arena;
+	struct http_arena_block *block = arena != NULL && ptr != NULL ? http_arena_owner(arena, ptr) : NULL;
+	if(block == NULL)
+	{
+		if(arena != NULL && ptr == NULL)
+			return http_arena_alloc(arena, size);
+		return realloc(ptr, size);
+	}
+
+	size_t *header = (size_t*)((char*)ptr - HTTP_ARENA_ALIGN);
+	size_t old_size = *header;
+	if(size <= old_size)
+	{
+		*header = size;
+		return ptr;
+	}
+	if((char*)ptr == arena->last)
+	{
+		size_t old_need = (old_size + HTTP_ARENA_ALIGN - 1) & ~(size_t)(HTTP_ARENA_ALIGN - 1);
+		size_t new_need = (size + HTTP_ARENA_ALIGN - 1) & ~(size_t)(HTTP_ARENA_ALIGN - 1);
+		if(block->used - old_need + new_need <= block->size)
+		{
+			block->used += new_need - old_need;
+			*header = size;
+			return ptr;
+		}
+	}
+	void *fresh = http_arena_alloc(arena, size);
+	if(fresh != NULL)
+		memcpy(fresh, ptr, old_size);
+	return fresh;
+}
+
+/*
+	Frees memory allocated with http_malloc. Arena memory is left alone, it
+	goes with the next http_arena_reset.
+*/
+void http_free(void *ptr)
+{
+	if(ptr == NULL)
+		return;
+	if(http_current_arena != NULL && http_arena_owner(http_current_arena, ptr) != NULL)
+		return;
+	free(ptr);
+}
+
+/*
+	Copies a string on the heap, bypassing any arena. Used for data kept
+	beyond a request, such as the keys of the connection pool and DNS cache.
+*/
+char* http_heap_strdup(const char *src)
+{
+	char *tmp = (char*)malloc(strlen(src) + 1);
+	if(tmp)
+		strcpy(tmp, src);
+	return tmp;
+}
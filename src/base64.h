@@ -0,0 +1,282 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+
+/*
+	Base64 with explicit lengths, so any bytes can be encoded, writing into
+	buffers the caller provides. On CPUs with AVX2 24 bytes are encoded, or
+	32 characters decoded, per step; otherwise and for the last bytes a
+	table is used. The instruction set follows http_scanner.
+*/
+const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+	The value of each base64 character, -1 for anything else
+*/
+const signed char base64_values[256] =
+{
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+	Returns the length of the encoding of len bytes, padding included
+*/
+size_t base64_encoded_len(size_t len)
+{
+	return (len + 2) / 3 * 4;
+}
+
+/*
+	Returns how many bytes decoding len characters writes at most
+*/
+size_t base64_decoded_max(size_t len)
+{
+	return (len + 3) / 4 * 3;
+}
+
+#ifdef HTTP_HAVE_AVX2
+/*
+	Encodes 24 bytes into 32 characters for as long as 28 bytes can be read,
+	returns how many bytes were encoded. Each lane spreads 12 bytes over
+	16 6-bit indices and turns them into characters by adding the offset of
+	their range of the alphabet.
+*/
+__attribute__((target("avx2")))
+size_t base64_encode_avx2(char *dst, const unsigned char *src, size_t len)
+{
+	const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0,
+		71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0);
+	size_t done = 0;
+	while(len - done >= 28)
+	{
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + done))),
+			_mm_loadu_si128((const __m128i*)(src + done + 12)), 1);
+		in = _mm256_shuffle_epi8(in, spread);
+		__m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i bd = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		__m256i indices = _mm256_or_si256(ac, bd);
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+		__m256i out = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range));
+		_mm256_storeu_si256((__m256i*)(dst + done / 3 * 4), out);
+		done += 24;
+	}
+	return done;
+}
+
+/*
+	Decodes 32 characters into 24 bytes at a time, stopping at the first
+	block with anything but base64 characters in it (padding included).
+	Returns how many characters were decoded.
+*/
+__attribute__((target("avx2")))
+size_t base64_decode_avx2(unsigned char *dst, const char *src, size_t len)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	size_t done = 0;
+	while(len - done >= 32)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(src + done));
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+		__m256i lo = _mm256_and_si256(in, nibble);
+		if(!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi)))
+			break;
+		__m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+		__m256i values = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slash, hi)));
+		__m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		__m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+		out = _mm256_shuffle_epi8(out, pack);
+		out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+		_mm_storeu_si128((__m128i*)(dst + done / 4 * 3), _mm256_castsi256_si128(out));
+		_mm_storel_epi64((__m128i*)(dst + done / 4 * 3 + 16), _mm256_extracti128_si256(out, 1));
+		done += 32;
+	}
+	return done;
+}
+#endif
+
+/*
+	Encodes len bytes of src into dst, which must have room for
+	base64_encoded_len(len) characters. dst is not terminated. Returns the
+	number of characters written.
+*/
+size_t base64_encode_to(char *dst, const void *src, size_t len)
+{
+	const unsigned char *in = (const unsigned char*)src;
+	size_t i = 0;
+	char *out;
+	#ifdef HTTP_HAVE_AVX2
+		http_scanner_select();
+		if(http_scanner.simd == HTTP_SIMD_AVX2)
+			i = base64_encode_avx2(dst, in, len);
+	#endif
+	out = dst + i / 3 * 4;
+	for(; len - i >= 3; i += 3)
+	{
+		unsigned int triple = (unsigned int)in[i] << 16 | (unsigned int)in[i + 1] << 8 | in[i + 2];
+		out[0] = base64_alphabet[triple >> 18];
+		out[1] = base64_alphabet[(triple >> 12) & 0x3f];
+		out[2] = base64_alphabet[(triple >> 6) & 0x3f];
+		out[3] = base64_alphabet[triple & 0x3f];
+		out += 4;
+	}
+	if(i < len)
+	{
+		unsigned int triple = (unsigned int)in[i] << 16 | (len - i > 1 ? (unsigned int)in[i + 1] << 8 : 0);
+		out[0] = base64_alphabet[triple >> 18];
+		out[1] = base64_alphabet[(triple >> 12) & 0x3f];
+		out[2] = len - i > 1 ? base64_alphabet[(triple >> 6) & 0x3f] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+	return out - dst;
+}
+
+/*
+	Decodes len characters of src into dst, which must have room for
+	base64_decoded_max(len) bytes. The padding may be left out, anything
+	else that is not base64 fails. Returns the number of bytes written, or
+	-1 if src is not valid base64.
+*/
+long base64_decode_to(void *dst, const char *src, size_t len)
+{
+	const unsigned char *in = (const unsigned char*)src;
+	unsigned char *out = (unsigned char*)dst;
+	size_t i = 0;
+
+	/* Padding only ever ends the input */
+	if(len % 4 == 0 && len > 0 && in[len - 1] == '=')
+		len -= in[len - 2] == '=' ? 2 : 1;
+	if(len % 4 == 1)
+		return -1;
+
+	#ifdef HTTP_HAVE_AVX2
+		http_scanner_select();
+		if(http_scanner.simd == HTTP_SIMD_AVX2)
+			i = base64_decode_avx2(out, src, len);
+	#endif
+	out += i / 4 * 3;
+	for(; len - i >= 4; i += 4)
+	{
+		int a = base64_values[in[i]], b = base64_values[in[i + 1]], c = base64_values[in[i + 2]], d = base64_values[in[i + 3]];
+		if((a | b | c | d) < 0)
+			return -1;
+		unsigned int triple = (unsigned int)a << 18 | (unsigned int)b << 12 | (unsigned int)c << 6 | (unsigned int)d;
+		out[0] = (unsigned char)(triple >> 16);
+		out[1] = (unsigned char)(triple >> 8);
+		out[2] = (unsigned char)triple;
+		out += 3;
+	}
+	if(i < len)
+	{
+		int a = base64_values[in[i]], b = base64_values[in[i + 1]], c = len - i > 2 ? base64_values[in[i + 2]] : 0;
+		if((a | b | c) < 0)
+			return -1;
+		unsigned int triple = (unsigned int)a << 18 | (unsigned int)b << 12 | (unsigned int)c << 6;
+		*out++ = (unsigned char)(triple >> 16);
+		if(len - i > 2)
+			*out++ = (unsigned char)(triple >> 8);
+	}
+	return (long)(out - (unsigned char*)dst);
+}
+
+/*
+	Appends the base64 encoding of len bytes to a buffer, returns -1 when
+	out of memory
+*/
+int str_buffer_append_base64(struct str_buffer *buf, const void *src, size_t len)
+{
+	if(str_buffer_reserve(buf, base64_encoded_len(len)) < 0)
+		return -1;
+	str_buffer_commit(buf, base64_encode_to(buf->data + buf->len, src, len));
+	return 0;
+}
+
+/*
+	Encodes a string with Base64
+*/
+char* base64_encode(char *clrstr)
+{
+	size_t len = strlen(clrstr);
+	char *b64dst = (char*)http_malloc(base64_encoded_len(len) + 1);
+	if(b64dst == NULL)
+		return NULL;
+	b64dst[base64_encode_to(b64dst, clrstr, len)] = '\0';
+	return b64dst;
+}
+
+/*
+	Decodes a Base64 string. Characters that are not base64 are skipped and
+	decoding stops at the padding, like it always did.
+*/
+char* base64_decode(char *b64src)
+{
+	size_t len = strlen(b64src);
+	char *clrdst = (char*)http_malloc(len + 4);
+	if(clrdst == NULL)
+		return NULL;
+	long decoded = base64_decode_to(clrdst, b64src, len);
+	if(decoded < 0)
+	{
+		/* Keep only the base64 characters before any padding, in place */
+		size_t i, kept = 0;
+		for(i = 0; i < len && b64src[i] != '='; i++)
+		{
+			if(base64_values[(unsigned char)b64src[i]] >= 0)
+				clrdst[kept++] = b64src[i];
+		}
+		kept -= kept % 4 == 1;
+		decoded = base64_decode_to(clrdst, clrdst, kept);
+	}
+	clrdst[decoded] = '\0';
+	return clrdst;
+}
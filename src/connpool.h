@@ -0,0 +1,205 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Represents an idle keep-alive connection
+*/
+struct http_conn
+{
+	int sock;
+	void *tls;						/* TLS session of an https connection, NULL for plain HTTP */
+	char *host;
+	int port;
+	long long idle_since;
+	struct http_conn *next;
+};
+
+/*
+	Represents the pool of idle connections, keyed by host and port
+*/
+struct http_pool
+{
+	struct http_conn *idle;
+	int max_idle_per_host;
+	long long idle_timeout_ms;
+	http_mutex lock;
+};
+
+struct http_pool http_conn_pool = { NULL, 8, 30000, HTTP_MUTEX_INIT };
+
+/*
+	Sets the maximum number of idle connections kept per host and how long
+	they may stay idle. A max_idle_per_host of 0 disables connection reuse.
+*/
+void http_pool_configure(int max_idle_per_host, long long idle_timeout_ms)
+{
+	http_mutex_lock(&http_conn_pool.lock);
+	http_conn_pool.max_idle_per_host = max_idle_per_host;
+	http_conn_pool.idle_timeout_ms = idle_timeout_ms;
+	http_mutex_unlock(&http_conn_pool.lock);
+}
+
+/*
+	Checks whether an idle socket is still usable. An idle HTTP connection
+	must not be readable: readable means the server closed it or sent junk.
+*/
+int http_pool_sock_alive(int sock)
+{
+	struct pollfd pfd;
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if(poll(&pfd, 1, 0) != 0)
+		return 0;
+	return 1;
+}
+
+/*
+	Frees a pooled connection entry, closing its socket
+*/
+void http_conn_free(struct http_conn *conn)
+{
+	http_tls_close(conn->tls);
+	http_close_socket(conn->sock);
+	free(conn->host);
+	free(conn);
+}
+
+/*
+	Takes an idle https connection to host:port out of the pool, along with
+	its TLS session, so it goes on without a handshake. Expired and dead
+	connections met on the way are evicted. Returns -1 if none is available.
+*/
+int http_pool_acquire_tls(const char *host, int port, void **tls)
+{
+	int sock = -1;
+	long long now = http_now_ms();
+	http_mutex_lock(&http_conn_pool.lock);
+	struct http_conn **link = &http_conn_pool.idle;
+	while(*link != NULL)
+	{
+		struct http_conn *conn = *link;
+		if(now - conn->idle_since > http_conn_pool.idle_timeout_ms)
+		{
+			/* Evict expired connection */
+			*link = conn->next;
+			http_conn_free(conn);
+			continue;
+		}
+		if(conn->port == port && (conn->tls != NULL) == (tls != NULL) && strcmp(conn->host, host) == 0)
+		{
+			*link = conn->next;
+			if(http_pool_sock_alive(conn->sock))
+			{
+				sock = conn->sock;
+				if(tls != NULL)
+					*tls = conn->tls;
+				free(conn->host);
+				free(conn);
+				break;
+			}
+			http_conn_free(conn);
+			continue;
+		}
+		link = &conn->next;
+	}
+	http_mutex_unlock(&http_conn_pool.lock);
+	return sock;
+}
+
+/*
+	Takes an idle plain HTTP connection to host:port out of the pool.
+	Returns -1 if none is available.
+*/
+int http_pool_acquire(const char *host, int port)
+{
+	return http_pool_acquire_tls(host, port, NULL);
+}
+
+/*
+	Hands an https connection and its TLS session back to the pool after a
+	complete response. The connection is closed instead when the host
+	already has enough idle connections.
+*/
+void http_pool_release_tls(const char *host, int port, int sock, void *tls)
+{
+	struct http_conn *conn = (struct http_conn*)malloc(sizeof(struct http_conn));
+	if(conn == NULL)
+	{
+		http_tls_close(tls);
+		http_close_socket(sock);
+		return;
+	}
+	conn->sock = sock;
+	conn->tls = tls;
+	conn->host = http_heap_strdup(host);
+	conn->port = port;
+	conn->idle_since = http_now_ms();
+
+	http_mutex_lock(&http_conn_pool.lock);
+	int count = 0;
+	struct http_conn *cur;
+	for(cur = http_conn_pool.idle; cur != NULL; cur = cur->next)
+	{
+		if(cur->port == port && (cur->tls != NULL) == (tls != NULL) && strcmp(cur->host, host) == 0)
+			count++;
+	}
+	if(conn->host == NULL || count >= http_conn_pool.max_idle_per_host)
+	{
+		http_mutex_unlock(&http_conn_pool.lock);
+		http_conn_free(conn);
+		return;
+	}
+	conn->next = http_conn_pool.idle;
+	http_conn_pool.idle = conn;
+	http_mutex_unlock(&http_conn_pool.lock);
+}
+
+/*
+	Hands a plain HTTP connection back to the pool after a complete response
+*/
+void http_pool_release(const char *host, int port, int sock)
+{
+	http_pool_release_tls(host, port, sock, NULL);
+}
+
+/*
+	Closes all idle connections
+*/
+void http_pool_flush()
+{
+	http_mutex_lock(&http_conn_pool.lock);
+	struct http_conn *conn = http_conn_pool.idle;
+	http_conn_pool.idle = NULL;
+	http_mutex_unlock(&http_conn_pool.lock);
+	while(conn != NULL)
+	{
+		struct http_conn *next = conn->next;
+		http_conn_free(conn);
+		conn = next;
+	}
+}
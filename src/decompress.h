@@ -0,0 +1,185 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Decompresses gzip and deflate response bodies as they arrive, a piece at
+	a time, so a compressed body is never held whole. Needs zlib: build with
+	HTTP_USE_ZLIB defined and link with -lz. Without it bodies are passed on
+	as they came and compression is never asked for.
+*/
+#ifdef HTTP_USE_ZLIB
+	#include <zlib.h>
+#endif
+
+/*
+	Represents the decompression of one response body
+*/
+struct http_decoder
+{
+	int active;						/* the body is compressed and being inflated */
+	int failed;						/* the body was not valid compressed data */
+	#ifdef HTTP_USE_ZLIB
+		int raw;					/* deflate sent without its zlib wrapper */
+		int fed;					/* input has been inflated */
+		int ended;					/* the compressed stream is complete */
+		z_stream z;
+	#endif
+};
+
+/*
+	The codings requests ask for, only defined when they can be decompressed
+*/
+#ifdef HTTP_USE_ZLIB
+	#define HTTP_ACCEPT_ENCODING "Accept-Encoding:gzip, deflate\r\n"
+#endif
+
+/*
+	Sets up a decoder that has not started
+*/
+void http_decoder_init(struct http_decoder *dec)
+{
+	memset(dec, 0, sizeof(struct http_decoder));
+}
+
+/*
+	Starts decompressing a body sent with the given Content-Encoding. Returns
+	1 if it is decompressed, 0 if it is passed on as it is, -1 when out of
+	memory.
+*/
+int http_decoder_start(struct http_decoder *dec, const char *coding, size_t len)
+{
+	#ifdef HTTP_USE_ZLIB
+		int gzip = (len == 4 && str_equal_nocase(coding, "gzip", 4)) || (len == 6 && str_equal_nocase(coding, "x-gzip", 6));
+		int deflate = len == 7 && str_equal_nocase(coding, "deflate", 7);
+		if(!gzip && !deflate)
+			return 0;
+
+		/* 15 + 32 takes both the gzip and the zlib wrapper */
+		memset(&dec->z, 0, sizeof(z_stream));
+		if(inflateInit2(&dec->z, 15 + 32) != Z_OK)
+			return -1;
+		dec->active = 1;
+		return 1;
+	#else
+		(void)dec;
+		(void)coding;
+		(void)len;
+		return 0;
+	#endif
+}
+
+/*
+	Inflates a piece of the body and passes what comes out to on_body.
+	Returns non-zero when the body is not valid compressed data or on_body
+	returned non-zero.
+*/
+int http_decoder_write(struct http_decoder *dec, const char *data, size_t len, int (*on_body)(const char *chunk, size_t len, void *data), void *on_body_data)
+{
+	#ifdef HTTP_USE_ZLIB
+		unsigned char out[16384];
+		dec->z.next_in = (Bytef*)data;
+		dec->z.avail_in = (uInt)len;
+		do
+		{
+			if(dec->ended)
+			{
+				/* Another gzip member may follow, anything else is padding */
+				if(dec->z.avail_in == 0 || dec->z.next_in[0] != 0x1f || inflateReset(&dec->z) != Z_OK)
+					break;
+				dec->ended = 0;
+			}
+			dec->z.next_out = out;
+			dec->z.avail_out = sizeof(out);
+			int ret = inflate(&dec->z, Z_NO_FLUSH);
+			if(ret == Z_DATA_ERROR && !dec->fed && !dec->raw)
+			{
+				/* Some servers send deflate without the zlib wrapper */
+				inflateEnd(&dec->z);
+				memset(&dec->z, 0, sizeof(z_stream));
+				if(inflateInit2(&dec->z, -15) != Z_OK)
+				{
+					dec->active = 0;
+					dec->failed = 1;
+					return -1;
+				}
+				dec->raw = 1;
+				dec->z.next_in = (Bytef*)data;
+				dec->z.avail_in = (uInt)len;
+				continue;
+			}
+			dec->fed = 1;
+			if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			{
+				dec->failed = 1;
+				return -1;
+			}
+			size_t n = sizeof(out) - dec->z.avail_out;
+			if(n > 0 && on_body != NULL && on_body((const char*)out, n, on_body_data) != 0)
+				return -1;
+			if(ret == Z_STREAM_END)
+				dec->ended = 1;
+			else if(n == 0)
+				break;
+		}
+		while(dec->z.avail_in > 0 || dec->z.avail_out == 0);
+		return 0;
+	#else
+		(void)dec;
+		return on_body != NULL ? on_body(data, len, on_body_data) : 0;
+	#endif
+}
+
+/*
+	Checks that a body which went through the decoder ended where the
+	compressed stream does. Returns -1, marking the decoder failed, when the
+	stream was cut short.
+*/
+int http_decoder_finish(struct http_decoder *dec)
+{
+	#ifdef HTTP_USE_ZLIB
+		if(dec->active && dec->fed && !dec->ended)
+		{
+			dec->failed = 1;
+			return -1;
+		}
+	#else
+		(void)dec;
+	#endif
+	return 0;
+}
+
+/*
+	Releases a decoder
+*/
+void http_decoder_end(struct http_decoder *dec)
+{
+	#ifdef HTTP_USE_ZLIB
+		if(dec->active)
+			inflateEnd(&dec->z);
+	#endif
+	dec->active = 0;
+}
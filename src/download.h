@@ -0,0 +1,258 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	How many times an interrupted download is resumed
+*/
+#define HTTP_DOWNLOAD_RESUMES 3
+
+/*
+	Represents a download in progress
+*/
+struct http_download
+{
+	struct http_sink sink;
+	long long offset;				/* where the body of the current response goes in the file */
+	int resumable;					/* fd is a regular file that can be resumed */
+	char *validator;				/* ETag or Last-Modified of the object, for If-Range */
+};
+
+/*
+	Tells whether a validator can go in If-Range, which takes no weak ETags
+*/
+int http_download_strong(const char *validator)
+{
+	return validator != NULL && strncmp(validator, "W/", 2) != 0;
+}
+
+/*
+	Decides where the body of a response goes once its headers are in. A
+	206 must carry on exactly where the file ends, any other 2xx brings the
+	whole object and starts the file over. Other responses are not written.
+*/
+int http_download_on_headers(struct http_response *hresp, void *data)
+{
+	struct http_download *dl = (struct http_download*)data;
+	int status = hresp->status_code_int;
+	dl->sink.active = 0;
+	if(status < 200 || status > 299)
+		return 0;
+	if(status == 206)
+	{
+		char *range = http_header_dup(hresp, "Content-Range");
+		long long start = range != NULL && str_starts_with_nocase(range, "bytes ") ? atoll(range + 6) : -1;
+		http_free(range);
+		if(start != dl->offset)
+		{
+			dl->sink.error = HTTP_ERR_PROTOCOL;
+			return 1;
+		}
+	}
+	else if(dl->offset > 0)
+	{
+		if(http_file_truncate(dl->sink.fd, 0) < 0)
+		{
+			dl->sink.error = HTTP_ERR_FILE;
+			return 1;
+		}
+		dl->offset = 0;
+	}
+
+	/* Remember which version of the object this is, to resume only that */
+	if(status != 206 || dl->validator == NULL)
+	{
+		http_free(dl->validator);
+		dl->validator = http_header_dup(hresp, "ETag");
+		if(!http_download_strong(dl->validator))
+		{
+			http_free(dl->validator);
+			dl->validator = http_header_dup(hresp, "Last-Modified");
+		}
+	}
+	dl->sink.active = 1;
+	return 0;
+}
+
+/*
+	Writes the pieces of the body that did not get spliced
+*/
+int http_download_on_body(const char *chunk, size_t len, void *data)
+{
+	struct http_download *dl = (struct http_download*)data;
+	if(!dl->sink.active)
+		return 0;
+	return http_sink_write(&dl->sink, chunk, len) < 0;
+}
+
+/*
+	Downloads the body of a GET request into a file descriptor, following
+	redirects within the limits of opts. On Linux the body goes from the
+	socket to the file with splice when possible, so it never passes through
+	user space. When validator holds the ETag or Last-Modified of the object
+	the file was filled from, and fd is a regular file with data in it, only
+	the rest is asked for, with a Range request that If-Range ties to that
+	version; otherwise a regular file starts over. A transfer that is cut
+	short is resumed the same way up to HTTP_DOWNLOAD_RESUMES times. On
+	return validator holds that of the object now in the file, NULL if the
+	server sent none, for the caller to free. Returns the final response
+	without a body, or NULL with http_last_error set.
+*/
+struct http_response* http_download_resume_opts(char *url, char *custom_headers, int fd, char **validator, const struct http_request_opts *opts)
+{
+	struct http_request_opts o;
+	struct http_download dl;
+	struct http_stream stream;
+	struct http_response *hresp = NULL;
+	int resumes = 0;
+
+	http_opts_begin(&o, opts);
+	http_set_error(HTTP_OK);
+
+	/* Ranges count bytes of the body as sent, so it is written as sent */
+	o.decompress = 0;
+	memset(&dl, 0, sizeof(dl));
+	dl.sink.fd = fd;
+	dl.sink.splice = 1;
+	dl.validator = *validator;
+	*validator = NULL;
+	if(!http_download_strong(dl.validator))
+	{
+		http_free(dl.validator);
+		dl.validator = NULL;
+	}
+	long long size = http_file_size(fd);
+	dl.resumable = size >= 0;
+	dl.offset = size > 0 && dl.validator != NULL ? size : 0;
+
+	/* Append to what the file already holds, or start it over */
+	if(dl.resumable && http_file_truncate(fd, dl.offset) < 0)
+	{
+		http_free(dl.validator);
+		http_set_error(HTTP_ERR_FILE);
+		return NULL;
+	}
+	stream.data = &dl;
+	stream.on_headers = http_download_on_headers;
+	stream.on_body = http_download_on_body;
+
+	char *current = str_dup(url);
+	while(current != NULL)
+	{
+		/* Parse url */
+		struct parsed_url *purl = parse_url(current);
+		if(purl == NULL)
+		{
+			http_free(current);
+			break;
+		}
+
+		/* Ask only for what the file is missing */
+		struct str_buffer extra;
+		str_buffer_init(&extra);
+		if(dl.offset > 0)
+		{
+			char range[64];
+			sprintf(range, "Range:bytes=%lld-\r\n", dl.offset);
+			str_buffer_append_str(&extra, range);
+			str_buffer_append_str(&extra, "If-Range:");
+			str_buffer_append_str(&extra, dl.validator);
+			str_buffer_append_str(&extra, "\r\n");
+		}
+		if(custom_headers != NULL)
+			str_buffer_append_str(&extra, custom_headers);
+		char *http_headers = http_build_request("GET", purl, extra.data);
+		str_buffer_free(&extra);
+
+		dl.sink.active = 0;
+		dl.sink.written = 0;
+		dl.sink.error = HTTP_OK;
+		hresp = http_req_run(http_headers, NULL, 0, purl, &stream, &dl.sink, &o);
+		char *next = NULL;
+		if(hresp != NULL)
+		{
+			/* Handle redirect */
+			next = http_redirect_location(hresp);
+			if(next != NULL)
+			{
+				http_response_free(hresp);
+				hresp = NULL;
+				if(o.max_redirects-- <= 0)
+				{
+					http_free(next);
+					next = NULL;
+					http_set_error(HTTP_ERR_REDIRECTS);
+				}
+			}
+		}
+		else
+		{
+			/*
+				Cut short: resume from where the file got to, if it got
+				anywhere and the object has a validator to tie the rest to
+			*/
+			enum http_error error = http_last_error();
+			if((error == HTTP_ERR_RECV || error == HTTP_ERR_READ_TIMEOUT) && dl.resumable && dl.sink.written > 0 && dl.validator != NULL && resumes++ < HTTP_DOWNLOAD_RESUMES)
+			{
+				dl.offset += dl.sink.written;
+				next = current;
+			}
+		}
+		if(next != current)
+			http_free(current);
+		current = next;
+	}
+	*validator = dl.validator;
+	return hresp;
+}
+
+/*
+	Resumes a download into a file descriptor with the default timeouts
+*/
+struct http_response* http_download_resume(char *url, char *custom_headers, int fd, char **validator)
+{
+	return http_download_resume_opts(url, custom_headers, fd, validator, NULL);
+}
+
+/*
+	Downloads the body of a GET request into a file descriptor, starting a
+	regular file over, within the limits of opts
+*/
+struct http_response* http_download_opts(char *url, char *custom_headers, int fd, const struct http_request_opts *opts)
+{
+	char *validator = NULL;
+	struct http_response *hresp = http_download_resume_opts(url, custom_headers, fd, &validator, opts);
+	http_free(validator);
+	return hresp;
+}
+
+/*
+	Downloads the body of a GET request into a file descriptor
+*/
+struct http_response* http_download(char *url, char *custom_headers, int fd)
+{
+	return http_download_opts(url, custom_headers, fd, NULL);
+}
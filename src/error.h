@@ -0,0 +1,92 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Errors of the last request made on a thread, see http_last_error
+*/
+enum http_error
+{
+	HTTP_OK = 0,
+	HTTP_ERR_URL,					/* url could not be parsed */
+	HTTP_ERR_MEMORY,
+	HTTP_ERR_RESOLVE,
+	HTTP_ERR_CONNECT,
+	HTTP_ERR_CONNECT_TIMEOUT,
+	HTTP_ERR_SEND,
+	HTTP_ERR_RECV,
+	HTTP_ERR_READ_TIMEOUT,			/* the server went quiet for longer than read_timeout_ms */
+	HTTP_ERR_TIMEOUT,				/* the total deadline passed */
+	HTTP_ERR_PROTOCOL,				/* the response could not be parsed */
+	HTTP_ERR_REDIRECTS,				/* more redirects than max_redirects */
+	HTTP_ERR_FILE,					/* the file to upload or download to could not be used */
+	HTTP_ERR_TLS,					/* no TLS for https, or the handshake failed */
+	HTTP_ERR_ABORTED				/* a stream callback returned non-zero */
+};
+
+HTTP_THREAD_LOCAL enum http_error http_error_code = HTTP_OK;
+
+/*
+	Returns why the last request made on this thread returned NULL
+*/
+enum http_error http_last_error()
+{
+	return http_error_code;
+}
+
+/*
+	Records the outcome of a request for http_last_error
+*/
+void http_set_error(enum http_error error)
+{
+	http_error_code = error;
+}
+
+/*
+	Returns a description of an error code
+*/
+const char* http_error_string(enum http_error error)
+{
+	switch(error)
+	{
+		case HTTP_OK: return "No error";
+		case HTTP_ERR_URL: return "Unable to parse url";
+		case HTTP_ERR_MEMORY: return "Out of memory";
+		case HTTP_ERR_RESOLVE: return "Unable to resolve host";
+		case HTTP_ERR_CONNECT: return "Could not connect";
+		case HTTP_ERR_CONNECT_TIMEOUT: return "Connect timed out";
+		case HTTP_ERR_SEND: return "Can't send request";
+		case HTTP_ERR_RECV: return "Unable to receive";
+		case HTTP_ERR_READ_TIMEOUT: return "Read timed out";
+		case HTTP_ERR_TIMEOUT: return "Request timed out";
+		case HTTP_ERR_PROTOCOL: return "Invalid response";
+		case HTTP_ERR_REDIRECTS: return "Too many redirects";
+		case HTTP_ERR_FILE: return "Unable to use file";
+		case HTTP_ERR_TLS: return "TLS handshake failed";
+		case HTTP_ERR_ABORTED: return "Aborted by callback";
+	}
+	return "Unknown error";
+}
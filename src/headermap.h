@@ -0,0 +1,315 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Headers that are looked up often get an id of their own, which leads
+	straight to their first entry without going through the hash buckets
+*/
+enum http_header_id
+{
+	HTTP_HDR_OTHER,
+	HTTP_HDR_CONTENT_LENGTH,
+	HTTP_HDR_CONTENT_TYPE,
+	HTTP_HDR_CONTENT_ENCODING,
+	HTTP_HDR_CONTENT_RANGE,
+	HTTP_HDR_TRANSFER_ENCODING,
+	HTTP_HDR_CONNECTION,
+	HTTP_HDR_KEEP_ALIVE,
+	HTTP_HDR_LOCATION,
+	HTTP_HDR_SET_COOKIE,
+	HTTP_HDR_ETAG,
+	HTTP_HDR_LAST_MODIFIED,
+	HTTP_HDR_CACHE_CONTROL,
+	HTTP_HDR_DATE,
+	HTTP_HDR_SERVER,
+	HTTP_HDR_COUNT
+};
+
+/*
+	Names of the interned headers and their lengths, in the order of their ids
+*/
+struct http_header_name
+{
+	const char *name;
+	size_t len;
+};
+
+const struct http_header_name http_header_names[HTTP_HDR_COUNT] =
+{
+	{ NULL, 0 },
+	{ "Content-Length", 14 },
+	{ "Content-Type", 12 },
+	{ "Content-Encoding", 16 },
+	{ "Content-Range", 13 },
+	{ "Transfer-Encoding", 17 },
+	{ "Connection", 10 },
+	{ "Keep-Alive", 10 },
+	{ "Location", 8 },
+	{ "Set-Cookie", 10 },
+	{ "ETag", 4 },
+	{ "Last-Modified", 13 },
+	{ "Cache-Control", 13 },
+	{ "Date", 4 },
+	{ "Server", 6 }
+};
+
+/*
+	Number of hash buckets of a header map, a power of two
+*/
+#define HTTP_HEADER_BUCKETS 32
+
+/*
+	Represents one header line. Name and value are spans of the block of
+	headers the map was built from. Links are indexes plus one, 0 ends a list.
+*/
+struct http_header
+{
+	struct http_span name;
+	struct http_span value;
+	unsigned int hash;
+	int id;
+	int next_bucket;				/* next header of another name in the same bucket */
+	int next_same;					/* next header of the same name */
+};
+
+/*
+	Represents the headers of a response in the order they came, hashed by
+	name ignoring case. A map that is all zero is empty and ready to use.
+*/
+struct http_header_map
+{
+	struct http_header *items;
+	int count;
+	int cap;
+	int built;						/* filled in from a block of headers */
+	int buckets[HTTP_HEADER_BUCKETS];
+	int first[HTTP_HDR_COUNT];		/* first header of each interned name */
+};
+
+/*
+	Returns the id of a header name, HTTP_HDR_OTHER if it is not interned.
+	The length narrows it down to at most three names.
+*/
+enum http_header_id http_header_intern(const char *name, size_t len)
+{
+	static const unsigned char candidates[18][3] =
+	{
+		{ 0 }, { 0 }, { 0 }, { 0 },
+		{ HTTP_HDR_ETAG, HTTP_HDR_DATE },
+		{ 0 },
+		{ HTTP_HDR_SERVER },
+		{ 0 },
+		{ HTTP_HDR_LOCATION },
+		{ 0 },
+		{ HTTP_HDR_CONNECTION, HTTP_HDR_KEEP_ALIVE, HTTP_HDR_SET_COOKIE },
+		{ 0 },
+		{ HTTP_HDR_CONTENT_TYPE },
+		{ HTTP_HDR_CONTENT_RANGE, HTTP_HDR_LAST_MODIFIED, HTTP_HDR_CACHE_CONTROL },
+		{ HTTP_HDR_CONTENT_LENGTH },
+		{ 0 },
+		{ HTTP_HDR_CONTENT_ENCODING },
+		{ HTTP_HDR_TRANSFER_ENCODING }
+	};
+	int i;
+	if(len >= 18)
+		return HTTP_HDR_OTHER;
+	for(i = 0; i < 3 && candidates[len][i] != HTTP_HDR_OTHER; i++)
+	{
+		int id = candidates[len][i];
+		if(str_equal_nocase(http_header_names[id].name, name, len))
+			return (enum http_header_id)id;
+	}
+	return HTTP_HDR_OTHER;
+}
+
+/*
+	Hashes a header name ignoring case, from its length and a few of its
+	bytes with the ASCII case bit set. Names that collide only cost a
+	comparison, and looking one up does not have to read all of it.
+*/
+unsigned int http_header_hash(const char *name, size_t len)
+{
+	if(len == 0)
+		return 0;
+	unsigned int first = (unsigned char)name[0] | 0x20;
+	unsigned int middle = (unsigned char)name[len / 2] | 0x20;
+	unsigned int last = (unsigned char)name[len - 1] | 0x20;
+	return ((unsigned int)len * 2654435761u) ^ (first * 31 + middle) * 257 ^ last * 7;
+}
+
+/*
+	Sets up an empty header map
+*/
+void http_header_map_init(struct http_header_map *map)
+{
+	memset(map, 0, sizeof(struct http_header_map));
+}
+
+/*
+	Empties a header map, keeping its storage
+*/
+void http_header_map_clear(struct http_header_map *map)
+{
+	int cap = map->cap;
+	struct http_header *items = map->items;
+	http_header_map_init(map);
+	map->items = items;
+	map->cap = cap;
+}
+
+/*
+	Frees the storage of a header map and leaves it empty
+*/
+void http_header_map_free(struct http_header_map *map)
+{
+	http_free(map->items);
+	http_header_map_init(map);
+}
+
+/*
+	Finds the first header of a name that hashed to hash, -1 if there is none.
+	base is the block of headers the spans point into.
+*/
+int http_header_map_lookup(const struct http_header_map *map, const char *base, const char *name, size_t len, unsigned int hash)
+{
+	int i = map->buckets[hash & (HTTP_HEADER_BUCKETS - 1)];
+	while(i > 0)
+	{
+		const struct http_header *header = &map->items[i - 1];
+		if(header->hash == hash && header->name.len == len && str_equal_nocase(base + header->name.off, name, len))
+			return i - 1;
+		i = header->next_bucket;
+	}
+	return -1;
+}
+
+/*
+	Adds a header of the block at base, returns -1 when out of memory
+*/
+int http_header_map_add(struct http_header_map *map, const char *base, struct http_span name, struct http_span value)
+{
+	if(map->count == map->cap)
+	{
+		int cap = map->cap > 0 ? map->cap * 2 : 8;
+		struct http_header *items = (struct http_header*)http_realloc(map->items, cap * sizeof(struct http_header));
+		if(items == NULL)
+			return -1;
+		map->items = items;
+		map->cap = cap;
+	}
+
+	int i = map->count++;
+	struct http_header *header = &map->items[i];
+	header->name = name;
+	header->value = value;
+	header->hash = http_header_hash(base + name.off, name.len);
+	header->id = http_header_intern(base + name.off, name.len);
+	header->next_bucket = 0;
+	header->next_same = 0;
+
+	/* A repeated name joins the list of its first header */
+	int first = header->id != HTTP_HDR_OTHER ? map->first[header->id] - 1 : http_header_map_lookup(map, base, base + name.off, name.len, header->hash);
+	if(first >= 0)
+	{
+		while(map->items[first].next_same > 0)
+			first = map->items[first].next_same - 1;
+		map->items[first].next_same = i + 1;
+		return 0;
+	}
+	int bucket = header->hash & (HTTP_HEADER_BUCKETS - 1);
+	header->next_bucket = map->buckets[bucket];
+	map->buckets[bucket] = i + 1;
+	if(header->id != HTTP_HDR_OTHER)
+		map->first[header->id] = i + 1;
+	return 0;
+}
+
+/*
+	Fills a map with the header lines of a block that starts with a status
+	line, like response_headers. Lines without a name are skipped. Returns
+	-1 when out of memory.
+*/
+int http_header_map_parse(struct http_header_map *map, const char *headers)
+{
+	const char *line = strchr(headers, '\n');
+	http_header_map_clear(map);
+	while(line != NULL)
+	{
+		line++;
+		const char *end = strchr(line, '\n');
+		const char *line_end = end != NULL ? end : line + strlen(line);
+		if(line_end > line && line_end[-1] == '\r')
+			line_end--;
+		const char *colon = (const char*)memchr(line, ':', line_end - line);
+		if(colon != NULL && colon > line)
+		{
+			const char *value = colon + 1;
+			const char *value_end = line_end;
+			while(value < value_end && (*value == ' ' || *value == '\t'))
+				value++;
+			while(value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+				value_end--;
+			struct http_span name_span = { (size_t)(line - headers), (size_t)(colon - line) };
+			struct http_span value_span = { (size_t)(value - headers), (size_t)(value_end - value) };
+			if(http_header_map_add(map, headers, name_span, value_span) < 0)
+				return -1;
+		}
+		line = end;
+	}
+	map->built = 1;
+	return 0;
+}
+
+/*
+	Returns the index of the first header of the given name, -1 if there is
+	none. base is the block of headers the spans point into.
+*/
+int http_header_map_find(const struct http_header_map *map, const char *base, const char *name)
+{
+	size_t len = strlen(name);
+	enum http_header_id id = http_header_intern(name, len);
+	if(id != HTTP_HDR_OTHER)
+		return map->first[id] - 1;
+	return http_header_map_lookup(map, base, name, len, http_header_hash(name, len));
+}
+
+/*
+	Returns the index of the first header with an interned id, -1 if there is none
+*/
+int http_header_map_find_id(const struct http_header_map *map, enum http_header_id id)
+{
+	return map->first[id] - 1;
+}
+
+/*
+	Returns the index of the next header with the same name as header i, -1
+	after the last one
+*/
+int http_header_map_next(const struct http_header_map *map, int i)
+{
+	return map->items[i].next_same - 1;
+}
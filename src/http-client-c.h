@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #ifdef _WIN32
 	#include <winsock2.h>
 	#include <ws2tcpip.h>
@@ -37,6 +38,9 @@
 	#pragma comment(lib, "Ws2_32.lib")
 #elif _LINUX
 	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <netdb.h>
+	#include <arpa/inet.h>
 #elif __FreeBSD__
     #include <sys/socket.h>
     #include <netinet/in.h>
@@ -47,8 +51,107 @@
 #endif
 
 #include <errno.h>
-#include "stringx.h";
+#include "platform.h"
+#include "error.h"
+#include "arena.h"
+#include "scan.h"
+#include "stringx.h"
+#include "base64.h"
+#include "urlencode.h"
+#include "resolver.h"
 #include "urlparser.h"
+#include "tls.h"
+#include "connpool.h"
+#include "httpparser.h"
+#include "headermap.h"
+#include "decompress.h"
+
+/*
+	Represents the limits of a request. Timeouts are in milliseconds, 0 for
+	no limit. connect_timeout_ms also bounds looking up a host that is not
+	cached. read_timeout_ms bounds every wait for the socket to make
+	progress, sending included. The total timeout covers the whole call,
+	redirects and DNS lookups included, by way of the deadline.
+*/
+struct http_request_opts
+{
+	int connect_timeout_ms;			/* for the lookup and per address tried */
+	int read_timeout_ms;
+	int total_timeout_ms;
+	int max_redirects;
+	int decompress;					/* ask for gzip or deflate and decompress the body, needs HTTP_USE_ZLIB */
+	long long deadline;				/* http_now_ms() the call must end by, 0 to start from total_timeout_ms */
+};
+
+struct http_request_opts http_default_opts = { 30000, 60000, 0, 20, 0, 0 };
+
+/*
+	Sets the timeouts of requests made without options
+*/
+void http_set_timeouts(int connect_timeout_ms, int read_timeout_ms, int total_timeout_ms)
+{
+	http_default_opts.connect_timeout_ms = connect_timeout_ms;
+	http_default_opts.read_timeout_ms = read_timeout_ms;
+	http_default_opts.total_timeout_ms = total_timeout_ms;
+}
+
+/*
+	Fills in the options of a call: the defaults when opts is NULL, and the
+	deadline from the total timeout unless the caller passed one down
+*/
+void http_opts_begin(struct http_request_opts *out, const struct http_request_opts *opts)
+{
+	*out = opts != NULL ? *opts : http_default_opts;
+	if(out->deadline == 0 && out->total_timeout_ms > 0)
+		out->deadline = http_now_ms() + out->total_timeout_ms;
+}
+
+/*
+	Returns how long to wait on a socket: limit_ms capped by the time left
+	until the deadline. -1 for no limit, 0 once the deadline has passed.
+*/
+int http_wait_ms(const struct http_request_opts *opts, int limit_ms)
+{
+	int wait = limit_ms > 0 ? limit_ms : -1;
+	if(opts->deadline > 0)
+	{
+		long long left = opts->deadline - http_now_ms();
+		if(left <= 0)
+			return 0;
+		if(wait < 0 || left < wait)
+			wait = (int)left;
+	}
+	return wait;
+}
+
+/*
+	Waits until a socket is ready for events. Returns 1 when ready, 0 on
+	timeout and -1 on failure.
+*/
+int http_wait(int sock, short events, int wait_ms)
+{
+	struct pollfd pfd;
+	int n;
+	pfd.fd = sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	do
+	{
+		n = poll(&pfd, 1, wait_ms);
+	}
+	while(n < 0 && errno == EINTR);
+	return n > 0 ? 1 : n;
+}
+
+/*
+	Tells a timeout of the total deadline from one of the given limit
+*/
+enum http_error http_timeout_error(const struct http_request_opts *opts, enum http_error limit_error)
+{
+	if(opts->deadline > 0 && http_now_ms() >= opts->deadline)
+		return HTTP_ERR_TIMEOUT;
+	return limit_error;
+}
 
 /*
 	Prototype functions
@@ -57,8 +160,34 @@ struct http_response* http_req(char *http_headers, struct parsed_url *purl);
 struct http_response* http_get(char *url, char *custom_headers);
 struct http_response* http_head(char *url, char *custom_headers);
 struct http_response* http_post(char *url, char *custom_headers, char *post_data);
+struct http_response* http_get_opts(char *url, char *custom_headers, const struct http_request_opts *opts);
+struct http_response* http_head_opts(char *url, char *custom_headers, const struct http_request_opts *opts);
+struct http_response* http_post_opts(char *url, char *custom_headers, char *post_data, const struct http_request_opts *opts);
+struct http_response* http_post_body_opts(char *url, char *custom_headers, const char *body, size_t body_len, const struct http_request_opts *opts);
+void http_response_free(struct http_response *hresp);
 
 
+/*
+	Represents the timing of a request, durations in nanoseconds. Phases
+	that did not happen, like connect on a pooled connection, stay 0.
+*/
+struct http_timing
+{
+	long long start;				/* http_now_ns() when the request started */
+	long long dns;					/* resolving the host, when parsing the url and connecting */
+	long long connect;
+	long long tls;					/* TLS handshake of an https connection */
+	long long send;
+	long long ttfb;					/* request sent until the first response byte */
+	long long body;					/* first response byte until the response is complete */
+	long long total;
+	size_t bytes_sent;
+	size_t bytes_received;
+	int reused;						/* the connection came from the pool */
+	int tls_resumed;				/* the TLS handshake resumed an earlier session */
+	int retries;					/* stale pooled connections given up on */
+};
+
 /*
 	Represents an HTTP html response
 */
@@ -66,89 +195,1094 @@ struct http_response
 {
 	struct parsed_url *request_uri;
 	char *body;
+	size_t body_len;
 	char *status_code;
 	int status_code_int;
 	char *status_text;
 	char *request_headers;
 	char *response_headers;
+	struct http_header_map headers;	/* response_headers by name, see http_headers */
+	struct http_timing timing;
 };
 
 /*
-	Handles redirect if needed for get requests
+	Connection events reported to the metrics hook
+*/
+enum http_conn_event
+{
+	HTTP_CONN_OPENED,				/* new connection */
+	HTTP_CONN_REUSED,				/* idle connection taken from the pool */
+	HTTP_CONN_STALE,				/* pooled connection found closed, request retried */
+	HTTP_CONN_POOLED,				/* connection kept for the next request */
+	HTTP_CONN_CLOSED
+};
+
+/*
+	Represents the metrics hook. on_response gets every completed response
+	with its timing, on_conn every connection event. Both are called from
+	the thread that made the request. Set it before making requests.
 */
-struct http_response* handle_redirect_get(struct http_response* hresp, char* custom_headers)
+struct http_metrics
 {
-	if(hresp->status_code_int > 300 && hresp->status_code_int < 399)
+	void (*on_response)(const struct http_response *hresp, void *data);
+	void (*on_conn)(enum http_conn_event event, const char *host, int port, void *data);
+	void *data;
+};
+
+struct http_metrics http_metrics_hook = { NULL, NULL, NULL };
+
+/*
+	Installs the metrics hook, either callback may be NULL
+*/
+void http_set_metrics_hook(void (*on_response)(const struct http_response *hresp, void *data), void (*on_conn)(enum http_conn_event event, const char *host, int port, void *data), void *data)
+{
+	http_metrics_hook.on_response = on_response;
+	http_metrics_hook.on_conn = on_conn;
+	http_metrics_hook.data = data;
+}
+
+/*
+	Reports a connection event to the metrics hook
+*/
+void http_metrics_conn(enum http_conn_event event, const char *host, int port)
+{
+	if(http_metrics_hook.on_conn != NULL)
+		http_metrics_hook.on_conn(event, host, port, http_metrics_hook.data);
+}
+
+/*
+	Reports a completed response to the metrics hook
+*/
+void http_metrics_response(const struct http_response *hresp)
+{
+	if(http_metrics_hook.on_response != NULL)
+		http_metrics_hook.on_response(hresp, http_metrics_hook.data);
+}
+
+/*
+	Returns the value of the first header of the given name in a block of
+	response headers, NULL if there is none. The caller frees it.
+*/
+char* http_header_value(const char *headers, const char *name)
+{
+	const char *line = headers;
+	size_t name_len = strlen(name);
+	while(line != NULL && *line != '\0')
 	{
-		char *token = strtok(hresp->response_headers, "\r\n");
-		while(token != NULL)
+		const char *end = strstr(line, "\r\n");
+		size_t len = end != NULL ? (size_t)(end - line) : strlen(line);
+		if(len > name_len && line[name_len] == ':' && str_starts_with_nocase(line, name))
 		{
-			if(str_contains(token, "Location:"))
-			{
-				/* Extract url */
-				char *location = str_replace("Location: ", "", token);
-				return http_get(location, custom_headers);
-			}
-			token = strtok(NULL, "\r\n");
+			const char *value = line + name_len + 1;
+			while(*value == ' ' || *value == '\t')
+				value++;
+			return str_ndup(value, line + len - value);
 		}
+		line = end != NULL ? end + 2 : NULL;
 	}
-	else
+	return NULL;
+}
+
+/*
+	Returns the headers of a response by name. The map is built from
+	response_headers on first use, trailers included, so responses that are
+	never asked for a header do not pay for it. Returns NULL when out of
+	memory.
+*/
+struct http_header_map* http_headers(struct http_response *hresp)
+{
+	if(!hresp->headers.built && hresp->response_headers != NULL && http_header_map_parse(&hresp->headers, hresp->response_headers) < 0)
+		return NULL;
+	return &hresp->headers;
+}
+
+/*
+	Returns the index into hresp->headers.items of the first header of the
+	given name, -1 if there is none
+*/
+int http_header_find(struct http_response *hresp, const char *name)
+{
+	struct http_header_map *map = http_headers(hresp);
+	return map != NULL ? http_header_map_find(map, hresp->response_headers, name) : -1;
+}
+
+/*
+	Returns the index of the next header with the same name as header i, to
+	go through repeated headers such as Set-Cookie. -1 after the last one.
+*/
+int http_header_next(struct http_response *hresp, int i)
+{
+	return http_header_map_next(&hresp->headers, i);
+}
+
+/*
+	Returns the value of header i and sets len to its length. The value
+	points into response_headers and is not terminated.
+*/
+const char* http_header_at(struct http_response *hresp, int i, size_t *len)
+{
+	const struct http_header *header = &hresp->headers.items[i];
+	*len = header->value.len;
+	return hresp->response_headers + header->value.off;
+}
+
+/*
+	Returns the value of the first header of the given name and sets len to
+	its length, NULL if there is none. The value points into
+	response_headers and is not terminated.
+*/
+const char* http_header_get(struct http_response *hresp, const char *name, size_t *len)
+{
+	int i = http_header_find(hresp, name);
+	return i >= 0 ? http_header_at(hresp, i, len) : NULL;
+}
+
+/*
+	Returns a copy of the value of the first header of the given name, NULL
+	if there is none. The caller frees it.
+*/
+char* http_header_dup(struct http_response *hresp, const char *name)
+{
+	size_t len;
+	const char *value = http_header_get(hresp, name, &len);
+	return value != NULL ? str_ndup(value, len) : NULL;
+}
+
+/*
+	Returns the url a redirect response points to, NULL if it is none. A
+	location that is only a path is taken relative to the request url.
+	The caller frees it.
+*/
+char* http_redirect_location(struct http_response *hresp)
+{
+	if(hresp->status_code_int <= 300 || hresp->status_code_int >= 399 || hresp->response_headers == NULL)
+		return NULL;
+	char *location = http_header_dup(hresp, "Location");
+	struct parsed_url *purl = hresp->request_uri;
+	if(location == NULL || location[0] != '/' || location[1] == '/' || purl == NULL)
+		return location;
+
+	/* Absolute path on the same origin */
+	struct str_buffer url;
+	str_buffer_init(&url);
+	str_buffer_append_str(&url, purl->scheme);
+	str_buffer_append_str(&url, "://");
+	str_buffer_append_str(&url, purl->host);
+	str_buffer_append_str(&url, ":");
+	str_buffer_append_str(&url, purl->port);
+	str_buffer_append_str(&url, location);
+	http_free(location);
+	return url.data;
+}
+
+/*
+	Checks whether another redirect may be followed. The options of the next
+	request keep the deadline of the first and one redirect less.
+*/
+int http_redirect_allowed(struct http_response *hresp, const struct http_request_opts *opts, struct http_request_opts *next)
+{
+	*next = *opts;
+	if(next->max_redirects <= 0)
+	{
+		http_response_free(hresp);
+		http_set_error(HTTP_ERR_REDIRECTS);
+		return 0;
+	}
+	next->max_redirects--;
+	return 1;
+}
+
+/*
+	Handles redirect if needed for get requests
+*/
+struct http_response* handle_redirect_get(struct http_response* hresp, char* custom_headers, const struct http_request_opts *opts)
+{
+	struct http_request_opts next;
+	if(hresp == NULL)
+		return NULL;
+	char *location = http_redirect_location(hresp);
+	if(location == NULL)
 	{
 		/* We're not dealing with a redirect, just return the same structure */
 		return hresp;
 	}
+	if(!http_redirect_allowed(hresp, opts, &next))
+	{
+		http_free(location);
+		return NULL;
+	}
+	http_response_free(hresp);
+	hresp = http_get_opts(location, custom_headers, &next);
+	http_free(location);
+	return hresp;
 }
 
 /*
 	Handles redirect if needed for head requests
 */
-struct http_response* handle_redirect_head(struct http_response* hresp, char* custom_headers)
+struct http_response* handle_redirect_head(struct http_response* hresp, char* custom_headers, const struct http_request_opts *opts)
+{
+	struct http_request_opts next;
+	if(hresp == NULL)
+		return NULL;
+	char *location = http_redirect_location(hresp);
+	if(location == NULL)
+	{
+		/* We're not dealing with a redirect, just return the same structure */
+		return hresp;
+	}
+	if(!http_redirect_allowed(hresp, opts, &next))
+	{
+		http_free(location);
+		return NULL;
+	}
+	http_response_free(hresp);
+	hresp = http_head_opts(location, custom_headers, &next);
+	http_free(location);
+	return hresp;
+}
+
+/*
+	Handles redirect if needed for post requests
+*/
+struct http_response* handle_redirect_post(struct http_response* hresp, char* custom_headers, const char *body, size_t body_len, const struct http_request_opts *opts)
+{
+	struct http_request_opts next;
+	if(hresp == NULL)
+		return NULL;
+	char *location = http_redirect_location(hresp);
+	if(location == NULL)
+	{
+		/* We're not dealing with a redirect, just return the same structure */
+		return hresp;
+	}
+	if(!http_redirect_allowed(hresp, opts, &next))
+	{
+		http_free(location);
+		return NULL;
+	}
+	http_response_free(hresp);
+	hresp = http_post_body_opts(location, custom_headers, body, body_len, &next);
+	http_free(location);
+	return hresp;
+}
+
+/*
+	Callbacks for streaming a response. on_headers is called once the status
+	line and headers are in, on_body for every piece of the body as it arrives.
+	Returning non-zero from either aborts the request with HTTP_ERR_ABORTED.
+*/
+struct http_stream
+{
+	void *data;
+	int (*on_headers)(struct http_response *hresp, void *data);
+	int (*on_body)(const char *chunk, size_t len, void *data);
+};
+
+/*
+	Ties a parser to the response and stream it reports to
+*/
+struct http_stream_ctx
+{
+	struct http_response *hresp;
+	struct http_stream *stream;
+	struct http_decoder *decoder;	/* NULL when bodies are passed on as they come */
+	enum http_error error;			/* HTTP_ERR_ABORTED once a callback of the stream aborted */
+};
+
+/*
+	Fills in status and headers of the response once the parser has them
+*/
+int http_stream_on_headers_complete(struct http_parser *parser, const char *buf)
+{
+	struct http_stream_ctx *ctx = (struct http_stream_ctx*)parser->data;
+	struct http_response *hresp = ctx->hresp;
+
+	/* Status code and text */
+	hresp->status_code = str_ndup(buf + parser->head.off + 9, 3);
+	hresp->status_code_int = parser->status_code;
+	hresp->status_text = str_ndup(buf + parser->status_text.off, parser->status_text.len);
+
+	/* Response headers, including the status line */
+	hresp->response_headers = str_ndup(buf + parser->head.off, parser->head.len);
+
+	/* A compressed body is inflated on its way to the stream */
+	if(ctx->decoder != NULL)
+	{
+		size_t len;
+		const char *coding = http_header_get(hresp, "Content-Encoding", &len);
+		if(coding != NULL && http_decoder_start(ctx->decoder, coding, len) < 0)
+			return -1;
+	}
+
+	if(ctx->stream->on_headers != NULL && ctx->stream->on_headers(hresp, ctx->stream->data) != 0)
+	{
+		ctx->error = HTTP_ERR_ABORTED;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Appends the trailers of a chunked response to its response headers
+*/
+void http_stream_finish(struct http_response *hresp, struct http_parser *parser, const char *buf)
+{
+	if(parser->trailers.len > 0 && hresp->response_headers != NULL)
+	{
+		size_t head_len = strlen(hresp->response_headers);
+		char *headers = (char*)http_realloc(hresp->response_headers, head_len + parser->trailers.len + 3);
+		if(headers != NULL)
+		{
+			sprintf(headers + head_len, "\r\n%.*s", (int)parser->trailers.len, buf + parser->trailers.off);
+			hresp->response_headers = headers;
+			hresp->headers.built = 0;
+		}
+	}
+}
+
+/*
+	Passes a piece of the body to the stream, noting when it aborts
+*/
+int http_stream_deliver(const char *chunk, size_t len, void *data)
+{
+	struct http_stream_ctx *ctx = (struct http_stream_ctx*)data;
+	if(ctx->stream->on_body != NULL && ctx->stream->on_body(chunk, len, ctx->stream->data) != 0)
+	{
+		ctx->error = HTTP_ERR_ABORTED;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Hands body spans reported by the parser to the stream
+*/
+int http_stream_on_body(struct http_parser *parser, const char *buf, struct http_span chunk)
+{
+	struct http_stream_ctx *ctx = (struct http_stream_ctx*)parser->data;
+	if(ctx->decoder != NULL && ctx->decoder->active)
+		return http_decoder_write(ctx->decoder, buf + chunk.off, chunk.len, http_stream_deliver, ctx);
+	return http_stream_deliver(buf + chunk.off, chunk.len, ctx);
+}
+
+/*
+	Head start a connection attempt gets before the next address is raced
+	against it, the delay RFC 8305 recommends
+*/
+#define HTTP_CONNECT_ATTEMPT_DELAY 250
+
+/*
+	Starts a non-blocking connect to one of the addresses. Returns the
+	socket, or -1 if the attempt failed straight away. Sets connected when
+	the connection was made at once, as it can be on loopback.
+*/
+int http_connect_start(struct http_addrinfo *addrs, int i, int *connected)
 {
-	if(hresp->status_code_int > 300 && hresp->status_code_int < 399)
+	int sock = socket(addrs->addrs[i].ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if(sock < 0)
+		return -1;
+	http_set_nonblocking(sock, 1);
+	*connected = connect(sock, (struct sockaddr *)&addrs->addrs[i], addrs->addrlens[i]) == 0;
+	if(!*connected && !HTTP_CONNECT_PENDING())
+	{
+		http_close_socket(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*
+	Opens a new TCP connection to the host of the given url. Its addresses
+	are raced Happy Eyeballs style (RFC 8305): each attempt gets a head
+	start of HTTP_CONNECT_ATTEMPT_DELAY ms, or less if it fails, before the
+	next address, of the other family when there is one, joins the race.
+	The first connection made wins. The lookup of a host that is not cached
+	and each attempt are bounded by the connect timeout, and all of them by
+	the deadline of opts, which may be NULL for the defaults. Adds the time taken to timing, which may be NULL.
+	Returns a blocking socket, or -1 with the error set.
+*/
+int http_connect(struct parsed_url *purl, struct http_timing *timing, const struct http_request_opts *opts)
+{
+	int sock = -1;
+	int i, n;
+	int port = atoi(purl->port);
+	struct http_addrinfo addrs;
+	struct http_request_opts defaults;
+	struct pollfd pending[HTTP_RESOLVER_MAX_ADDRS];
+	long long started[HTTP_RESOLVER_MAX_ADDRS];
+	int pending_count = 0;
+	int next = 0;
+	long long next_attempt = 0;
+	enum http_error error = HTTP_ERR_CONNECT;
+
+	if(opts == NULL)
+	{
+		http_opts_begin(&defaults, NULL);
+		opts = &defaults;
+	}
+
+	/* A lookup that is not cached gets the connect timeout, within the deadline */
+	long long start = http_now_ns();
+	int lookup = http_resolve_within(purl->host, port, &addrs, http_wait_ms(opts, opts->connect_timeout_ms));
+	if(lookup < 0)
+	{
+		http_set_error(lookup == -2 ? http_timeout_error(opts, HTTP_ERR_CONNECT_TIMEOUT) : HTTP_ERR_RESOLVE);
+		return -1;
+	}
+	long long resolved = http_now_ns();
+	if(timing != NULL)
+		timing->dns += resolved - start;
+
+	while(sock < 0)
 	{
-		char *token = strtok(hresp->response_headers, "\r\n");
-		while(token != NULL)
+		long long now = http_now_ms();
+
+		/* Start the next attempt once the last one had its head start */
+		if(next < addrs.count && (pending_count == 0 || now >= next_attempt))
 		{
-			if(str_contains(token, "Location:"))
+			int connected;
+			int attempt = http_connect_start(&addrs, next++, &connected);
+			if(attempt >= 0 && connected)
 			{
-				/* Extract url */
-				char *location = str_replace("Location: ", "", token);
-				return http_head(location, custom_headers);
+				sock = attempt;
 			}
-			token = strtok(NULL, "\r\n");
+			else if(attempt >= 0)
+			{
+				pending[pending_count].fd = attempt;
+				pending[pending_count].events = POLLOUT;
+				pending[pending_count].revents = 0;
+				started[pending_count++] = now;
+				next_attempt = now + HTTP_CONNECT_ATTEMPT_DELAY;
+			}
+			continue;
+		}
+		if(opts->deadline > 0 && now >= opts->deadline)
+		{
+			error = HTTP_ERR_TIMEOUT;
+			break;
+		}
+
+		/* Give up on attempts that ran out of time, swapping in the last */
+		int limit = next < addrs.count ? (int)(next_attempt - now) : -1;
+		for(i = 0; i < pending_count; )
+		{
+			if(opts->connect_timeout_ms > 0)
+			{
+				long long left = started[i] + opts->connect_timeout_ms - now;
+				if(left <= 0)
+				{
+					http_close_socket(pending[i].fd);
+					pending[i] = pending[--pending_count];
+					started[i] = started[pending_count];
+					error = HTTP_ERR_CONNECT_TIMEOUT;
+					continue;
+				}
+				if(limit < 0 || left < limit)
+					limit = (int)left;
+			}
+			i++;
+		}
+		if(pending_count == 0)
+		{
+			if(next < addrs.count)
+				continue;
+			break;
+		}
+
+		/* Wait for an attempt to finish, or until the next one is due */
+		n = poll(pending, pending_count, http_wait_ms(opts, limit));
+		if(n < 0 && errno != EINTR)
+			break;
+		for(i = 0; n > 0 && i < pending_count; )
+		{
+			if(pending[i].revents == 0)
+			{
+				i++;
+				continue;
+			}
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if(getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == 0 && err == 0)
+			{
+				sock = pending[i].fd;
+			}
+			else
+			{
+				/* Failed, the next address need not wait for its turn */
+				http_close_socket(pending[i].fd);
+				error = HTTP_ERR_CONNECT;
+				next_attempt = now;
+			}
+			pending[i] = pending[--pending_count];
+			started[i] = started[pending_count];
+			if(sock >= 0)
+				break;
 		}
 	}
-	else
+
+	/* Close the losers */
+	for(i = 0; i < pending_count; i++)
+		http_close_socket(pending[i].fd);
+	if(sock < 0)
 	{
-		/* We're not dealing with a redirect, just return the same structure */
-		return hresp;
+		http_set_error(error);
+		return -1;
 	}
+	http_set_nonblocking(sock, 0);
+	if(timing != NULL)
+		timing->connect += http_now_ns() - resolved;
+	http_metrics_conn(HTTP_CONN_OPENED, purl->host, port);
+	return sock;
 }
 
 /*
-	Handles redirect if needed for post requests
+	Sends a whole buffer over a socket, returns -1 on failure
+*/
+int http_send_all(int sock, const char *data, size_t len)
+{
+	size_t sent = 0;
+	while(sent < len)
+	{
+		int tmpres = send(sock, data + sent, len - sent, HTTP_SEND_FLAGS);
+		if(tmpres == -1)
+		{
+			return -1;
+		}
+		sent += tmpres;
+	}
+	return 0;
+}
+
+/*
+	Sends the pieces over a non-blocking socket within the timeouts of opts,
+	advancing them past what went out. Over TLS they go out one at a time.
+	Returns HTTP_OK or the error.
+*/
+enum http_error http_send_timed(int sock, void *tls, http_iovec *iov, int count, const struct http_request_opts *opts)
+{
+	while(count > 0)
+	{
+		short events = POLLOUT;
+		long sent;
+		if(tls != NULL)
+			sent = http_tls_transport->send(tls, (const char*)HTTP_IOV_BASE(*iov), HTTP_IOV_LEN(*iov), &events);
+		else if((sent = http_sendv(sock, iov, count)) < 0 && !HTTP_WOULD_BLOCK())
+			events = 0;
+		if(sent < 0)
+		{
+			if(events == 0)
+				return HTTP_ERR_SEND;
+			int ready = http_wait(sock, events, http_wait_ms(opts, opts->read_timeout_ms));
+			if(ready == 0)
+				return http_timeout_error(opts, HTTP_ERR_READ_TIMEOUT);
+			if(ready < 0)
+				return HTTP_ERR_SEND;
+			continue;
+		}
+
+		/* Skip the pieces that are done and trim the one cut short */
+		while(count > 0 && (size_t)sent >= (size_t)HTTP_IOV_LEN(*iov))
+		{
+			sent -= (long)HTTP_IOV_LEN(*iov);
+			iov++;
+			count--;
+		}
+		if(count > 0)
+		{
+			HTTP_IOV_BASE(*iov) = (char*)HTTP_IOV_BASE(*iov) + sent;
+			HTTP_IOV_LEN(*iov) -= sent;
+		}
+	}
+	return HTTP_OK;
+}
+
+/*
+	Receives from a non-blocking socket, through its TLS session if it has
+	one. Returns what recv does, or HTTP_TLS_TRUNCATED for a session that
+	ended without close_notify; when it has to wait, -1 with events set to
+	what to poll for.
+*/
+long http_recv(int sock, void *tls, char *data, size_t len, short *events)
+{
+	*events = 0;
+	if(tls != NULL)
+		return http_tls_transport->recv(tls, data, len, events);
+	long n = (long)recv(sock, data, len, 0);
+	if(n < 0 && HTTP_WOULD_BLOCK())
+		*events = POLLIN;
+	return n;
+}
+
+/*
+	Closes a connection along with its TLS session, if it has one
+*/
+void http_conn_close(int sock, void *tls)
+{
+	http_tls_close(tls);
+	http_close_socket(sock);
+}
+
+/*
+	Runs the TLS handshake of a new https connection within the connect
+	timeout. The session is stored in tls, also on failure so it can be
+	closed. Returns HTTP_OK or the error.
+*/
+enum http_error http_tls_handshake(int sock, struct parsed_url *purl, void **tls, struct http_timing *timing, const struct http_request_opts *opts)
+{
+	long long start = http_now_ns();
+	*tls = http_tls_transport->open(sock, purl->host, atoi(purl->port));
+	if(*tls == NULL)
+		return HTTP_ERR_TLS;
+	while(1)
+	{
+		short events = 0;
+		int done = http_tls_transport->handshake(*tls, &events);
+		if(done > 0)
+			break;
+		if(done < 0)
+			return HTTP_ERR_TLS;
+		int ready = http_wait(sock, events, http_wait_ms(opts, opts->connect_timeout_ms));
+		if(ready == 0)
+			return http_timeout_error(opts, HTTP_ERR_CONNECT_TIMEOUT);
+		if(ready < 0)
+			return HTTP_ERR_TLS;
+	}
+	timing->tls = http_now_ns() - start;
+	timing->tls_resumed = http_tls_transport->resumed(*tls);
+	return HTTP_OK;
+}
+
+/*
+	Represents a file descriptor a response body is written to. The body of
+	a known length can go from the socket to the descriptor with splice,
+	without passing through user space.
+*/
+struct http_sink
+{
+	int fd;
+	int active;						/* the body is wanted, set once the headers are in */
+	int splice;						/* splice may be tried */
+	long long written;				/* body bytes written to fd */
+	enum http_error error;			/* why the body could not be written */
+};
+
+/*
+	Writes body bytes to the sink, returns -1 on failure
+*/
+int http_sink_write(struct http_sink *sink, const char *data, size_t len)
+{
+	if(http_write_all(sink->fd, data, len) < 0)
+	{
+		sink->error = HTTP_ERR_FILE;
+		return -1;
+	}
+	sink->written += len;
+	return 0;
+}
+
+#ifdef HTTP_HAVE_SPLICE
+/*
+	Moves up to len body bytes from a non-blocking socket to the sink through
+	a pipe, so they never enter user space. Sets closed when the server
+	closed the connection first. Turns splicing off for the sink when it can
+	not be spliced to; the caller then reads the rest of the body itself.
+*/
+enum http_error http_sink_splice(int sock, struct http_sink *sink, long long len, const struct http_request_opts *opts, long long *moved, int *closed)
+{
+	int pipefd[2];
+	enum http_error error = HTTP_OK;
+	*moved = 0;
+	*closed = 0;
+	if(pipe2(pipefd, O_CLOEXEC) < 0)
+	{
+		sink->splice = 0;
+		return HTTP_OK;
+	}
+	#ifdef F_SETPIPE_SZ
+		/* Fewer, larger moves; the default pipe holds only 64 KB */
+		fcntl(pipefd[1], F_SETPIPE_SZ, 1 << 20);
+	#endif
+	while(*moved < len && sink->splice && error == HTTP_OK)
+	{
+		size_t want = len - *moved < (1 << 20) ? (size_t)(len - *moved) : (1 << 20);
+		ssize_t in = splice(sock, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(in < 0 && errno == EINTR)
+			continue;
+		if(in < 0 && HTTP_WOULD_BLOCK())
+		{
+			/* Wait for more within the read timeout and the deadline */
+			int ready = http_wait(sock, POLLIN, http_wait_ms(opts, opts->read_timeout_ms));
+			if(ready == 0)
+				error = http_timeout_error(opts, HTTP_ERR_READ_TIMEOUT);
+			else if(ready < 0)
+				error = HTTP_ERR_RECV;
+			continue;
+		}
+		if(in < 0 && *moved == 0 && errno == EINVAL)
+		{
+			sink->splice = 0;
+			break;
+		}
+		if(in <= 0)
+		{
+			if(in < 0)
+				error = HTTP_ERR_RECV;
+			*closed = in == 0;
+			break;
+		}
+		*moved += in;
+
+		/* And on from the pipe into the file */
+		while(in > 0)
+		{
+			ssize_t out = splice(pipefd[0], NULL, sink->fd, NULL, in, SPLICE_F_MOVE);
+			if(out < 0 && errno == EINTR)
+				continue;
+			if(out > 0)
+			{
+				sink->written += out;
+				in -= out;
+				continue;
+			}
+
+			/* Not something splice writes to, copy out what is in the pipe */
+			char buf[BUFSIZ];
+			sink->splice = 0;
+			while(in > 0 && error == HTTP_OK)
+			{
+				ssize_t n = read(pipefd[0], buf, in < (ssize_t)sizeof(buf) ? (size_t)in : sizeof(buf));
+				if(n <= 0)
+					error = HTTP_ERR_RECV;
+				else if(http_sink_write(sink, buf, n) < 0)
+					error = HTTP_ERR_FILE;
+				else
+					in -= n;
+			}
+			break;
+		}
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return error;
+}
+#endif
+
+/*
+	Gives up on a request: frees the response along with the request it owns
+	and records the error
 */
-struct http_response* handle_redirect_post(struct http_response* hresp, char* custom_headers, char *post_data)
+struct http_response* http_req_fail(struct http_response *hresp, enum http_error error)
 {
-	if(hresp->status_code_int > 300 && hresp->status_code_int < 399)
+	http_response_free(hresp);
+	http_set_error(error);
+	return NULL;
+}
+
+/*
+	Makes a HTTP request and streams the response to the given callbacks,
+	see http_req_stream_opts. With a sink, the rest of a body of known
+	length is spliced to it once its on_headers activates it. Only a
+	response the parser saw to its end is returned: a body cut short fails
+	with HTTP_ERR_RECV, one that breaks its framing with HTTP_ERR_PROTOCOL.
+*/
+struct http_response* http_req_run(char *http_headers, const char *body, size_t body_len, struct parsed_url *purl, struct http_stream *stream, struct http_sink *sink, const struct http_request_opts *opts)
+{
+	struct http_request_opts o;
+	http_opts_begin(&o, opts);
+	http_set_error(HTTP_OK);
+
+	/* Parse url */
+	if(purl == NULL)
 	{
-		char *token = strtok(hresp->response_headers, "\r\n");
-		while(token != NULL)
+		http_free(http_headers);
+		http_set_error(HTTP_ERR_URL);
+		return NULL;
+	}
+
+	/* Declare variable */
+	int sock;
+	void *tls = NULL;
+	int secure = strcmp(purl->scheme, "https") == 0;
+	int port = atoi(purl->port);
+	int is_head = strncmp(http_headers, "HEAD ", 5) == 0;
+	size_t headers_len = strlen(http_headers);
+	struct str_buffer response;
+	struct http_parser parser;
+	struct http_stream_ctx ctx;
+	struct http_decoder decoder;
+	enum http_error error = HTTP_OK;
+
+	/* Allocate memeory for htmlcontent */
+	struct http_response *hresp = (struct http_response*)http_malloc(sizeof(struct http_response));
+	if(hresp == NULL)
+	{
+		http_free(http_headers);
+		parsed_url_free(purl);
+		http_set_error(HTTP_ERR_MEMORY);
+		return NULL;
+	}
+	hresp->body = NULL;
+	hresp->body_len = 0;
+	hresp->request_headers = http_headers;
+	hresp->response_headers = NULL;
+	http_header_map_init(&hresp->headers);
+	hresp->status_code = NULL;
+	hresp->status_text = NULL;
+	hresp->request_uri = purl;
+	memset(&hresp->timing, 0, sizeof(hresp->timing));
+	hresp->timing.start = http_now_ns();
+	ctx.hresp = hresp;
+	ctx.stream = stream;
+	ctx.decoder = o.decompress ? &decoder : NULL;
+	ctx.error = HTTP_OK;
+	http_decoder_init(&decoder);
+	long long first_byte = 0;
+	if(secure && http_tls_transport == NULL)
+		return http_req_fail(hresp, HTTP_ERR_TLS);
+
+	/*
+		Try an idle pooled connection first. If the server dropped it while it
+		sat in the pool, nothing comes back and the request is retried once
+		on a fresh connection.
+	*/
+	int attempt;
+	for(attempt = 0; attempt < 2; attempt++)
+	{
+		int reused = 0;
+		tls = NULL;
+		sock = attempt == 0 ? http_pool_acquire_tls(purl->host, port, secure ? &tls : NULL) : -1;
+		if(sock >= 0)
 		{
-			if(str_contains(token, "Location:"))
+			reused = 1;
+			http_metrics_conn(HTTP_CONN_REUSED, purl->host, port);
+		}
+		else if((sock = http_connect(purl, &hresp->timing, &o)) < 0)
+		{
+			return http_req_fail(hresp, http_last_error());
+		}
+		hresp->timing.reused = reused;
+		http_set_nonblocking(sock, 1);
+
+		/* A new https connection starts with the handshake */
+		if(secure && !reused && (error = http_tls_handshake(sock, purl, &tls, &hresp->timing, &o)) != HTTP_OK)
+		{
+			http_conn_close(sock, tls);
+			return http_req_fail(hresp, error);
+		}
+
+		/* Send headers and body to server in one go */
+		long long send_start = http_now_ns();
+		http_iovec iov[2];
+		http_iov_set(&iov[0], http_headers, headers_len);
+		http_iov_set(&iov[1], body, body_len);
+		error = http_send_timed(sock, tls, iov, body_len > 0 ? 2 : 1, &o);
+		if(error != HTTP_OK)
+		{
+			http_conn_close(sock, tls);
+			if(reused && error == HTTP_ERR_SEND)
 			{
-				/* Extract url */
-				char *location = str_replace("Location: ", "", token);
-				return http_post(location, custom_headers, post_data);
+				http_metrics_conn(HTTP_CONN_STALE, purl->host, port);
+				hresp->timing.retries++;
+				continue;
 			}
-			token = strtok(NULL, "\r\n");
+			return http_req_fail(hresp, error);
 		}
+
+		long long sent_at = http_now_ns();
+		hresp->timing.send = sent_at - send_start;
+		hresp->timing.bytes_sent = headers_len + body_len;
+
+		/* Recieve straight into the spare capacity of the response buffer */
+		str_buffer_init(&response);
+		http_parser_init(&parser, is_head);
+		parser.on_headers_complete = http_stream_on_headers_complete;
+		parser.on_body = http_stream_on_body;
+		parser.data = &ctx;
+		int recived_len = 0;
+		while(1)
+		{
+			if(str_buffer_reserve(&response, BUFSIZ) < 0)
+			{
+				error = HTTP_ERR_MEMORY;
+				break;
+			}
+			short events;
+			recived_len = (int)http_recv(sock, tls, response.data + response.len, response.cap - response.len - 1, &events);
+			if(recived_len == HTTP_TLS_TRUNCATED)
+			{
+				/* Without close_notify only a body read until close may end, anything else was cut */
+				recived_len = parser.state == HTTP_PARSE_BODY_UNTIL_CLOSE ? 0 : -1;
+			}
+			if(recived_len < 0 && events != 0)
+			{
+				/* Wait for more within the read timeout and the deadline */
+				int ready = http_wait(sock, events, http_wait_ms(&o, o.read_timeout_ms));
+				if(ready > 0)
+					continue;
+				error = ready == 0 ? http_timeout_error(&o, HTTP_ERR_READ_TIMEOUT) : HTTP_ERR_RECV;
+				break;
+			}
+			if(recived_len < 0)
+				error = HTTP_ERR_RECV;
+			if(recived_len <= 0)
+				break;
+			if(first_byte == 0)
+			{
+				first_byte = http_now_ns();
+				hresp->timing.ttfb = first_byte - sent_at;
+			}
+			hresp->timing.bytes_received += recived_len;
+			str_buffer_commit(&response, recived_len);
+			if(http_parser_execute(&parser, response.data, response.len) >= HTTP_PARSE_DONE)
+				break;
+
+			/* Body bytes have been handed on, drop them */
+			if(parser.state > HTTP_PARSE_HEADERS && parser.state < HTTP_PARSE_TRAILERS)
+			{
+				str_buffer_consume(&response, parser.pos);
+				http_parser_shift(&parser, parser.pos);
+			}
+
+			#ifdef HTTP_HAVE_SPLICE
+				/* The rest of a body of known length goes straight to the sink */
+				if(sink != NULL && sink->active && sink->splice && tls == NULL && !decoder.active && parser.state == HTTP_PARSE_BODY && parser.pos == response.len)
+				{
+					long long moved;
+					int closed;
+					error = http_sink_splice(sock, sink, parser.remaining, &o, &moved, &closed);
+					hresp->timing.bytes_received += moved;
+					http_parser_skip_body(&parser, moved);
+					if(closed)
+						recived_len = 0;
+					if(error != HTTP_OK || closed || parser.state == HTTP_PARSE_DONE)
+						break;
+				}
+			#endif
+		}
+		if(error == HTTP_OK && recived_len == 0 && http_parser_finish(&parser) != HTTP_PARSE_DONE)
+			error = HTTP_ERR_RECV;
+		if((error == HTTP_OK || error == HTTP_ERR_RECV) && recived_len <= 0 && reused && hresp->timing.bytes_received == 0)
+		{
+			/* Stale pooled connection */
+			http_conn_close(sock, tls);
+			str_buffer_free(&response);
+			http_metrics_conn(HTTP_CONN_STALE, purl->host, port);
+			hresp->timing.retries++;
+			hresp->timing.bytes_received = 0;
+			first_byte = 0;
+			error = HTTP_OK;
+			continue;
+		}
+		break;
+	}
+
+	/* The body ended, the compressed stream in it has to end there too */
+	if(error == HTTP_OK && parser.state == HTTP_PARSE_DONE)
+		http_decoder_finish(&decoder);
+	http_decoder_end(&decoder);
+	if(attempt == 2)
+		return http_req_fail(hresp, HTTP_ERR_RECV);
+
+	/* Keep the connection for the next request if the response was framed */
+	if(error == HTTP_OK && parser.state == HTTP_PARSE_DONE && parser.keep_alive && parser.pos == response.len)
+	{
+		http_set_nonblocking(sock, 0);
+		http_pool_release_tls(purl->host, port, sock, tls);
+		http_metrics_conn(HTTP_CONN_POOLED, purl->host, port);
 	}
 	else
 	{
-		/* We're not dealing with a redirect, just return the same structure */
-		return hresp;
+		http_conn_close(sock, tls);
+		http_metrics_conn(HTTP_CONN_CLOSED, purl->host, port);
+	}
+	long long done = http_now_ns();
+	if(first_byte != 0)
+		hresp->timing.body = done - first_byte;
+	hresp->timing.total = done - hresp->timing.start;
+
+	/* A compressed body that does not inflate is not the body */
+	if(error == HTTP_OK && decoder.failed)
+		error = HTTP_ERR_PROTOCOL;
+
+	/* A response the parser rejected, a body that could not be written, or a callback that aborted */
+	if(error == HTTP_OK && parser.state != HTTP_PARSE_DONE)
+		error = sink != NULL && sink->error != HTTP_OK ? sink->error : ctx.error != HTTP_OK ? ctx.error : HTTP_ERR_PROTOCOL;
+
+	/* Failed, or a response the parser could not make sense of */
+	if(error != HTTP_OK || hresp->response_headers == NULL)
+	{
+		str_buffer_free(&response);
+		return http_req_fail(hresp, error != HTTP_OK ? error : HTTP_ERR_PROTOCOL);
+	}
+
+	http_stream_finish(hresp, &parser, response.data);
+	str_buffer_free(&response);
+	http_metrics_response(hresp);
+
+	/* Return response */
+	return hresp;
+}
+
+/*
+	Makes a HTTP request and streams the response to the given callbacks.
+	Body bytes are passed on as they arrive and then dropped, so memory use
+	stays bounded whatever the size of the body. The returned response holds
+	the status and headers but no body. The request body, if any, stays
+	owned by the caller and is sent straight after the headers without
+	being copied. Waits are bounded by opts, NULL for the defaults. On
+	failure NULL is returned and http_last_error tells why.
+*/
+struct http_response* http_req_stream_opts(char *http_headers, const char *body, size_t body_len, struct parsed_url *purl, struct http_stream *stream, const struct http_request_opts *opts)
+{
+	return http_req_run(http_headers, body, body_len, purl, stream, NULL, opts);
+}
+
+/*
+	Makes a HTTP request and streams the response to the given callbacks,
+	with the default timeouts
+*/
+struct http_response* http_req_stream(char *http_headers, struct parsed_url *purl, struct http_stream *stream)
+{
+	return http_req_stream_opts(http_headers, NULL, 0, purl, stream, NULL);
+}
+
+/*
+	Collects the body of a response into a buffer
+*/
+int http_req_collect_body(const char *chunk, size_t len, void *data)
+{
+	return str_buffer_append((struct str_buffer*)data, chunk, len);
+}
+
+/*
+	Makes a HTTP request within the timeouts of opts and returns the response.
+	The request body, if any, stays owned by the caller.
+*/
+struct http_response* http_req_opts(char *http_headers, const char *body, size_t body_len, struct parsed_url *purl, const struct http_request_opts *opts)
+{
+	struct str_buffer response_body;
+	struct http_stream stream;
+	str_buffer_init(&response_body);
+	stream.data = &response_body;
+	stream.on_headers = NULL;
+	stream.on_body = http_req_collect_body;
+
+	struct http_response *hresp = http_req_stream_opts(http_headers, body, body_len, purl, &stream, opts);
+	if(hresp == NULL)
+	{
+		/* Collecting only stops when the body does not fit in memory */
+		if(http_last_error() == HTTP_ERR_ABORTED)
+			http_set_error(HTTP_ERR_MEMORY);
+		str_buffer_free(&response_body);
+		return NULL;
 	}
+
+	/* Body as collected from the stream, an empty string when there is none */
+	str_buffer_append(&response_body, "", 0);
+	hresp->body = response_body.data;
+	hresp->body_len = response_body.len;
+	return hresp;
 }
 
 /*
@@ -156,214 +1290,189 @@ struct http_response* handle_redirect_post(struct http_response* hresp, char* cu
 */
 struct http_response* http_req(char *http_headers, struct parsed_url *purl)
 {
-	/* Parse url */
-	if(purl == NULL)
+	return http_req_opts(http_headers, NULL, 0, purl, NULL);
+}
+
+/*
+	Tells whether a block of headers has a header of the given name
+*/
+int http_has_header(const char *headers, const char *name)
+{
+	const char *line = headers;
+	size_t len = strlen(name);
+	while(line != NULL && *line != '\0')
 	{
-		printf("Unable to parse url");
-		return NULL;
+		if(str_starts_with_nocase(line, name) && line[len] == ':')
+			return 1;
+		line = strchr(line, '\n');
+		if(line != NULL)
+			line++;
 	}
+	return 0;
+}
 
-	/* Declare variable */
-	int sock;
-	int tmpres;
-	char buf[BUFSIZ+1];
-	struct sockaddr_in *remote;
+/*
+	Builds the request line and headers of a request without a body
+*/
+char* http_build_request(const char *method, struct parsed_url *purl, char *custom_headers)
+{
+	struct str_buffer req;
+	str_buffer_init(&req);
 
-	/* Allocate memeory for htmlcontent */
-	struct http_response *hresp = (struct http_response*)malloc(sizeof(struct http_response));
-	if(hresp == NULL)
+	/* Request line and basic headers */
+	str_buffer_append_str(&req, method);
+	str_buffer_append_str(&req, " /");
+	if(purl->path != NULL)
+		str_buffer_append_str(&req, purl->path);
+	if(purl->query != NULL)
 	{
-		printf("Unable to allocate memory for htmlcontent.");
-		return NULL;
+		str_buffer_append_str(&req, "?");
+		str_buffer_append_str(&req, purl->query);
 	}
-	hresp->body = NULL;
-	hresp->request_headers = NULL;
-	hresp->response_headers = NULL;
-	hresp->status_code = NULL;
-	hresp->status_text = NULL;
+	str_buffer_append_str(&req, " HTTP/1.1\r\nHost:");
+	str_buffer_append_str(&req, purl->host);
+	str_buffer_append_str(&req, "\r\nConnection:keep-alive\r\n");
 
-	/* Create TCP socket */
-	if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+	/* Handle authorisation if needed */
+	if(purl->username != NULL)
 	{
-	    printf("Can't create TCP socket");
-		return NULL;
+		/* Format username:password pair, on the stack unless it is long */
+		char pair[256];
+		size_t user_len = strlen(purl->username);
+		size_t pass_len = purl->password != NULL ? strlen(purl->password) : 0;
+		char *upwd = user_len + pass_len + 1 <= sizeof(pair) ? pair : (char*)http_malloc(user_len + pass_len + 1);
+		if(upwd != NULL)
+		{
+			memcpy(upwd, purl->username, user_len);
+			upwd[user_len] = ':';
+			if(pass_len > 0)
+				memcpy(upwd + user_len + 1, purl->password, pass_len);
+
+			/* Base64 encode straight into the request */
+			str_buffer_append_str(&req, "Authorization: Basic ");
+			str_buffer_append_base64(&req, upwd, user_len + pass_len + 1);
+			str_buffer_append_str(&req, "\r\n");
+			if(upwd != pair)
+				http_free(upwd);
+		}
 	}
 
-	/* Set remote->sin_addr.s_addr */
-	remote = (struct sockaddr_in *)malloc(sizeof(struct sockaddr_in *));
-	remote->sin_family = AF_INET;
-  	tmpres = inet_pton(AF_INET, purl->ip, (void *)(&(remote->sin_addr.s_addr)));
-  	if( tmpres < 0)
-  	{
-    	printf("Can't set remote->sin_addr.s_addr");
-    	return NULL;
-  	}
-	else if(tmpres == 0)
-  	{
-		printf("Not a valid IP");
-    	return NULL;
-  	}
-	remote->sin_port = htons(atoi(purl->port));
-
-	/* Connect */
-	if(connect(sock, (struct sockaddr *)remote, sizeof(struct sockaddr)) < 0)
-	{
-	    printf("Could not connect");
-		return NULL;
-	}
+	/* Add custom headers, and close */
+	if(custom_headers != NULL)
+		str_buffer_append_str(&req, custom_headers);
+	str_buffer_append_str(&req, "\r\n");
+	return req.data;
+}
 
-	/* Send headers to server */
-	int sent = 0;
-	while(sent < strlen(http_headers))
-	{
-	    tmpres = send(sock, http_headers+sent, strlen(http_headers)-sent, 0);
-		if(tmpres == -1)
+/*
+	Builds a request like http_build_request, and asks for a compressed
+	response when opts wants bodies decompressed and custom_headers does not
+	ask already
+*/
+char* http_build_request_opts(const char *method, struct parsed_url *purl, char *custom_headers, const struct http_request_opts *opts)
+{
+	#ifdef HTTP_ACCEPT_ENCODING
+		if(opts->decompress && !http_has_header(custom_headers, "Accept-Encoding"))
 		{
-			printf("Can't send headers");
-			return NULL;
+			struct str_buffer headers;
+			str_buffer_init(&headers);
+			str_buffer_append_str(&headers, HTTP_ACCEPT_ENCODING);
+			if(custom_headers != NULL)
+				str_buffer_append_str(&headers, custom_headers);
+			char *http_headers = http_build_request(method, purl, headers.data);
+			str_buffer_free(&headers);
+			return http_headers;
 		}
-		sent += tmpres;
-	 }
-
-	/* Recieve into response*/
-	char *response = (char*)malloc(0);
-	char BUF[BUFSIZ];
-	size_t recived_len = 0;
-	while((recived_len = recv(sock, BUF, BUFSIZ-1, 0)) > 0)
-	{
-        BUF[recived_len] = '\0';
-		response = (char*)realloc(response, strlen(response) + strlen(BUF) + 1);
-		sprintf(response, "%s%s", response, BUF);
-	}
-	if (recived_len < 0)
-    {
-		free(http_headers);
-		#ifdef _WIN32
-			closesocket(sock);
-		#else
-			close(sock);
-		#endif
-        printf("Unabel to recieve");
-		return NULL;
-    }
-
-	/* Reallocate response */
-	response = (char*)realloc(response, strlen(response) + 1);
-
-	/* Close socket */
-	#ifdef _WIN32
-		closesocket(sock);
 	#else
-		close(sock);
+		(void)opts;
 	#endif
-
-	/* Parse status code and text */
-	char *status_line = get_until(response, "\r\n");
-	status_line = str_replace("HTTP/1.1 ", "", status_line);
-	char *status_code = str_ndup(status_line, 4);
-	status_code = str_replace(" ", "", status_code);
-	char *status_text = str_replace(status_code, "", status_line);
-	status_text = str_replace(" ", "", status_text);
-	hresp->status_code = status_code;
-	hresp->status_code_int = atoi(status_code);
-	hresp->status_text = status_text;
-
-	/* Parse response headers */
-	char *headers = get_until(response, "\r\n\r\n");
-	hresp->response_headers = headers;
-
-	/* Assign request headers */
-	hresp->request_headers = http_headers;
-
-	/* Assign request url */
-	hresp->request_uri = purl;
-
-	/* Parse body */
-	char *body = strstr(response, "\r\n\r\n");
-	body = str_replace("\r\n\r\n", "", body);
-	hresp->body = body;
-
-	/* Return response */
-	return hresp;
+	return http_build_request(method, purl, custom_headers);
 }
 
 /*
-	Makes a HTTP GET request to the given url
+	Makes a HTTP GET request to the given url, following redirects within
+	the limits of opts
 */
-struct http_response* http_get(char *url, char *custom_headers)
+struct http_response* http_get_opts(char *url, char *custom_headers, const struct http_request_opts *opts)
 {
+	struct http_request_opts o;
+	http_opts_begin(&o, opts);
+	http_set_error(HTTP_OK);
+
 	/* Parse url */
 	struct parsed_url *purl = parse_url(url);
 	if(purl == NULL)
-	{
-		printf("Unable to parse url");
 		return NULL;
-	}
-
-	/* Declare variable */
-	char *http_headers = (char*)malloc(1024);
 
 	/* Build query/headers */
-	if(purl->path != NULL)
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "GET /%s?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "GET /%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->host);
-		}
-	}
-	else
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "GET /?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "GET / HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->host);
-		}
-	}
+	char *http_headers = http_build_request_opts("GET", purl, custom_headers, &o);
 
-	/* Handle authorisation if needed */
-	if(purl->username != NULL)
-	{
-		/* Format username:password pair */
-		char *upwd = (char*)malloc(1024);
-		sprintf(upwd, "%s:%s", purl->username, purl->password);
-		upwd = (char*)realloc(upwd, strlen(upwd) + 1);
+	/* Make request and return response */
+	struct http_response *hresp = http_req_opts(http_headers, NULL, 0, purl, &o);
 
-		/* Base64 encode */
-		char *base64 = base64_encode(upwd);
+	/* Handle redirect */
+	return handle_redirect_get(hresp, custom_headers, &o);
+}
 
-		/* Form header */
-		char *auth_header = (char*)malloc(1024);
-		sprintf(auth_header, "Authorization: Basic %s\r\n", base64);
-		auth_header = (char*)realloc(auth_header, strlen(auth_header) + 1);
+/*
+	Makes a HTTP GET request to the given url
+*/
+struct http_response* http_get(char *url, char *custom_headers)
+{
+	return http_get_opts(url, custom_headers, NULL);
+}
 
-		/* Add to header */
-		http_headers = (char*)realloc(http_headers, strlen(http_headers) + strlen(auth_header) + 2);
-		sprintf(http_headers, "%s%s", http_headers, auth_header);
-	}
+/*
+	Makes a HTTP POST request to the given url with a body of body_len
+	bytes, which may hold any data, following redirects within the limits of
+	opts. A form Content-Type is sent unless custom_headers has one.
+*/
+struct http_response* http_post_body_opts(char *url, char *custom_headers, const char *body, size_t body_len, const struct http_request_opts *opts)
+{
+	struct http_request_opts o;
+	http_opts_begin(&o, opts);
+	http_set_error(HTTP_OK);
 
-	/* Add custom headers, and close */
+	/* Parse url */
+	struct parsed_url *purl = parse_url(url);
+	if(purl == NULL)
+		return NULL;
+
+	/* Build query/headers, the body headers go before the custom ones */
+	struct str_buffer extra;
+	char length[64];
+	str_buffer_init(&extra);
+	sprintf(length, "Content-Length:%lu\r\n", (unsigned long)body_len);
+	str_buffer_append_str(&extra, length);
+	if(!http_has_header(custom_headers, "Content-Type"))
+		str_buffer_append_str(&extra, "Content-Type:application/x-www-form-urlencoded\r\n");
 	if(custom_headers != NULL)
-	{
-		sprintf(http_headers, "%s%s\r\n", http_headers, custom_headers);
-	}
-	else
-	{
-		sprintf(http_headers, "%s\r\n", http_headers);
-	}
-	http_headers = (char*)realloc(http_headers, strlen(http_headers) + 1);
+		str_buffer_append_str(&extra, custom_headers);
+	char *http_headers = http_build_request_opts("POST", purl, extra.data, &o);
+	str_buffer_free(&extra);
 
-	/* Make request and return response */
-	struct http_response *hresp = http_req(http_headers, purl);
+	/* Make request, the body goes out as it is, and return response */
+	struct http_response *hresp = http_req_opts(http_headers, body, body_len, purl, &o);
 
 	/* Handle redirect */
-	return handle_redirect_get(hresp, custom_headers);
+	return handle_redirect_post(hresp, custom_headers, body, body_len, &o);
+}
+
+/*
+	Makes a HTTP POST request to the given url with a binary body
+*/
+struct http_response* http_post_body(char *url, char *custom_headers, const char *body, size_t body_len)
+{
+	return http_post_body_opts(url, custom_headers, body, body_len, NULL);
+}
+
+/*
+	Makes a HTTP POST request to the given url, following redirects within
+	the limits of opts
+*/
+struct http_response* http_post_opts(char *url, char *custom_headers, char *post_data, const struct http_request_opts *opts)
+{
+	return http_post_body_opts(url, custom_headers, post_data, strlen(post_data), opts);
 }
 
 /*
@@ -371,156 +1480,113 @@ struct http_response* http_get(char *url, char *custom_headers)
 */
 struct http_response* http_post(char *url, char *custom_headers, char *post_data)
 {
-	/* Parse url */
-	struct parsed_url *purl = parse_url(url);
-	if(purl == NULL)
-	{
-		printf("Unable to parse url");
-		return NULL;
-	}
-
-	/* Declare variable */
-	char *http_headers = (char*)malloc(1024);
+	return http_post_body_opts(url, custom_headers, post_data, strlen(post_data), NULL);
+}
 
-	/* Build query/headers */
-	if(purl->path != NULL)
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "POST /%s?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\nContent-Length:%zu\r\nContent-Type:application/x-www-form-urlencoded\r\n", purl->path, purl->query, purl->host, strlen(post_data));
-		}
-		else
-		{
-			sprintf(http_headers, "POST /%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\nContent-Length:%zu\r\nContent-Type:application/x-www-form-urlencoded\r\n", purl->path, purl->host, strlen(post_data));
-		}
-	}
-	else
+/*
+	Makes a HTTP POST request to the given url that uploads the whole of a
+	regular file. The file is mapped rather than read into memory, so its
+	pages go from the page cache to the socket without a copy on the heap
+	and uploads are not limited by free memory. Sends a Content-Type of
+	application/octet-stream unless custom_headers has one.
+*/
+struct http_response* http_post_fd_opts(char *url, char *custom_headers, int fd, const struct http_request_opts *opts)
+{
+	size_t len;
+	http_set_error(HTTP_OK);
+	char *data = http_map_file(fd, &len);
+	if(data == NULL)
 	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "POST /?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\nContent-Length:%zu\r\nContent-Type:application/x-www-form-urlencoded\r\n", purl->query, purl->host, strlen(post_data));
-		}
-		else
-		{
-			sprintf(http_headers, "POST / HTTP/1.1\r\nHost:%s\r\nConnection:close\r\nContent-Length:%zu\r\nContent-Type:application/x-www-form-urlencoded\r\n", purl->host, strlen(post_data));
-		}
+		http_set_error(HTTP_ERR_FILE);
+		return NULL;
 	}
 
-	/* Handle authorisation if needed */
-	if(purl->username != NULL)
-	{
-		/* Format username:password pair */
-		char *upwd = (char*)malloc(1024);
-		sprintf(upwd, "%s:%s", purl->username, purl->password);
-		upwd = (char*)realloc(upwd, strlen(upwd) + 1);
-
-		/* Base64 encode */
-		char *base64 = base64_encode(upwd);
+	/* The content type goes with the custom headers, so redirects keep it */
+	struct str_buffer headers;
+	str_buffer_init(&headers);
+	if(!http_has_header(custom_headers, "Content-Type"))
+		str_buffer_append_str(&headers, "Content-Type:application/octet-stream\r\n");
+	if(custom_headers != NULL)
+		str_buffer_append_str(&headers, custom_headers);
 
-		/* Form header */
-		char *auth_header = (char*)malloc(1024);
-		sprintf(auth_header, "Authorization: Basic %s\r\n", base64);
-		auth_header = (char*)realloc(auth_header, strlen(auth_header) + 1);
+	struct http_response *hresp = http_post_body_opts(url, headers.data, data, len, opts);
+	str_buffer_free(&headers);
+	http_unmap_file(data, len);
+	return hresp;
+}
 
-		/* Add to header */
-		http_headers = (char*)realloc(http_headers, strlen(http_headers) + strlen(auth_header) + 2);
-		sprintf(http_headers, "%s%s", http_headers, auth_header);
-	}
+/*
+	Makes a HTTP POST request to the given url that uploads a regular file
+*/
+struct http_response* http_post_fd(char *url, char *custom_headers, int fd)
+{
+	return http_post_fd_opts(url, custom_headers, fd, NULL);
+}
 
-	if(custom_headers != NULL)
-	{
-		sprintf(http_headers, "%s%s\r\n", http_headers, custom_headers);
-		sprintf(http_headers, "%s\r\n%s", http_headers, post_data);
-	}
-	else
+/*
+	Makes a HTTP POST request to the given url that uploads the file at path,
+	following redirects within the limits of opts
+*/
+struct http_response* http_post_file_opts(char *url, char *custom_headers, const char *path, const struct http_request_opts *opts)
+{
+	#ifdef _WIN32
+		int fd = _open(path, _O_RDONLY | _O_BINARY);
+	#else
+		int fd = open(path, O_RDONLY);
+	#endif
+	if(fd < 0)
 	{
-		sprintf(http_headers, "%s\r\n%s", http_headers, post_data);
+		http_set_error(HTTP_ERR_FILE);
+		return NULL;
 	}
-	http_headers = (char*)realloc(http_headers, strlen(http_headers) + 1);
-
-	/* Make request and return response */
-	struct http_response *hresp = http_req(http_headers, purl);
+	struct http_response *hresp = http_post_fd_opts(url, custom_headers, fd, opts);
+	#ifdef _WIN32
+		_close(fd);
+	#else
+		close(fd);
+	#endif
+	return hresp;
+}
 
-	/* Handle redirect */
-	return handle_redirect_post(hresp, custom_headers, post_data);
+/*
+	Makes a HTTP POST request to the given url that uploads the file at path
+*/
+struct http_response* http_post_file(char *url, char *custom_headers, const char *path)
+{
+	return http_post_file_opts(url, custom_headers, path, NULL);
 }
 
 /*
-	Makes a HTTP HEAD request to the given url
+	Makes a HTTP HEAD request to the given url, following redirects within
+	the limits of opts
 */
-struct http_response* http_head(char *url, char *custom_headers)
+struct http_response* http_head_opts(char *url, char *custom_headers, const struct http_request_opts *opts)
 {
+	struct http_request_opts o;
+	http_opts_begin(&o, opts);
+	http_set_error(HTTP_OK);
+
 	/* Parse url */
 	struct parsed_url *purl = parse_url(url);
 	if(purl == NULL)
-	{
-		printf("Unable to parse url");
 		return NULL;
-	}
-
-	/* Declare variable */
-	char *http_headers = (char*)malloc(1024);
 
 	/* Build query/headers */
-	if(purl->path != NULL)
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "HEAD /%s?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "HEAD /%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->host);
-		}
-	}
-	else
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "HEAD/?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "HEAD / HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->host);
-		}
-	}
-
-	/* Handle authorisation if needed */
-	if(purl->username != NULL)
-	{
-		/* Format username:password pair */
-		char *upwd = (char*)malloc(1024);
-		sprintf(upwd, "%s:%s", purl->username, purl->password);
-		upwd = (char*)realloc(upwd, strlen(upwd) + 1);
-
-		/* Base64 encode */
-		char *base64 = base64_encode(upwd);
-
-		/* Form header */
-		char *auth_header = (char*)malloc(1024);
-		sprintf(auth_header, "Authorization: Basic %s\r\n", base64);
-		auth_header = (char*)realloc(auth_header, strlen(auth_header) + 1);
-
-		/* Add to header */
-		http_headers = (char*)realloc(http_headers, strlen(http_headers) + strlen(auth_header) + 2);
-		sprintf(http_headers, "%s%s", http_headers, auth_header);
-	}
-
-	if(custom_headers != NULL)
-	{
-		sprintf(http_headers, "%s%s\r\n", http_headers, custom_headers);
-	}
-	else
-	{
-		sprintf(http_headers, "%s\r\n", http_headers);
-	}
-	http_headers = (char*)realloc(http_headers, strlen(http_headers) + 1);
+	char *http_headers = http_build_request_opts("HEAD", purl, custom_headers, &o);
 
 	/* Make request and return response */
-	struct http_response *hresp = http_req(http_headers, purl);
+	struct http_response *hresp = http_req_opts(http_headers, NULL, 0, purl, &o);
 
 	/* Handle redirect */
-	return handle_redirect_head(hresp, custom_headers);
+	return handle_redirect_head(hresp, custom_headers, &o);
+}
+
+/*
+	Makes a HTTP HEAD request to the given url
+*/
+struct http_response* http_head(char *url, char *custom_headers)
+{
+	return http_head_opts(url, custom_headers, NULL);
 }
 
 /*
@@ -528,65 +1594,15 @@ struct http_response* http_head(char *url, char *custom_headers)
 */
 struct http_response* http_options(char *url)
 {
+	http_set_error(HTTP_OK);
+
 	/* Parse url */
 	struct parsed_url *purl = parse_url(url);
 	if(purl == NULL)
-	{
-		printf("Unable to parse url");
 		return NULL;
-	}
-
-	/* Declare variable */
-	char *http_headers = (char*)malloc(1024);
 
 	/* Build query/headers */
-	if(purl->path != NULL)
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "OPTIONS /%s?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "OPTIONS /%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->path, purl->host);
-		}
-	}
-	else
-	{
-		if(purl->query != NULL)
-		{
-			sprintf(http_headers, "OPTIONS/?%s HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->query, purl->host);
-		}
-		else
-		{
-			sprintf(http_headers, "OPTIONS / HTTP/1.1\r\nHost:%s\r\nConnection:close\r\n", purl->host);
-		}
-	}
-
-	/* Handle authorisation if needed */
-	if(purl->username != NULL)
-	{
-		/* Format username:password pair */
-		char *upwd = (char*)malloc(1024);
-		sprintf(upwd, "%s:%s", purl->username, purl->password);
-		upwd = (char*)realloc(upwd, strlen(upwd) + 1);
-
-		/* Base64 encode */
-		char *base64 = base64_encode(upwd);
-
-		/* Form header */
-		char *auth_header = (char*)malloc(1024);
-		sprintf(auth_header, "Authorization: Basic %s\r\n", base64);
-		auth_header = (char*)realloc(auth_header, strlen(auth_header) + 1);
-
-		/* Add to header */
-		http_headers = (char*)realloc(http_headers, strlen(http_headers) + strlen(auth_header) + 2);
-		sprintf(http_headers, "%s%s", http_headers, auth_header);
-	}
-
-	/* Build headers */
-	sprintf(http_headers, "%s\r\n", http_headers);
-	http_headers = (char*)realloc(http_headers, strlen(http_headers) + 1);
+	char *http_headers = http_build_request("OPTIONS", purl, NULL);
 
 	/* Make request and return response */
 	struct http_response *hresp = http_req(http_headers, purl);
@@ -603,11 +1619,21 @@ void http_response_free(struct http_response *hresp)
 	if(hresp != NULL)
 	{
 		if(hresp->request_uri != NULL) parsed_url_free(hresp->request_uri);
-		if(hresp->body != NULL) free(hresp->body);
-		if(hresp->status_code != NULL) free(hresp->status_code);
-		if(hresp->status_text != NULL) free(hresp->status_text);
-		if(hresp->request_headers != NULL) free(hresp->request_headers);
-		if(hresp->response_headers != NULL) free(hresp->response_headers);
-		free(hresp);
+		if(hresp->body != NULL) http_free(hresp->body);
+		if(hresp->status_code != NULL) http_free(hresp->status_code);
+		if(hresp->status_text != NULL) http_free(hresp->status_text);
+		if(hresp->request_headers != NULL) http_free(hresp->request_headers);
+		if(hresp->response_headers != NULL) http_free(hresp->response_headers);
+		http_header_map_free(&hresp->headers);
+		http_free(hresp);
 	}
 }
+
+/*
+	The event loop engine, pipelining, downloads and request templates build on
+	everything above
+*/
+#include "httpevent.h"
+#include "pipeline.h"
+#include "download.h"
+#include "template.h"
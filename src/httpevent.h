@@ -0,0 +1,806 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+
+/*
+	Event loop engine: drives many requests over non-blocking sockets from a
+	single thread. Built on epoll, so only available on Linux.
+*/
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/*
+	Phases a request in the event loop goes through
+*/
+enum http_loop_phase
+{
+	HTTP_LOOP_RESOLVING,
+	HTTP_LOOP_CONNECTING,
+	HTTP_LOOP_SENDING,
+	HTTP_LOOP_RECEIVING
+};
+
+struct http_loop_req;
+
+/*
+	Represents a host lookup running on a resolver thread for the loop
+*/
+struct http_loop_lookup
+{
+	struct http_loop *loop;
+	struct http_loop_req *req;		/* NULL once the request stopped waiting for it */
+	int ok;
+	struct http_addrinfo addrs;
+	struct http_loop_lookup *next;
+};
+
+/*
+	Represents the event loop
+*/
+struct http_loop
+{
+	int epfd;
+	int wakefd;						/* eventfd signalled when a lookup is done */
+	int pending;
+	struct http_loop_req **timers;	/* requests with a timeout, a min-heap on expires */
+	int timer_count;
+	int timer_cap;
+	http_mutex lock;				/* guards the fields below, shared with resolver threads */
+	struct http_loop_lookup *resolved;
+	int lookups;					/* lookups still running */
+	int freed;						/* the last lookup to finish frees the loop */
+};
+
+/*
+	Represents a request in flight on the event loop
+*/
+struct http_loop_req
+{
+	struct http_loop *loop;
+	int timer;						/* index in the timer heap, -1 when not in it */
+	int sock;
+	int reused;
+	enum http_loop_phase phase;
+	struct http_addrinfo addrs;
+	int next_addr;
+	struct http_loop_lookup *lookup;	/* while resolving */
+	struct http_request_opts opts;
+	long long expires;				/* http_now_ms() the current wait times out at, 0 for never */
+	char *http_headers;
+	size_t headers_len;
+	size_t sent;
+	struct parsed_url *purl;
+	struct str_buffer response;
+	struct str_buffer body;
+	struct http_parser parser;
+	struct http_stream stream;
+	struct http_stream_ctx ctx;
+	struct http_response *hresp;
+	long long phase_start;			/* when resolving, connecting or sending started */
+	long long sent_at;
+	long long first_byte;
+	void (*on_done)(struct http_response *hresp, void *data);
+	void *data;
+};
+
+/*
+	Creates an event loop
+*/
+struct http_loop* http_loop_new()
+{
+	struct http_loop *loop = (struct http_loop*)calloc(1, sizeof(struct http_loop));
+	struct epoll_event ev;
+	if(loop == NULL)
+		return NULL;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(loop->epfd < 0 || loop->wakefd < 0 || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0)
+	{
+		if(loop->epfd >= 0)
+			close(loop->epfd);
+		if(loop->wakefd >= 0)
+			close(loop->wakefd);
+		free(loop);
+		return NULL;
+	}
+	pthread_mutex_init(&loop->lock, NULL);
+	return loop;
+}
+
+/*
+	Releases a loop along with the lookups it did not pick up
+*/
+void http_loop_destroy(struct http_loop *loop)
+{
+	while(loop->resolved != NULL)
+	{
+		struct http_loop_lookup *next = loop->resolved->next;
+		free(loop->resolved);
+		loop->resolved = next;
+	}
+	close(loop->epfd);
+	close(loop->wakefd);
+	pthread_mutex_destroy(&loop->lock);
+	free(loop->timers);
+	free(loop);
+}
+
+/*
+	Frees an event loop. Requests still in flight are not completed. Host
+	lookups still running keep the loop until they are done.
+*/
+void http_loop_free(struct http_loop *loop)
+{
+	if(loop == NULL)
+		return;
+	http_mutex_lock(&loop->lock);
+	int running = loop->lookups > 0;
+	loop->freed = 1;
+	http_mutex_unlock(&loop->lock);
+	if(!running)
+		http_loop_destroy(loop);
+}
+
+/*
+	Puts the request at index i of the timer heap
+*/
+void http_loop_timer_place(struct http_loop *loop, int i, struct http_loop_req *req)
+{
+	loop->timers[i] = req;
+	req->timer = i;
+}
+
+/*
+	Moves the request at index i of the timer heap up or down to where its
+	expiry belongs
+*/
+void http_loop_timer_fix(struct http_loop *loop, int i)
+{
+	struct http_loop_req *req = loop->timers[i];
+	while(i > 0 && loop->timers[(i - 1) / 2]->expires > req->expires)
+	{
+		http_loop_timer_place(loop, i, loop->timers[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while(1)
+	{
+		int child = 2 * i + 1;
+		if(child >= loop->timer_count)
+			break;
+		if(child + 1 < loop->timer_count && loop->timers[child + 1]->expires < loop->timers[child]->expires)
+			child++;
+		if(loop->timers[child]->expires >= req->expires)
+			break;
+		http_loop_timer_place(loop, i, loop->timers[child]);
+		i = child;
+	}
+	http_loop_timer_place(loop, i, req);
+}
+
+/*
+	Takes a request out of the timer heap
+*/
+void http_loop_timer_remove(struct http_loop *loop, struct http_loop_req *req)
+{
+	int i = req->timer;
+	if(i < 0)
+		return;
+	req->timer = -1;
+	struct http_loop_req *last = loop->timers[--loop->timer_count];
+	if(last != req)
+	{
+		http_loop_timer_place(loop, i, last);
+		http_loop_timer_fix(loop, i);
+	}
+}
+
+/*
+	Starts the timeout of the wait a request begins now: limit_ms, capped
+	by the deadline of the request. The heap has room for every request in
+	flight, see http_loop_submit_opts.
+*/
+void http_loop_req_wait(struct http_loop_req *req, int limit_ms)
+{
+	struct http_loop *loop = req->loop;
+	req->expires = limit_ms > 0 ? http_now_ms() + limit_ms : 0;
+	if(req->opts.deadline > 0 && (req->expires == 0 || req->opts.deadline < req->expires))
+		req->expires = req->opts.deadline;
+	if(req->expires == 0)
+	{
+		http_loop_timer_remove(loop, req);
+		return;
+	}
+	if(req->timer < 0)
+		http_loop_timer_place(loop, loop->timer_count++, req);
+	http_loop_timer_fix(loop, req->timer);
+}
+
+/*
+	Resets the receive state of a request before (re)sending it
+*/
+void http_loop_req_reset(struct http_loop_req *req)
+{
+	req->sent = 0;
+	str_buffer_free(&req->response);
+	str_buffer_free(&req->body);
+	http_parser_init(&req->parser, strncmp(req->http_headers, "HEAD ", 5) == 0);
+	req->parser.on_headers_complete = http_stream_on_headers_complete;
+	req->parser.on_body = http_stream_on_body;
+	req->parser.data = &req->ctx;
+}
+
+/*
+	Moves a request on to sending once its connection is up
+*/
+void http_loop_req_connected(struct http_loop_req *req)
+{
+	long long now = http_now_ns();
+	req->hresp->timing.connect += now - req->phase_start;
+	req->phase_start = now;
+	req->phase = HTTP_LOOP_SENDING;
+	http_loop_req_wait(req, req->opts.read_timeout_ms);
+	http_metrics_conn(HTTP_CONN_OPENED, req->purl->host, atoi(req->purl->port));
+}
+
+/*
+	Starts a non-blocking connect to the next address of the host that does
+	not fail right away, and waits for the socket to become writable.
+	Connecting and sending both wait for that.
+*/
+int http_loop_req_connect_next(struct http_loop_req *req)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = req;
+	while(req->next_addr < req->addrs.count)
+	{
+		int i = req->next_addr++;
+		req->sock = socket(req->addrs.addrs[i].ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+		if(req->sock < 0)
+			continue;
+		if(connect(req->sock, (struct sockaddr *)&req->addrs.addrs[i], req->addrs.addrlens[i]) == 0)
+		{
+			http_loop_req_connected(req);
+		}
+		else if(errno == EINPROGRESS)
+		{
+			req->phase = HTTP_LOOP_CONNECTING;
+			http_loop_req_wait(req, req->opts.connect_timeout_ms);
+		}
+		else
+		{
+			close(req->sock);
+			req->sock = -1;
+			continue;
+		}
+		if(epoll_ctl(req->loop->epfd, EPOLL_CTL_ADD, req->sock, &ev) < 0)
+		{
+			close(req->sock);
+			req->sock = -1;
+			return -1;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+/*
+	Takes a request on from its resolved addresses
+*/
+enum http_error http_loop_req_resolved(struct http_loop_req *req, struct http_addrinfo *addrs)
+{
+	long long resolved = http_now_ns();
+	req->hresp->timing.dns += resolved - req->phase_start;
+	req->phase_start = resolved;
+	if(addrs == NULL)
+		return HTTP_ERR_RESOLVE;
+	req->addrs = *addrs;
+	req->next_addr = 0;
+	return http_loop_req_connect_next(req) < 0 ? HTTP_ERR_CONNECT : HTTP_OK;
+}
+
+/*
+	Called on a resolver thread once a lookup is done: hands the result to
+	the loop and wakes it up
+*/
+void http_loop_on_lookup(const char *host, struct http_addrinfo *addrs, void *data)
+{
+	struct http_loop_lookup *lookup = (struct http_loop_lookup*)data;
+	struct http_loop *loop = lookup->loop;
+	unsigned long long one = 1;
+	(void)host;
+	lookup->ok = addrs != NULL;
+	if(addrs != NULL)
+		lookup->addrs = *addrs;
+	http_mutex_lock(&loop->lock);
+	lookup->next = loop->resolved;
+	loop->resolved = lookup;
+	int orphaned = --loop->lookups == 0 && loop->freed;
+	if(!orphaned && write(loop->wakefd, &one, sizeof(one)) < 0)
+	{
+		/* The counter is already signalled */
+	}
+	http_mutex_unlock(&loop->lock);
+	if(orphaned)
+		http_loop_destroy(loop);
+}
+
+/*
+	Puts a request on a connection: an idle pooled one if allowed and
+	available, a new non-blocking connect otherwise. A host that is not in
+	the DNS cache is looked up on a resolver thread, so the loop never
+	blocks on it.
+*/
+enum http_error http_loop_req_connect(struct http_loop_req *req, int use_pool)
+{
+	struct epoll_event ev;
+	int port = atoi(req->purl->port);
+
+	http_loop_req_reset(req);
+	req->sock = use_pool ? http_pool_acquire(req->purl->host, port) : -1;
+	req->reused = req->sock >= 0;
+	req->hresp->timing.reused = req->reused;
+	req->first_byte = 0;
+	req->hresp->timing.bytes_received = 0;
+	req->phase_start = http_now_ns();
+	if(req->reused)
+	{
+		http_set_nonblocking(req->sock, 1);
+		req->phase = HTTP_LOOP_SENDING;
+		http_loop_req_wait(req, req->opts.read_timeout_ms);
+		http_metrics_conn(HTTP_CONN_REUSED, req->purl->host, port);
+		ev.events = EPOLLOUT;
+		ev.data.ptr = req;
+		if(epoll_ctl(req->loop->epfd, EPOLL_CTL_ADD, req->sock, &ev) < 0)
+		{
+			close(req->sock);
+			req->sock = -1;
+			return HTTP_ERR_CONNECT;
+		}
+		return HTTP_OK;
+	}
+
+	struct http_addrinfo addrs;
+	if(http_resolve_cached(req->purl->host, port, &addrs) == 0)
+		return http_loop_req_resolved(req, &addrs);
+
+	/* Not cached, wait for a lookup within the connect timeout */
+	struct http_loop_lookup *lookup = (struct http_loop_lookup*)calloc(1, sizeof(struct http_loop_lookup));
+	if(lookup == NULL)
+		return HTTP_ERR_MEMORY;
+	lookup->loop = req->loop;
+	lookup->req = req;
+	req->lookup = lookup;
+	req->phase = HTTP_LOOP_RESOLVING;
+	http_loop_req_wait(req, req->opts.connect_timeout_ms);
+	http_mutex_lock(&req->loop->lock);
+	req->loop->lookups++;
+	http_mutex_unlock(&req->loop->lock);
+	if(http_resolve_async(req->purl->host, port, http_loop_on_lookup, lookup) < 0)
+	{
+		http_mutex_lock(&req->loop->lock);
+		req->loop->lookups--;
+		http_mutex_unlock(&req->loop->lock);
+		req->lookup = NULL;
+		free(lookup);
+		return HTTP_ERR_RESOLVE;
+	}
+	return HTTP_OK;
+}
+
+/*
+	Finishes a request: the connection goes back to the pool if the response
+	allows it and the completion callback gets the response. It gets NULL,
+	with http_last_error set, if the request failed or the response was not
+	read to its end.
+*/
+void http_loop_req_complete(struct http_loop_req *req, enum http_error error)
+{
+	struct http_parser *parser = &req->parser;
+	struct http_response *hresp = req->hresp;
+
+	/* Out of the timer heap, and of a lookup it waits for */
+	http_loop_timer_remove(req->loop, req);
+	if(req->lookup != NULL)
+		req->lookup->req = NULL;
+
+	if(req->sock >= 0)
+	{
+		epoll_ctl(req->loop->epfd, EPOLL_CTL_DEL, req->sock, NULL);
+		if(error == HTTP_OK && parser->state == HTTP_PARSE_DONE && parser->keep_alive && parser->pos == req->response.len)
+		{
+			http_set_nonblocking(req->sock, 0);
+			http_pool_release(req->purl->host, atoi(req->purl->port), req->sock);
+			http_metrics_conn(HTTP_CONN_POOLED, req->purl->host, atoi(req->purl->port));
+		}
+		else
+		{
+			close(req->sock);
+			http_metrics_conn(HTTP_CONN_CLOSED, req->purl->host, atoi(req->purl->port));
+		}
+	}
+	long long now = http_now_ns();
+	if(req->first_byte != 0)
+		hresp->timing.body = now - req->first_byte;
+	hresp->timing.total = now - hresp->timing.start;
+
+	if(error == HTTP_OK && (parser->state != HTTP_PARSE_DONE || hresp->response_headers == NULL))
+		error = HTTP_ERR_PROTOCOL;
+	if(error != HTTP_OK)
+	{
+		/* Goes with the request headers and url it owns */
+		http_response_free(hresp);
+		hresp = NULL;
+	}
+	else
+	{
+		http_stream_finish(hresp, parser, req->response.data);
+		str_buffer_append(&req->body, "", 0);
+		hresp->body = req->body.data;
+		hresp->body_len = req->body.len;
+		str_buffer_init(&req->body);
+		http_metrics_response(hresp);
+	}
+	str_buffer_free(&req->response);
+	str_buffer_free(&req->body);
+
+	req->loop->pending--;
+	http_set_error(error);
+	req->on_done(hresp, req->data);
+	http_free(req);
+}
+
+/*
+	Drops a pooled connection that turned out to be closed by the server and
+	starts the request again on a fresh one
+*/
+void http_loop_req_retry(struct http_loop_req *req)
+{
+	epoll_ctl(req->loop->epfd, EPOLL_CTL_DEL, req->sock, NULL);
+	close(req->sock);
+	req->sock = -1;
+	http_metrics_conn(HTTP_CONN_STALE, req->purl->host, atoi(req->purl->port));
+	req->hresp->timing.retries++;
+	enum http_error error = http_loop_req_connect(req, 0);
+	if(error != HTTP_OK)
+		http_loop_req_complete(req, error);
+}
+
+/*
+	Writes as much of the request as the socket takes
+*/
+void http_loop_req_send(struct http_loop_req *req)
+{
+	while(req->sent < req->headers_len)
+	{
+		ssize_t n = send(req->sock, req->http_headers + req->sent, req->headers_len - req->sent, HTTP_SEND_FLAGS);
+		if(n < 0)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if(req->reused)
+				http_loop_req_retry(req);
+			else
+				http_loop_req_complete(req, HTTP_ERR_SEND);
+			return;
+		}
+		req->sent += n;
+		http_loop_req_wait(req, req->opts.read_timeout_ms);
+	}
+
+	/* All sent, wait for the response */
+	req->sent_at = http_now_ns();
+	req->hresp->timing.send = req->sent_at - req->phase_start;
+	req->hresp->timing.bytes_sent = req->headers_len;
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = req;
+	req->phase = HTTP_LOOP_RECEIVING;
+	http_loop_req_wait(req, req->opts.read_timeout_ms);
+	epoll_ctl(req->loop->epfd, EPOLL_CTL_MOD, req->sock, &ev);
+}
+
+/*
+	Reads whatever the socket has and feeds it to the parser
+*/
+void http_loop_req_recv(struct http_loop_req *req)
+{
+	struct str_buffer *response = &req->response;
+	while(1)
+	{
+		if(str_buffer_reserve(response, BUFSIZ) < 0)
+		{
+			http_loop_req_complete(req, HTTP_ERR_MEMORY);
+			return;
+		}
+		ssize_t n = recv(req->sock, response->data + response->len, response->cap - response->len - 1, 0);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if(n <= 0)
+		{
+			if(req->reused && req->hresp->timing.bytes_received == 0)
+			{
+				/* Stale pooled connection, nothing of the response came */
+				http_loop_req_retry(req);
+				return;
+			}
+
+			/* Only a body delimited by the close is complete now */
+			if(n < 0 || http_parser_finish(&req->parser) != HTTP_PARSE_DONE)
+				http_loop_req_complete(req, HTTP_ERR_RECV);
+			else
+				http_loop_req_complete(req, HTTP_OK);
+			return;
+		}
+		if(req->first_byte == 0)
+		{
+			req->first_byte = http_now_ns();
+			req->hresp->timing.ttfb = req->first_byte - req->sent_at;
+		}
+		req->hresp->timing.bytes_received += n;
+		http_loop_req_wait(req, req->opts.read_timeout_ms);
+		str_buffer_commit(response, n);
+		if(http_parser_execute(&req->parser, response->data, response->len) >= HTTP_PARSE_DONE)
+		{
+			/* The body is only collected, that stops when it does not fit in memory */
+			enum http_error error = req->ctx.error == HTTP_ERR_ABORTED ? HTTP_ERR_MEMORY : HTTP_ERR_PROTOCOL;
+			http_loop_req_complete(req, req->parser.state == HTTP_PARSE_DONE ? HTTP_OK : error);
+			return;
+		}
+
+		/* Body bytes have been handed on, drop them */
+		if(req->parser.state > HTTP_PARSE_HEADERS && req->parser.state < HTTP_PARSE_TRAILERS)
+		{
+			str_buffer_consume(response, req->parser.pos);
+			http_parser_shift(&req->parser, req->parser.pos);
+		}
+	}
+}
+
+/*
+	Gives up on the wait of a request that timed out. A connect attempt that
+	took too long fails over to the next address of the host.
+*/
+void http_loop_req_expire(struct http_loop_req *req)
+{
+	if(req->opts.deadline > 0 && http_now_ms() >= req->opts.deadline)
+	{
+		http_loop_req_complete(req, HTTP_ERR_TIMEOUT);
+		return;
+	}
+	if(req->phase == HTTP_LOOP_CONNECTING)
+	{
+		epoll_ctl(req->loop->epfd, EPOLL_CTL_DEL, req->sock, NULL);
+		close(req->sock);
+		req->sock = -1;
+		if(http_loop_req_connect_next(req) < 0)
+			http_loop_req_complete(req, HTTP_ERR_CONNECT_TIMEOUT);
+		return;
+	}
+	http_loop_req_complete(req, req->phase == HTTP_LOOP_RESOLVING ? HTTP_ERR_CONNECT_TIMEOUT : HTTP_ERR_READ_TIMEOUT);
+}
+
+/*
+	Handles readiness of a request's socket
+*/
+void http_loop_req_event(struct http_loop_req *req)
+{
+	if(req->phase == HTTP_LOOP_CONNECTING)
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if(getsockopt(req->sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		{
+			/* Fail over to the next address of the host */
+			epoll_ctl(req->loop->epfd, EPOLL_CTL_DEL, req->sock, NULL);
+			close(req->sock);
+			req->sock = -1;
+			if(http_loop_req_connect_next(req) < 0)
+				http_loop_req_complete(req, HTTP_ERR_CONNECT);
+			return;
+		}
+		http_loop_req_connected(req);
+	}
+	if(req->phase == HTTP_LOOP_SENDING)
+		http_loop_req_send(req);
+	else
+		http_loop_req_recv(req);
+}
+
+/*
+	Picks up the lookups resolver threads finished and moves their requests
+	on to connecting
+*/
+void http_loop_take_lookups(struct http_loop *loop)
+{
+	unsigned long long count;
+	if(read(loop->wakefd, &count, sizeof(count)) < 0)
+	{
+		/* Nothing signalled, the list is checked all the same */
+	}
+	http_mutex_lock(&loop->lock);
+	struct http_loop_lookup *lookup = loop->resolved;
+	loop->resolved = NULL;
+	http_mutex_unlock(&loop->lock);
+	while(lookup != NULL)
+	{
+		struct http_loop_lookup *next = lookup->next;
+		struct http_loop_req *req = lookup->req;
+		if(req != NULL)
+		{
+			req->lookup = NULL;
+			enum http_error error = http_loop_req_resolved(req, lookup->ok ? &lookup->addrs : NULL);
+			if(error != HTTP_OK)
+				http_loop_req_complete(req, error);
+		}
+		free(lookup);
+		lookup = next;
+	}
+}
+
+/*
+	Submits a request to the event loop, with the timeouts of opts, NULL for
+	the defaults. Takes ownership of http_headers and purl like http_req
+	does. on_done is called from http_loop_run once the request has
+	completed, with the response or NULL if it failed. Returns -1 if the
+	request could not be started, with the headers and url freed and
+	on_done not called. The event loop speaks plain HTTP only, https
+	requests are not started and fail with HTTP_ERR_TLS.
+*/
+int http_loop_submit_opts(struct http_loop *loop, char *http_headers, struct parsed_url *purl, const struct http_request_opts *opts, void (*on_done)(struct http_response *hresp, void *data), void *data)
+{
+	if(purl == NULL || strcmp(purl->scheme, "https") == 0)
+	{
+		if(purl != NULL)
+			http_set_error(HTTP_ERR_TLS);
+		http_free(http_headers);
+		parsed_url_free(purl);
+		return -1;
+	}
+
+	/* Room in the timer heap for every request in flight */
+	if(loop->timer_cap <= loop->pending)
+	{
+		int cap = loop->timer_cap > 0 ? loop->timer_cap * 2 : 64;
+		struct http_loop_req **timers = (struct http_loop_req**)realloc(loop->timers, cap * sizeof(struct http_loop_req*));
+		if(timers == NULL)
+		{
+			http_set_error(HTTP_ERR_MEMORY);
+			http_free(http_headers);
+			parsed_url_free(purl);
+			return -1;
+		}
+		loop->timers = timers;
+		loop->timer_cap = cap;
+	}
+
+	struct http_loop_req *req = (struct http_loop_req*)http_calloc(1, sizeof(struct http_loop_req));
+	struct http_response *hresp = (struct http_response*)http_calloc(1, sizeof(struct http_response));
+	if(req == NULL || hresp == NULL)
+	{
+		http_set_error(HTTP_ERR_MEMORY);
+		http_free(req);
+		http_free(hresp);
+		http_free(http_headers);
+		parsed_url_free(purl);
+		return -1;
+	}
+	hresp->request_headers = http_headers;
+	hresp->request_uri = purl;
+	hresp->timing.start = http_now_ns();
+
+	req->loop = loop;
+	req->timer = -1;
+	req->sock = -1;
+	http_opts_begin(&req->opts, opts);
+	req->http_headers = http_headers;
+	req->headers_len = strlen(http_headers);
+	req->purl = purl;
+	req->hresp = hresp;
+	req->on_done = on_done;
+	req->data = data;
+	str_buffer_init(&req->response);
+	str_buffer_init(&req->body);
+	req->stream.data = &req->body;
+	req->stream.on_headers = NULL;
+	req->stream.on_body = http_req_collect_body;
+	req->ctx.hresp = hresp;
+	req->ctx.stream = &req->stream;
+
+	enum http_error error = http_loop_req_connect(req, 1);
+	if(error != HTTP_OK)
+	{
+		http_set_error(error);
+		http_loop_timer_remove(loop, req);
+		str_buffer_free(&req->response);
+		http_response_free(hresp);
+		http_free(req);
+		return -1;
+	}
+	loop->pending++;
+	return 0;
+}
+
+/*
+	Submits a request to the event loop with the default timeouts
+*/
+int http_loop_submit(struct http_loop *loop, char *http_headers, struct parsed_url *purl, void (*on_done)(struct http_response *hresp, void *data), void *data)
+{
+	return http_loop_submit_opts(loop, http_headers, purl, NULL, on_done, data);
+}
+
+/*
+	Waits up to timeout_ms (-1 for no limit) for socket events and handles
+	them, then fails the requests whose wait timed out. Returns the number
+	of requests still in flight.
+*/
+int http_loop_run_once(struct http_loop *loop, int timeout_ms)
+{
+	struct epoll_event events[256];
+	int i;
+
+	/* Wake up in time for the first request to time out */
+	long long now = http_now_ms();
+	if(loop->timer_count > 0)
+	{
+		long long expires = loop->timers[0]->expires;
+		long long left = expires > now ? expires - now : 0;
+		if(timeout_ms < 0 || left < timeout_ms)
+			timeout_ms = (int)left;
+	}
+
+	int n = epoll_wait(loop->epfd, events, 256, timeout_ms);
+	for(i = 0; i < n; i++)
+	{
+		if(events[i].data.ptr == NULL)
+			http_loop_take_lookups(loop);
+		else
+			http_loop_req_event((struct http_loop_req*)events[i].data.ptr);
+	}
+
+	/* Each expiry either ends a request or starts a later wait for it */
+	now = http_now_ms();
+	while(loop->timer_count > 0 && now >= loop->timers[0]->expires)
+		http_loop_req_expire(loop->timers[0]);
+	return loop->pending;
+}
+
+/*
+	Runs the event loop until all submitted requests have completed
+*/
+void http_loop_run(struct http_loop *loop)
+{
+	while(loop->pending > 0)
+	{
+		http_loop_run_once(loop, -1);
+	}
+}
+
+#endif
@@ -0,0 +1,513 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Represents a range of bytes in the receive buffer. Offsets are used rather
+	than pointers so the buffer may be reallocated between calls.
+*/
+struct http_span
+{
+	size_t off;
+	size_t len;
+};
+
+/*
+	parser->colon when part of the line was searched without looking for colons
+*/
+#define HTTP_PARSER_COLON_UNKNOWN ((size_t)-1)
+
+/*
+	States of the response parser
+*/
+enum http_parser_state
+{
+	HTTP_PARSE_STATUS_LINE,
+	HTTP_PARSE_HEADERS,
+	HTTP_PARSE_BODY,
+	HTTP_PARSE_BODY_UNTIL_CLOSE,
+	HTTP_PARSE_CHUNK_SIZE,
+	HTTP_PARSE_CHUNK_DATA,
+	HTTP_PARSE_CHUNK_DATA_END,
+	HTTP_PARSE_TRAILERS,
+	HTTP_PARSE_DONE,
+	HTTP_PARSE_ERROR
+};
+
+/*
+	Represents an incremental HTTP response parser. Data is fed as it arrives
+	and the status line, headers and body are reported as spans of the
+	receive buffer, nothing is copied. A callback returning non-zero stops
+	the parser with HTTP_PARSE_ERROR.
+*/
+struct http_parser
+{
+	enum http_parser_state state;
+	size_t pos;						/* first byte not parsed yet */
+	size_t scan;					/* how far the current line was searched */
+	size_t colon;					/* first ':' of the current line plus one, 0 if none so far */
+	size_t block;					/* bytes whose line ends and colons are in the masks below */
+	size_t block_end;
+	unsigned long long newlines;
+	unsigned long long colons;
+	int is_head;
+	int version_minor;
+	int status_code;
+	struct http_span status_text;
+	struct http_span head;			/* status line and headers */
+	struct http_span trailers;		/* trailer lines after a chunked body */
+	long long content_length;		/* -1 when not given */
+	long long remaining;			/* body or chunk bytes still expected */
+	int transfer_encoding;
+	int chunked;
+	int connection_close;
+	int keep_alive;
+	void *data;
+	int (*on_header)(struct http_parser *parser, const char *buf, struct http_span name, struct http_span value);
+	int (*on_headers_complete)(struct http_parser *parser, const char *buf);
+	int (*on_body)(struct http_parser *parser, const char *buf, struct http_span chunk);
+};
+
+/*
+	Resets a parser for a new response. is_head tells whether the request was
+	a HEAD request, whose response never has a body.
+*/
+void http_parser_init(struct http_parser *parser, int is_head)
+{
+	memset(parser, 0, sizeof(struct http_parser));
+	http_scanner_select();
+	parser->state = HTTP_PARSE_STATUS_LINE;
+	parser->is_head = is_head;
+	parser->content_length = -1;
+}
+
+/*
+	Finds the end of the line starting at parser->pos. Returns 0 when the line
+	is not complete yet, remembering how far it looked so the next call does
+	not search the same bytes again. With a SIMD scanner, line ends and
+	colons are found for a whole block at once, and the following lines of
+	the block only take their bits from the masks; parser->colon is set on
+	the way.
+*/
+int http_parser_line(struct http_parser *parser, const char *buf, size_t len, struct http_span *line)
+{
+	size_t at = parser->scan;
+	size_t end;
+	if(at == parser->pos)
+		parser->colon = 0;
+	for(;;)
+	{
+		if(at >= parser->block_end)
+		{
+			if(http_scanner.block == NULL || len - at < HTTP_SCAN_BLOCK)
+			{
+				if(parser->colon == 0)
+					parser->colon = HTTP_PARSER_COLON_UNKNOWN;
+				const char *nl = (const char*)memchr(buf + at, '\n', len - at);
+				if(nl == NULL)
+				{
+					parser->scan = len;
+					return 0;
+				}
+				end = nl - buf;
+				break;
+			}
+			http_scanner.block(buf + at, &parser->newlines, &parser->colons);
+			parser->block = at;
+			parser->block_end = at + HTTP_SCAN_BLOCK;
+		}
+		unsigned long long from = ~0ULL << (at - parser->block);
+		unsigned long long newlines = parser->newlines & from;
+		unsigned long long colons = parser->colons & from;
+		if(newlines != 0)
+			colons &= (newlines & (0 - newlines)) - 1;
+		if(parser->colon == 0 && colons != 0)
+			parser->colon = parser->block + http_lowest_bit64(colons) + 1;
+		if(newlines != 0)
+		{
+			end = parser->block + http_lowest_bit64(newlines);
+			break;
+		}
+		at = parser->block_end;
+	}
+	line->off = parser->pos;
+	line->len = end - parser->pos;
+	if(line->len > 0 && buf[end - 1] == '\r')
+		line->len--;
+	parser->pos = end + 1;
+	parser->scan = parser->pos;
+	return 1;
+}
+
+/*
+	Checks whether a span holds the given token, ignoring case
+*/
+int http_span_is(const char *buf, struct http_span span, const char *token)
+{
+	return strlen(token) == span.len && str_equal_nocase(buf + span.off, token, span.len);
+}
+
+/*
+	Parses a decimal length, returns -1 when the span is not a valid length
+*/
+long long http_span_to_length(const char *buf, struct http_span span)
+{
+	long long length = 0;
+	size_t i;
+	if(span.len == 0 || span.len > 18)
+		return -1;
+	for(i = 0; i < span.len; i++)
+	{
+		if(!isdigit((unsigned char)buf[span.off + i]))
+			return -1;
+		length = length * 10 + (buf[span.off + i] - '0');
+	}
+	return length;
+}
+
+/*
+	Parses the size of a chunk: hex digits, optionally followed by white
+	space and ;extensions, which are ignored. Returns -1 for anything else,
+	or a size that does not fit.
+*/
+long long http_span_to_chunk_size(const char *buf, struct http_span span)
+{
+	long long size = 0;
+	size_t i;
+	for(i = 0; i < span.len; i++)
+	{
+		int digit = url_hex_values[(unsigned char)buf[span.off + i]];
+		if(digit < 0)
+			break;
+		if(size > (LLONG_MAX >> 4))
+			return -1;
+		size = size << 4 | digit;
+	}
+	if(i == 0)
+		return -1;
+	while(i < span.len && (buf[span.off + i] == ' ' || buf[span.off + i] == '\t'))
+		i++;
+	if(i < span.len && buf[span.off + i] != ';')
+		return -1;
+	return size;
+}
+
+/*
+	Parses the status line, e.g. "HTTP/1.1 200 OK"
+*/
+int http_parser_status_line(struct http_parser *parser, const char *buf, struct http_span line)
+{
+	const char *s = buf + line.off;
+	if(line.len < 12 || strncmp(s, "HTTP/1.", 7) != 0 || s[8] != ' ')
+		return -1;
+	if(!isdigit((unsigned char)s[9]) || !isdigit((unsigned char)s[10]) || !isdigit((unsigned char)s[11]))
+		return -1;
+	parser->version_minor = s[7] - '0';
+	parser->status_code = (s[9] - '0') * 100 + (s[10] - '0') * 10 + (s[11] - '0');
+	parser->status_text.off = line.off + 12;
+	parser->status_text.len = line.len - 12;
+	if(parser->status_text.len > 0)
+	{
+		parser->status_text.off++;
+		parser->status_text.len--;
+	}
+	return 0;
+}
+
+/*
+	Splits a header or trailer line into name and value, picks up the headers
+	that decide the framing and reports it. Trailers never change the framing.
+*/
+int http_parser_header(struct http_parser *parser, const char *buf, struct http_span line)
+{
+	const char *colon;
+	if(parser->colon > 0 && parser->colon != HTTP_PARSER_COLON_UNKNOWN)
+		colon = buf + parser->colon - 1;
+	else
+		colon = (const char*)memchr(buf + line.off, ':', line.len);
+	if(colon == NULL)
+		return -1;
+	struct http_span name, value;
+	name.off = line.off;
+	name.len = colon - (buf + line.off);
+	value.off = name.off + name.len + 1;
+	value.len = line.len - name.len - 1;
+	while(value.len > 0 && (buf[value.off] == ' ' || buf[value.off] == '\t'))
+	{
+		value.off++;
+		value.len--;
+	}
+	while(value.len > 0 && (buf[value.off + value.len - 1] == ' ' || buf[value.off + value.len - 1] == '\t'))
+		value.len--;
+
+	if(parser->state != HTTP_PARSE_HEADERS)
+	{
+		/* Trailer */
+	}
+	else if(http_span_is(buf, name, "Content-Length"))
+	{
+		/* An unparsable or conflicting length makes the framing unknowable */
+		long long length = http_span_to_length(buf, value);
+		if(length < 0 || (parser->content_length >= 0 && parser->content_length != length))
+			return -1;
+		parser->content_length = length;
+	}
+	else if(http_span_is(buf, name, "Transfer-Encoding"))
+	{
+		/* Only a final chunked coding frames the body */
+		parser->transfer_encoding = 1;
+		parser->chunked = value.len >= 7 && str_starts_with_nocase(buf + value.off + value.len - 7, "chunked");
+	}
+	else if(http_span_is(buf, name, "Connection"))
+	{
+		if(http_span_is(buf, value, "close"))
+			parser->connection_close = 1;
+		else if(http_span_is(buf, value, "keep-alive"))
+			parser->connection_close = 0;
+	}
+
+	if(parser->on_header != NULL && parser->on_header(parser, buf, name, value) != 0)
+		return -1;
+	return 0;
+}
+
+/*
+	Decides how the body is delimited once all headers are in
+*/
+enum http_parser_state http_parser_body_state(struct http_parser *parser)
+{
+	/* HTTP/1.1 is persistent unless told otherwise, HTTP/1.0 only on request */
+	if(parser->version_minor == 0)
+		parser->keep_alive = 0;
+	else
+		parser->keep_alive = !parser->connection_close;
+
+	/* After 101 Switching Protocols the connection no longer speaks HTTP */
+	if(parser->status_code == 101)
+	{
+		parser->keep_alive = 0;
+		return HTTP_PARSE_DONE;
+	}
+
+	/* Responses that never carry a body */
+	if(parser->is_head || parser->status_code < 200 || parser->status_code == 204 || parser->status_code == 304)
+		return HTTP_PARSE_DONE;
+
+	/*
+		Transfer-Encoding overrides Content-Length. A response carrying both
+		may be an attempt at request smuggling, so its connection is not reused.
+	*/
+	if(parser->transfer_encoding)
+	{
+		if(parser->content_length >= 0)
+			parser->keep_alive = 0;
+		if(parser->chunked)
+			return HTTP_PARSE_CHUNK_SIZE;
+		parser->keep_alive = 0;
+		return HTTP_PARSE_BODY_UNTIL_CLOSE;
+	}
+	if(parser->content_length >= 0)
+	{
+		parser->remaining = parser->content_length;
+		return parser->remaining > 0 ? HTTP_PARSE_BODY : HTTP_PARSE_DONE;
+	}
+
+	/* Body runs until the server closes the connection */
+	parser->keep_alive = 0;
+	return HTTP_PARSE_BODY_UNTIL_CLOSE;
+}
+
+/*
+	Reports up to parser->remaining body bytes that are available
+*/
+int http_parser_emit_body(struct http_parser *parser, const char *buf, size_t len, int bounded)
+{
+	struct http_span chunk;
+	chunk.off = parser->pos;
+	chunk.len = len - parser->pos;
+	if(bounded && (long long)chunk.len > parser->remaining)
+		chunk.len = (size_t)parser->remaining;
+	if(chunk.len == 0)
+		return 0;
+	parser->pos += chunk.len;
+	parser->scan = parser->pos;
+	if(bounded)
+		parser->remaining -= chunk.len;
+	if(parser->on_body != NULL && parser->on_body(parser, buf, chunk) != 0)
+		return -1;
+	return 0;
+}
+
+/*
+	Feeds the parser. buf is the receive buffer and len the number of valid
+	bytes in it; parsing resumes where the previous call stopped. Stops at the
+	end of the response, leaving parser->pos at the first byte after it.
+	Returns the new state.
+*/
+enum http_parser_state http_parser_execute(struct http_parser *parser, const char *buf, size_t len)
+{
+	struct http_span line;
+	while(parser->pos < len)
+	{
+		switch(parser->state)
+		{
+			case HTTP_PARSE_STATUS_LINE:
+				if(!http_parser_line(parser, buf, len, &line))
+					return parser->state;
+				if(http_parser_status_line(parser, buf, line) < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				parser->head.off = line.off;
+				parser->head.len = line.len;
+				parser->state = HTTP_PARSE_HEADERS;
+				break;
+
+			case HTTP_PARSE_HEADERS:
+				if(!http_parser_line(parser, buf, len, &line))
+					return parser->state;
+				if(line.len == 0 && parser->status_code < 200 && parser->status_code != 101)
+				{
+					/* Skip an interim response such as 100 Continue, the final one follows */
+					int is_head = parser->is_head;
+					void *data = parser->data;
+					size_t pos = parser->pos;
+					int (*on_header)(struct http_parser*, const char*, struct http_span, struct http_span) = parser->on_header;
+					int (*on_headers_complete)(struct http_parser*, const char*) = parser->on_headers_complete;
+					int (*on_body)(struct http_parser*, const char*, struct http_span) = parser->on_body;
+					http_parser_init(parser, is_head);
+					parser->pos = parser->scan = pos;
+					parser->data = data;
+					parser->on_header = on_header;
+					parser->on_headers_complete = on_headers_complete;
+					parser->on_body = on_body;
+					break;
+				}
+				if(line.len == 0)
+				{
+					parser->state = http_parser_body_state(parser);
+					if(parser->on_headers_complete != NULL && parser->on_headers_complete(parser, buf) != 0)
+						return parser->state = HTTP_PARSE_ERROR;
+					break;
+				}
+				if(http_parser_header(parser, buf, line) < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				parser->head.len = line.off + line.len - parser->head.off;
+				break;
+
+			case HTTP_PARSE_BODY:
+			case HTTP_PARSE_CHUNK_DATA:
+				if(http_parser_emit_body(parser, buf, len, 1) < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				if(parser->remaining == 0)
+					parser->state = parser->state == HTTP_PARSE_BODY ? HTTP_PARSE_DONE : HTTP_PARSE_CHUNK_DATA_END;
+				break;
+
+			case HTTP_PARSE_BODY_UNTIL_CLOSE:
+				if(http_parser_emit_body(parser, buf, len, 0) < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				break;
+
+			case HTTP_PARSE_CHUNK_SIZE:
+			{
+				if(!http_parser_line(parser, buf, len, &line))
+					return parser->state;
+				parser->remaining = http_span_to_chunk_size(buf, line);
+				if(parser->remaining < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				if(parser->remaining == 0)
+				{
+					parser->trailers.off = parser->pos;
+					parser->state = HTTP_PARSE_TRAILERS;
+				}
+				else
+				{
+					parser->state = HTTP_PARSE_CHUNK_DATA;
+				}
+				break;
+			}
+
+			case HTTP_PARSE_CHUNK_DATA_END:
+				if(!http_parser_line(parser, buf, len, &line))
+					return parser->state;
+				if(line.len != 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				parser->state = HTTP_PARSE_CHUNK_SIZE;
+				break;
+
+			case HTTP_PARSE_TRAILERS:
+				if(!http_parser_line(parser, buf, len, &line))
+					return parser->state;
+				if(line.len == 0)
+				{
+					parser->state = HTTP_PARSE_DONE;
+					break;
+				}
+				if(http_parser_header(parser, buf, line) < 0)
+					return parser->state = HTTP_PARSE_ERROR;
+				parser->trailers.len = line.off + line.len - parser->trailers.off;
+				break;
+
+			default:
+				return parser->state;
+		}
+	}
+	return parser->state;
+}
+
+/*
+	Tells the parser the first n bytes of the buffer were discarded. Only
+	bytes before parser->pos may be discarded.
+*/
+void http_parser_shift(struct http_parser *parser, size_t n)
+{
+	parser->pos -= n;
+	parser->scan -= n;
+	parser->colon = HTTP_PARSER_COLON_UNKNOWN;
+	parser->block_end = 0;
+}
+
+/*
+	Accounts for body bytes of a body of known length that were taken off
+	the connection without going through the parser
+*/
+void http_parser_skip_body(struct http_parser *parser, long long n)
+{
+	parser->remaining -= n;
+	if(parser->state == HTTP_PARSE_BODY && parser->remaining == 0)
+		parser->state = HTTP_PARSE_DONE;
+}
+
+/*
+	Tells the parser the connection was closed. Only a body delimited by the
+	close is complete at that point, anything else was cut short.
+*/
+enum http_parser_state http_parser_finish(struct http_parser *parser)
+{
+	if(parser->state == HTTP_PARSE_BODY_UNTIL_CLOSE)
+		parser->state = HTTP_PARSE_DONE;
+	else if(parser->state != HTTP_PARSE_DONE)
+		parser->state = HTTP_PARSE_ERROR;
+	return parser->state;
+}
@@ -0,0 +1,419 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Represents a batch of requests to one origin, sent back-to-back over a
+	single connection with the responses read in order
+*/
+struct http_pipeline
+{
+	int count;
+	int cap;
+	int depth;						/* requests in flight at most */
+	char **requests;
+	struct parsed_url **purls;
+	struct http_response **responses;
+	long long *sent_at;				/* when each request went out */
+};
+
+/*
+	Creates an empty pipeline
+*/
+struct http_pipeline* http_pipeline_new()
+{
+	struct http_pipeline *pipeline = (struct http_pipeline*)http_calloc(1, sizeof(struct http_pipeline));
+	if(pipeline != NULL)
+		pipeline->depth = 32;
+	return pipeline;
+}
+
+/*
+	Queues a request. Takes ownership of http_headers and purl like http_req
+	does. All requests of a pipeline must go to the same host and port, over
+	plain HTTP.
+*/
+int http_pipeline_add(struct http_pipeline *pipeline, char *http_headers, struct parsed_url *purl)
+{
+	if(purl == NULL || http_headers == NULL || strcmp(purl->scheme, "https") == 0)
+		return -1;
+	if(pipeline->count > 0)
+	{
+		struct parsed_url *origin = pipeline->purls[0];
+		if(strcmp(origin->host, purl->host) != 0 || strcmp(origin->port, purl->port) != 0)
+			return -1;
+	}
+	if(pipeline->count == pipeline->cap)
+	{
+		int cap = pipeline->cap > 0 ? pipeline->cap * 2 : 16;
+		char **requests = (char**)http_realloc(pipeline->requests, cap * sizeof(char*));
+		if(requests == NULL)
+			return -1;
+		pipeline->requests = requests;
+		struct parsed_url **purls = (struct parsed_url**)http_realloc(pipeline->purls, cap * sizeof(struct parsed_url*));
+		if(purls == NULL)
+			return -1;
+		pipeline->purls = purls;
+		struct http_response **responses = (struct http_response**)http_realloc(pipeline->responses, cap * sizeof(struct http_response*));
+		if(responses == NULL)
+			return -1;
+		pipeline->responses = responses;
+		long long *sent_at = (long long*)http_realloc(pipeline->sent_at, cap * sizeof(long long));
+		if(sent_at == NULL)
+			return -1;
+		pipeline->sent_at = sent_at;
+		pipeline->cap = cap;
+	}
+	pipeline->requests[pipeline->count] = http_headers;
+	pipeline->purls[pipeline->count] = purl;
+	pipeline->responses[pipeline->count] = NULL;
+	pipeline->count++;
+	return 0;
+}
+
+/*
+	Queues a GET request, built like http_get builds it
+*/
+int http_pipeline_get(struct http_pipeline *pipeline, char *url, char *custom_headers)
+{
+	struct parsed_url *purl = parse_url(url);
+	if(purl == NULL)
+		return -1;
+	char *http_headers = http_build_request("GET", purl, custom_headers);
+	if(http_pipeline_add(pipeline, http_headers, purl) < 0)
+	{
+		http_free(http_headers);
+		parsed_url_free(purl);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Queues a HEAD request, built like http_head builds it
+*/
+int http_pipeline_head(struct http_pipeline *pipeline, char *url, char *custom_headers)
+{
+	struct parsed_url *purl = parse_url(url);
+	if(purl == NULL)
+		return -1;
+	char *http_headers = http_build_request("HEAD", purl, custom_headers);
+	if(http_pipeline_add(pipeline, http_headers, purl) < 0)
+	{
+		http_free(http_headers);
+		parsed_url_free(purl);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Frees a response that was cut short, leaving its request to be retried
+*/
+void http_pipeline_discard(struct http_response *hresp, struct str_buffer *body)
+{
+	http_free(hresp->status_code);
+	http_free(hresp->status_text);
+	http_free(hresp->response_headers);
+	http_free(hresp);
+	str_buffer_free(body);
+}
+
+/*
+	Fills in the timing of a pipelined response. The request that opened the
+	connection carries its connect time; the others count from when they
+	were written. begin is when the response started to come in.
+*/
+void http_pipeline_timing(struct http_pipeline *pipeline, int i, struct http_response *hresp, struct http_timing *conn_timing, long long conn_start, long long begin, size_t received)
+{
+	struct http_timing *timing = &hresp->timing;
+	long long now = http_now_ns();
+	long long sent_at = pipeline->sent_at[i];
+	if(conn_timing != NULL)
+	{
+		*timing = *conn_timing;
+		timing->start = conn_start;
+	}
+	else
+	{
+		memset(timing, 0, sizeof(*timing));
+		timing->start = sent_at;
+		timing->reused = 1;
+	}
+	if(begin < sent_at)
+		begin = sent_at;
+	timing->ttfb = begin - sent_at;
+	timing->body = now - begin;
+	timing->total = now - timing->start;
+	timing->bytes_sent = strlen(hresp->request_headers);
+	timing->bytes_received = received;
+}
+
+/*
+	Runs the pipeline over one connection, starting at request first, within
+	the timeouts of opts. Keeps up to depth requests written ahead of the
+	responses. Returns the index of the first request that got no response,
+	because the server closed the connection, asked to close it, or failed;
+	error tells why.
+*/
+int http_pipeline_conn(struct http_pipeline *pipeline, int first, const struct http_request_opts *opts, enum http_error *error)
+{
+	struct parsed_url *origin = pipeline->purls[first];
+	int port = atoi(origin->port);
+	struct http_timing conn_timing;
+	memset(&conn_timing, 0, sizeof(conn_timing));
+	long long conn_start = http_now_ns();
+	int sock = http_pool_acquire(origin->host, port);
+	int reused = sock >= 0;
+	if(reused)
+		http_metrics_conn(HTTP_CONN_REUSED, origin->host, port);
+	else if((sock = http_connect(origin, &conn_timing, opts)) < 0)
+	{
+		*error = http_last_error();
+		return first;
+	}
+	http_set_nonblocking(sock, 1);
+
+	int sent = first;
+	int done = first;
+	int failed = 0;
+	int keep_alive = 1;
+	long long begin = 0;
+	*error = HTTP_OK;
+	size_t received = 0;
+	struct str_buffer response;
+	struct str_buffer body;
+	struct http_parser parser;
+	struct http_stream stream;
+	struct http_stream_ctx ctx;
+	struct http_response *hresp = NULL;
+	str_buffer_init(&response);
+	str_buffer_init(&body);
+	stream.data = &body;
+	stream.on_headers = NULL;
+	stream.on_body = http_req_collect_body;
+	ctx.stream = &stream;
+	ctx.decoder = NULL;
+	ctx.error = HTTP_OK;
+
+	while(done < pipeline->count)
+	{
+		/* Write requests ahead, up to the pipeline depth */
+		while(sent < pipeline->count && sent - done < pipeline->depth)
+		{
+			long long send_start = http_now_ns();
+			http_iovec iov;
+			http_iov_set(&iov, pipeline->requests[sent], strlen(pipeline->requests[sent]));
+			if((*error = http_send_timed(sock, NULL, &iov, 1, opts)) != HTTP_OK)
+				break;
+			pipeline->sent_at[sent] = http_now_ns();
+			if(sent == first)
+				conn_timing.send = pipeline->sent_at[sent] - send_start;
+			sent++;
+		}
+		if(sent == done)
+		{
+			failed = 1;
+			break;
+		}
+
+		/* Start on the response to the oldest outstanding request */
+		if(hresp == NULL)
+		{
+			hresp = (struct http_response*)http_calloc(1, sizeof(struct http_response));
+			if(hresp == NULL)
+			{
+				*error = HTTP_ERR_MEMORY;
+				failed = 1;
+				break;
+			}
+			ctx.hresp = hresp;
+			begin = response.len > 0 ? http_now_ns() : 0;
+			received = 0;
+			http_parser_init(&parser, strncmp(pipeline->requests[done], "HEAD ", 5) == 0);
+			parser.on_headers_complete = http_stream_on_headers_complete;
+			parser.on_body = http_stream_on_body;
+			parser.data = &ctx;
+		}
+
+		/* Parse what is buffered before reading more */
+		enum http_parser_state state = http_parser_execute(&parser, response.data, response.len);
+		if(state == HTTP_PARSE_ERROR)
+		{
+			/* The body is only collected, that stops when it does not fit in memory */
+			*error = ctx.error == HTTP_ERR_ABORTED ? HTTP_ERR_MEMORY : HTTP_ERR_PROTOCOL;
+			failed = 1;
+			break;
+		}
+		if(state != HTTP_PARSE_DONE)
+		{
+			/* Body bytes have been handed on, drop them */
+			if(state > HTTP_PARSE_HEADERS && state < HTTP_PARSE_TRAILERS)
+			{
+				received += parser.pos;
+				str_buffer_consume(&response, parser.pos);
+				http_parser_shift(&parser, parser.pos);
+			}
+			if(str_buffer_reserve(&response, BUFSIZ) < 0)
+			{
+				*error = HTTP_ERR_MEMORY;
+				failed = 1;
+				break;
+			}
+			short events;
+			long recived_len = http_recv(sock, NULL, response.data + response.len, response.cap - response.len - 1, &events);
+			if(recived_len < 0 && events != 0)
+			{
+				/* Wait for more within the read timeout and the deadline */
+				int ready = http_wait(sock, events, http_wait_ms(opts, opts->read_timeout_ms));
+				if(ready > 0)
+					continue;
+				*error = ready == 0 ? http_timeout_error(opts, HTTP_ERR_READ_TIMEOUT) : HTTP_ERR_RECV;
+				failed = 1;
+				break;
+			}
+			if(recived_len > 0)
+			{
+				if(begin == 0)
+					begin = http_now_ns();
+				str_buffer_commit(&response, recived_len);
+				continue;
+			}
+			if(recived_len < 0 || http_parser_finish(&parser) != HTTP_PARSE_DONE)
+			{
+				*error = HTTP_ERR_RECV;
+				failed = 1;
+				break;
+			}
+		}
+
+		/* Response complete, the leftover bytes belong to the next one */
+		http_stream_finish(hresp, &parser, response.data);
+		str_buffer_append(&body, "", 0);
+		hresp->body = body.data;
+		hresp->body_len = body.len;
+		hresp->request_headers = pipeline->requests[done];
+		hresp->request_uri = pipeline->purls[done];
+		http_pipeline_timing(pipeline, done, hresp, done == first && !reused ? &conn_timing : NULL, conn_start, begin, received + parser.pos);
+		http_metrics_response(hresp);
+		pipeline->requests[done] = NULL;
+		pipeline->purls[done] = NULL;
+		pipeline->responses[done] = hresp;
+		done++;
+		hresp = NULL;
+		str_buffer_init(&body);
+		str_buffer_consume(&response, parser.pos);
+		if(!parser.keep_alive)
+		{
+			keep_alive = 0;
+			break;
+		}
+	}
+
+	if(hresp != NULL)
+		http_pipeline_discard(hresp, &body);
+	if(!failed && keep_alive && done == sent && response.len == 0)
+	{
+		http_set_nonblocking(sock, 0);
+		http_pool_release(origin->host, port, sock);
+		http_metrics_conn(HTTP_CONN_POOLED, origin->host, port);
+	}
+	else
+	{
+		http_close_socket(sock);
+		http_metrics_conn(reused && done == first ? HTTP_CONN_STALE : HTTP_CONN_CLOSED, origin->host, port);
+	}
+	str_buffer_free(&response);
+	return done;
+}
+
+/*
+	Sends all queued requests and collects their responses, in the order the
+	requests were added. Requests that got no response because the server
+	closed the connection mid-pipeline are sent again on a new connection.
+	Entries stay NULL for requests that could not be completed, and
+	http_last_error tells why the first of them failed. Waits are bounded by
+	opts, NULL for the defaults; the total timeout covers the whole pipeline
+	and a request that timed out is not sent again. Redirects are not
+	followed. The responses belong to the pipeline.
+*/
+struct http_response** http_pipeline_run_opts(struct http_pipeline *pipeline, const struct http_request_opts *opts)
+{
+	struct http_request_opts o;
+	enum http_error error = HTTP_OK;
+	int next = 0;
+	int stalls = 0;
+	http_opts_begin(&o, opts);
+	while(next < pipeline->count)
+	{
+		int done = http_pipeline_conn(pipeline, next, &o, &error);
+		if(error == HTTP_ERR_CONNECT_TIMEOUT || error == HTTP_ERR_READ_TIMEOUT || error == HTTP_ERR_TIMEOUT)
+		{
+			next = done;
+			break;
+		}
+
+		/* A stale pooled connection gets one retry on a fresh one */
+		if(done == next && ++stalls > 1)
+			break;
+		if(done > next)
+			stalls = 0;
+		next = done;
+	}
+	http_set_error(next < pipeline->count ? (error != HTTP_OK ? error : HTTP_ERR_RECV) : HTTP_OK);
+	return pipeline->responses;
+}
+
+/*
+	Runs the pipeline with the default timeouts
+*/
+struct http_response** http_pipeline_run(struct http_pipeline *pipeline)
+{
+	return http_pipeline_run_opts(pipeline, NULL);
+}
+
+/*
+	Frees a pipeline with its requests and responses
+*/
+void http_pipeline_free(struct http_pipeline *pipeline)
+{
+	int i;
+	if(pipeline == NULL)
+		return;
+	for(i = 0; i < pipeline->count; i++)
+	{
+		if(pipeline->requests[i] != NULL)
+			http_free(pipeline->requests[i]);
+		if(pipeline->purls[i] != NULL)
+			parsed_url_free(pipeline->purls[i]);
+		http_response_free(pipeline->responses[i]);
+	}
+	http_free(pipeline->requests);
+	http_free(pipeline->purls);
+	http_free(pipeline->responses);
+	http_free(pipeline->sent_at);
+	http_free(pipeline);
+}
@@ -0,0 +1,337 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Small portability helpers shared by the socket, pool and resolver code
+*/
+#ifdef _WIN32
+	#include <io.h>
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#define poll WSAPoll
+	typedef SRWLOCK http_mutex;
+	#define HTTP_MUTEX_INIT SRWLOCK_INIT
+	#define http_mutex_lock(m) AcquireSRWLockExclusive(m)
+	#define http_mutex_unlock(m) ReleaseSRWLockExclusive(m)
+	typedef CONDITION_VARIABLE http_cond;
+	#define HTTP_COND_INIT CONDITION_VARIABLE_INIT
+	#define http_cond_wait(c, m) SleepConditionVariableSRW((c), (m), INFINITE, 0)
+	#define http_cond_signal(c) WakeConditionVariable(c)
+#else
+	#include <poll.h>
+	#include <time.h>
+	#include <unistd.h>
+	#include <pthread.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	typedef pthread_mutex_t http_mutex;
+	#define HTTP_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+	#define http_mutex_lock(m) pthread_mutex_lock(m)
+	#define http_mutex_unlock(m) pthread_mutex_unlock(m)
+	typedef pthread_cond_t http_cond;
+	#define HTTP_COND_INIT PTHREAD_COND_INITIALIZER
+	#define http_cond_wait(c, m) pthread_cond_wait((c), (m))
+	#define http_cond_signal(c) pthread_cond_signal(c)
+#endif
+
+/*
+	A peer that went away must not kill the process with SIGPIPE
+*/
+#ifdef MSG_NOSIGNAL
+	#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+	#define HTTP_SEND_FLAGS 0
+#endif
+
+/*
+	Whether a non-blocking socket call failed only because it has to wait
+*/
+#ifdef _WIN32
+	#define HTTP_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+	#define HTTP_CONNECT_PENDING() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+	#define HTTP_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+	#define HTTP_CONNECT_PENDING() (errno == EINPROGRESS)
+#endif
+
+/*
+	A piece of a scatter-gather send
+*/
+#ifdef _WIN32
+	typedef WSABUF http_iovec;
+	#define HTTP_IOV_BASE(v) ((v).buf)
+	#define HTTP_IOV_LEN(v) ((v).len)
+#else
+	#include <sys/uio.h>
+	typedef struct iovec http_iovec;
+	#define HTTP_IOV_BASE(v) ((v).iov_base)
+	#define HTTP_IOV_LEN(v) ((v).iov_len)
+#endif
+
+/*
+	splice(2) moves data between a socket and a file inside the kernel. It is
+	declared when building with _GNU_SOURCE on Linux.
+*/
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+	#define HTTP_HAVE_SPLICE
+#endif
+
+/*
+	Adds to an int atomically and returns the new value
+*/
+#ifdef _MSC_VER
+	#define http_atomic_add(p, n) (InterlockedExchangeAdd((volatile LONG*)(p), (n)) + (n))
+#else
+	#define http_atomic_add(p, n) __sync_add_and_fetch((p), (n))
+#endif
+
+/*
+	Storage that is separate for each thread
+*/
+#if defined(__cplusplus) && __cplusplus >= 201103L
+	#define HTTP_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+	#define HTTP_THREAD_LOCAL __declspec(thread)
+#else
+	#define HTTP_THREAD_LOCAL __thread
+#endif
+
+/*
+	Closes a socket
+*/
+void http_close_socket(int sock)
+{
+	#ifdef _WIN32
+		closesocket(sock);
+	#else
+		close(sock);
+	#endif
+}
+
+/*
+	Switches a socket between blocking and non-blocking mode
+*/
+int http_set_nonblocking(int sock, int nonblocking)
+{
+	#ifdef _WIN32
+		u_long mode = nonblocking ? 1 : 0;
+		return ioctlsocket(sock, FIONBIO, &mode) == 0 ? 0 : -1;
+	#else
+		int flags = fcntl(sock, F_GETFL, 0);
+		if(flags < 0)
+			return -1;
+		flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+		return fcntl(sock, F_SETFL, flags);
+	#endif
+}
+
+/*
+	Points a piece of a scatter-gather send at a buffer
+*/
+void http_iov_set(http_iovec *iov, const char *data, size_t len)
+{
+	#ifdef _WIN32
+		iov->buf = (CHAR*)data;
+		iov->len = (ULONG)len;
+	#else
+		iov->iov_base = (void*)data;
+		iov->iov_len = len;
+	#endif
+}
+
+/*
+	Sends as much of the pieces as the socket takes in one call, without
+	copying them together. Returns the number of bytes sent or -1.
+*/
+long http_sendv(int sock, http_iovec *iov, int count)
+{
+	#ifdef _WIN32
+		DWORD sent = 0;
+		if(WSASend(sock, iov, count, &sent, 0, NULL, NULL) != 0)
+			return -1;
+		return (long)sent;
+	#else
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		return (long)sendmsg(sock, &msg, HTTP_SEND_FLAGS);
+	#endif
+}
+
+/*
+	Returns the size of a regular file, -1 for anything else
+*/
+long long http_file_size(int fd)
+{
+	#ifdef _WIN32
+		struct _stat64 st;
+		if(_fstat64(fd, &st) != 0 || !(st.st_mode & _S_IFREG))
+			return -1;
+	#else
+		struct stat st;
+		if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+			return -1;
+	#endif
+	return (long long)st.st_size;
+}
+
+/*
+	Cuts a file to the given length and moves its offset there
+*/
+int http_file_truncate(int fd, long long len)
+{
+	#ifdef _WIN32
+		if(_chsize_s(fd, len) != 0 || _lseeki64(fd, len, SEEK_SET) < 0)
+			return -1;
+	#else
+		if(ftruncate(fd, (off_t)len) != 0 || lseek(fd, (off_t)len, SEEK_SET) < 0)
+			return -1;
+	#endif
+	return 0;
+}
+
+/*
+	Writes a whole buffer to a file descriptor, returns -1 on failure
+*/
+int http_write_all(int fd, const char *data, size_t len)
+{
+	while(len > 0)
+	{
+		#ifdef _WIN32
+			long n = _write(fd, data, (unsigned int)(len < 0x40000000 ? len : 0x40000000));
+		#else
+			long n = (long)write(fd, data, len);
+			if(n < 0 && errno == EINTR)
+				continue;
+		#endif
+		if(n <= 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+	Maps a whole file read-only, so it can be sent straight from the page
+	cache. Returns the data and sets len to the size of the file, or returns
+	NULL if fd is not a regular file or can not be mapped.
+*/
+char* http_map_file(int fd, size_t *len)
+{
+	static char empty[1] = "";
+	long long size = http_file_size(fd);
+	if(size < 0)
+		return NULL;
+	*len = (size_t)size;
+	if(*len == 0)
+		return empty;
+	#ifdef _WIN32
+		HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping == NULL)
+			return NULL;
+		char *data = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		return data;
+	#else
+		void *data = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+		if(data == MAP_FAILED)
+			return NULL;
+		madvise(data, *len, MADV_SEQUENTIAL);
+		return (char*)data;
+	#endif
+}
+
+/*
+	Releases a mapping made by http_map_file
+*/
+void http_unmap_file(char *data, size_t len)
+{
+	if(len == 0)
+		return;
+	#ifdef _WIN32
+		UnmapViewOfFile(data);
+	#else
+		munmap(data, len);
+	#endif
+}
+
+/*
+	Returns a monotonic timestamp in milliseconds
+*/
+long long http_now_ms()
+{
+	#ifdef _WIN32
+		return (long long)GetTickCount64();
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	#endif
+}
+
+/*
+	Returns a monotonic timestamp in nanoseconds, for timing requests
+*/
+long long http_now_ns()
+{
+	#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (long long)(counter.QuadPart / frequency.QuadPart * 1000000000LL
+			+ counter.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart);
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	#endif
+}
+
+/*
+	Waits on a condition variable for at most wait_ms milliseconds, with
+	the mutex held. May return early, callers check what they wait for.
+*/
+void http_cond_wait_ms(http_cond *cond, http_mutex *lock, int wait_ms)
+{
+	#ifdef _WIN32
+		SleepConditionVariableSRW(cond, lock, (DWORD)wait_ms, 0);
+	#else
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += wait_ms / 1000;
+		until.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+		if(until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(cond, lock, &until);
+	#endif
+}
@@ -0,0 +1,642 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+#define HTTP_RESOLVER_MAX_ADDRS 16
+
+/*
+	Represents the addresses a host name resolved to, IPv4 and IPv6 mixed
+*/
+struct http_addrinfo
+{
+	int count;
+	struct sockaddr_storage addrs[HTTP_RESOLVER_MAX_ADDRS];
+	socklen_t addrlens[HTTP_RESOLVER_MAX_ADDRS];
+};
+
+/*
+	Represents a cached resolution
+*/
+struct http_dns_entry
+{
+	char *host;
+	struct http_addrinfo addrs;
+	long long expires;
+	unsigned int rotation;
+	struct http_dns_entry *next;
+};
+
+/*
+	Represents the resolver cache
+*/
+struct http_resolver
+{
+	struct http_dns_entry *entries;
+	long long ttl_ms;
+	http_mutex lock;
+};
+
+struct http_resolver http_dns_cache = { NULL, 60000, HTTP_MUTEX_INIT };
+
+/*
+	Sets how long resolved addresses are cached. A ttl of 0 disables caching.
+*/
+void http_resolver_configure(long long ttl_ms)
+{
+	http_mutex_lock(&http_dns_cache.lock);
+	http_dns_cache.ttl_ms = ttl_ms;
+	http_mutex_unlock(&http_dns_cache.lock);
+}
+
+/*
+	Drops all cached resolutions
+*/
+void http_resolver_flush()
+{
+	http_mutex_lock(&http_dns_cache.lock);
+	struct http_dns_entry *entry = http_dns_cache.entries;
+	http_dns_cache.entries = NULL;
+	http_mutex_unlock(&http_dns_cache.lock);
+	while(entry != NULL)
+	{
+		struct http_dns_entry *next = entry->next;
+		free(entry->host);
+		free(entry);
+		entry = next;
+	}
+}
+
+/*
+	Resolves a host with getaddrinfo, without the cache
+*/
+int http_resolve_uncached(const char *host, struct http_addrinfo *out)
+{
+	struct addrinfo hints, *res, *ai;
+	char name[256];
+
+	/* IPv6 literals come bracketed from urls */
+	size_t len = strlen(host);
+	if(len >= 2 && host[0] == '[' && host[len - 1] == ']')
+	{
+		host++;
+		len -= 2;
+	}
+	if(len >= sizeof(name))
+		return -1;
+	memcpy(name, host, len);
+	name[len] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	if(getaddrinfo(name, NULL, &hints, &res) != 0)
+		return -1;
+
+	out->count = 0;
+	for(ai = res; ai != NULL && out->count < HTTP_RESOLVER_MAX_ADDRS; ai = ai->ai_next)
+	{
+		if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+			continue;
+		memcpy(&out->addrs[out->count], ai->ai_addr, ai->ai_addrlen);
+		out->addrlens[out->count] = (socklen_t)ai->ai_addrlen;
+		out->count++;
+	}
+	freeaddrinfo(res);
+	return out->count > 0 ? 0 : -1;
+}
+
+/*
+	Sets the port of every address in the list
+*/
+void http_addrinfo_set_port(struct http_addrinfo *addrs, int port)
+{
+	int i;
+	for(i = 0; i < addrs->count; i++)
+	{
+		if(addrs->addrs[i].ss_family == AF_INET)
+			((struct sockaddr_in*)&addrs->addrs[i])->sin_port = htons(port);
+		else
+			((struct sockaddr_in6*)&addrs->addrs[i])->sin6_port = htons(port);
+	}
+}
+
+/*
+	Reorders the addresses so the families alternate, starting with the
+	family of the first one, as RFC 8305 asks for connection racing. The
+	order within each family is kept.
+*/
+void http_addrinfo_interleave(struct http_addrinfo *addrs)
+{
+	struct http_addrinfo mixed;
+	int same[HTTP_RESOLVER_MAX_ADDRS], other[HTTP_RESOLVER_MAX_ADDRS];
+	int same_count = 0, other_count = 0;
+	int i;
+
+	/* Split by family */
+	for(i = 0; i < addrs->count; i++)
+	{
+		if(addrs->addrs[i].ss_family == addrs->addrs[0].ss_family)
+			same[same_count++] = i;
+		else
+			other[other_count++] = i;
+	}
+	if(other_count == 0)
+		return;
+
+	/* And merge, one of each in turn */
+	mixed.count = 0;
+	for(i = 0; i < same_count || i < other_count; i++)
+	{
+		if(i < same_count)
+		{
+			mixed.addrs[mixed.count] = addrs->addrs[same[i]];
+			mixed.addrlens[mixed.count++] = addrs->addrlens[same[i]];
+		}
+		if(i < other_count)
+		{
+			mixed.addrs[mixed.count] = addrs->addrs[other[i]];
+			mixed.addrlens[mixed.count++] = addrs->addrlens[other[i]];
+		}
+	}
+	*addrs = mixed;
+}
+
+/*
+	Orders the addresses of a host for one call: rotated so the call starts
+	at its round-robin address, families alternating, and set to the port
+*/
+void http_addrinfo_prepare(struct http_addrinfo *addrs, unsigned int start, int port)
+{
+	if(start % addrs->count != 0)
+	{
+		struct http_addrinfo rotated;
+		int i;
+		rotated.count = addrs->count;
+		for(i = 0; i < addrs->count; i++)
+		{
+			int from = (i + start) % addrs->count;
+			rotated.addrs[i] = addrs->addrs[from];
+			rotated.addrlens[i] = addrs->addrlens[from];
+		}
+		*addrs = rotated;
+	}
+	http_addrinfo_interleave(addrs);
+	http_addrinfo_set_port(addrs, port);
+}
+
+/*
+	Copies the cached addresses of a host, evicting expired entries on the
+	way. With rotate set the entry moves on to its next address, and start
+	gets the one this call begins at. Returns -1 when the host is not
+	cached. Called with the cache locked.
+*/
+int http_dns_find(const char *host, struct http_addrinfo *out, int rotate, unsigned int *start)
+{
+	long long now = http_now_ms();
+	struct http_dns_entry *entry;
+	struct http_dns_entry **link = &http_dns_cache.entries;
+	while((entry = *link) != NULL)
+	{
+		if(entry->expires <= now)
+		{
+			/* Evict expired entry */
+			*link = entry->next;
+			free(entry->host);
+			free(entry);
+			continue;
+		}
+		if(strcmp(entry->host, host) == 0)
+		{
+			*out = entry->addrs;
+			*start = rotate ? entry->rotation++ : entry->rotation;
+			return 0;
+		}
+		link = &entry->next;
+	}
+	return -1;
+}
+
+/*
+	Looks a host up in the cache only, never blocking on a lookup. Returns 0
+	with the addresses ordered like http_resolve orders them, or -1 when the
+	host is not cached.
+*/
+int http_resolve_cached(const char *host, int port, struct http_addrinfo *out)
+{
+	unsigned int start;
+	http_mutex_lock(&http_dns_cache.lock);
+	int found = http_dns_find(host, out, 1, &start);
+	http_mutex_unlock(&http_dns_cache.lock);
+	if(found < 0)
+		return -1;
+	http_addrinfo_prepare(out, start, port);
+	return 0;
+}
+
+/*
+	Caches the addresses of a host, replacing what was cached for it
+	before. count connections are about to use them: start gets the address
+	the first of them begins at, and the entry moves on past them.
+*/
+void http_dns_store(const char *host, struct http_addrinfo *addrs, unsigned int count, unsigned int *start)
+{
+	struct http_dns_entry *entry;
+	struct http_dns_entry *added = (struct http_dns_entry*)malloc(sizeof(struct http_dns_entry));
+	long long now = http_now_ms();
+	if(added != NULL && (added->host = http_heap_strdup(host)) == NULL)
+	{
+		free(added);
+		added = NULL;
+	}
+	*start = 0;
+
+	/* A lookup that ran alongside may have cached the host already */
+	http_mutex_lock(&http_dns_cache.lock);
+	for(entry = http_dns_cache.entries; entry != NULL; entry = entry->next)
+	{
+		if(strcmp(entry->host, host) == 0)
+			break;
+	}
+	if(entry != NULL)
+	{
+		*start = entry->rotation;
+		entry->rotation += count;
+	}
+	else if(added != NULL && http_dns_cache.ttl_ms > 0)
+	{
+		entry = added;
+		added = NULL;
+		entry->rotation = count;
+		entry->next = http_dns_cache.entries;
+		http_dns_cache.entries = entry;
+	}
+	if(entry != NULL)
+	{
+		entry->addrs = *addrs;
+		entry->expires = now + http_dns_cache.ttl_ms;
+	}
+	http_mutex_unlock(&http_dns_cache.lock);
+	if(added != NULL)
+	{
+		free(added->host);
+		free(added);
+	}
+}
+
+/*
+	Resolves a host to its addresses, set to the given port. Results are
+	cached for the configured ttl. Every call for the same host starts at the
+	next address, spreading connections round-robin, and IPv6 and IPv4
+	addresses alternate; callers fail over by trying the addresses in order.
+	Safe to call from several threads.
+*/
+int http_resolve(const char *host, int port, struct http_addrinfo *out)
+{
+	if(http_resolve_cached(host, port, out) == 0)
+		return 0;
+
+	/* Resolve outside the lock, lookups for other hosts go on meanwhile */
+	unsigned int start;
+	if(http_resolve_uncached(host, out) < 0)
+		return -1;
+	http_dns_store(host, out, 1, &start);
+	http_addrinfo_prepare(out, start, port);
+	return 0;
+}
+
+/*
+	Resolves a host like http_resolve, but leaves the round-robin order
+	alone: the addresses start where the next connection will. For looking
+	at the addresses of a host without connecting to it.
+*/
+int http_resolve_peek(const char *host, int port, struct http_addrinfo *out)
+{
+	unsigned int start;
+	http_mutex_lock(&http_dns_cache.lock);
+	int found = http_dns_find(host, out, 0, &start);
+	http_mutex_unlock(&http_dns_cache.lock);
+	if(found < 0)
+	{
+		if(http_resolve_uncached(host, out) < 0)
+			return -1;
+		http_dns_store(host, out, 0, &start);
+	}
+	http_addrinfo_prepare(out, start, port);
+	return 0;
+}
+
+#define HTTP_RESOLVER_THREADS 4
+
+/*
+	Represents a caller waiting for an asynchronous resolution
+*/
+struct http_resolve_waiter
+{
+	int port;
+	void (*on_done)(const char *host, struct http_addrinfo *addrs, void *data);
+	void *data;
+	struct http_resolve_waiter *next;
+};
+
+/*
+	Represents the lookup of one host, shared by everyone who asked for it
+	while it was queued or running
+*/
+struct http_resolve_job
+{
+	char *host;
+	struct http_resolve_waiter *waiters;
+	int count;						/* waiters */
+	struct http_resolve_job *next;
+};
+
+/*
+	Represents the resolver threads. They are started as lookups are queued,
+	up to HTTP_RESOLVER_THREADS, and stay around for later ones.
+*/
+struct http_resolver_pool
+{
+	http_mutex lock;
+	http_cond ready;				/* signalled when a lookup is queued */
+	struct http_resolve_job *queued;
+	struct http_resolve_job *queued_tail;
+	struct http_resolve_job *running;
+	int threads;
+	int idle;
+};
+
+struct http_resolver_pool http_resolver_threads = { HTTP_MUTEX_INIT, HTTP_COND_INIT, NULL, NULL, NULL, 0, 0 };
+
+/*
+	Finds the job of a host in one of the pool's lists
+*/
+struct http_resolve_job* http_resolve_job_find(struct http_resolve_job *job, const char *host)
+{
+	while(job != NULL && strcmp(job->host, host) != 0)
+		job = job->next;
+	return job;
+}
+
+/*
+	Hands the answer of a finished job to each of its waiters, each of them
+	starting at the next address of the host, and frees the job
+*/
+void http_resolve_job_done(struct http_resolve_job *job, struct http_addrinfo *resolved)
+{
+	struct http_addrinfo addrs;
+	unsigned int start = 0;
+	if(resolved != NULL)
+		http_dns_store(job->host, resolved, job->count, &start);
+	while(job->waiters != NULL)
+	{
+		struct http_resolve_waiter *waiter = job->waiters;
+		job->waiters = waiter->next;
+		if(resolved != NULL)
+		{
+			addrs = *resolved;
+			http_addrinfo_prepare(&addrs, start++, waiter->port);
+		}
+		waiter->on_done(job->host, resolved != NULL ? &addrs : NULL, waiter->data);
+		free(waiter);
+	}
+	free(job->host);
+	free(job);
+}
+
+/*
+	Thread body of a resolver: takes the queued lookups one after the other
+*/
+#ifdef _WIN32
+DWORD WINAPI http_resolve_thread(LPVOID arg)
+#else
+void* http_resolve_thread(void *arg)
+#endif
+{
+	struct http_resolver_pool *pool = &http_resolver_threads;
+	struct http_resolve_job **link;
+	struct http_addrinfo addrs;
+	(void)arg;
+	http_mutex_lock(&pool->lock);
+	while(1)
+	{
+		struct http_resolve_job *job = pool->queued;
+		if(job == NULL)
+		{
+			pool->idle++;
+			http_cond_wait(&pool->ready, &pool->lock);
+			pool->idle--;
+			continue;
+		}
+		pool->queued = job->next;
+		if(pool->queued == NULL)
+			pool->queued_tail = NULL;
+		job->next = pool->running;
+		pool->running = job;
+		http_mutex_unlock(&pool->lock);
+
+		/* Looked up outside the lock, callers of the same host join the job meanwhile */
+		int ok = http_resolve_uncached(job->host, &addrs) == 0;
+
+		http_mutex_lock(&pool->lock);
+		for(link = &pool->running; *link != job; link = &(*link)->next);
+		*link = job->next;
+		http_mutex_unlock(&pool->lock);
+		http_resolve_job_done(job, ok ? &addrs : NULL);
+		http_mutex_lock(&pool->lock);
+	}
+	return 0;
+}
+
+/*
+	Starts another resolver thread, called with the pool locked. Returns -1
+	if it could not be started.
+*/
+int http_resolver_start_thread(struct http_resolver_pool *pool)
+{
+	#ifdef _WIN32
+		HANDLE thread = CreateThread(NULL, 0, http_resolve_thread, NULL, 0, NULL);
+		if(thread == NULL)
+			return -1;
+		CloseHandle(thread);
+	#else
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, http_resolve_thread, NULL) != 0)
+			return -1;
+		pthread_detach(thread);
+	#endif
+	pool->threads++;
+	return 0;
+}
+
+/*
+	Resolves a host without blocking the caller. on_done is called from a
+	resolver thread with the addresses, or NULL if the host did not resolve.
+	Callers asking for a host that is already being looked up share that
+	lookup, and at most HTTP_RESOLVER_THREADS lookups run at once; the rest
+	wait their turn. Answers already in the cache are delivered right away
+	on the calling thread. Returns -1 if the resolution could not be
+	started.
+*/
+int http_resolve_async(const char *host, int port, void (*on_done)(const char *host, struct http_addrinfo *addrs, void *data), void *data)
+{
+	struct http_resolver_pool *pool = &http_resolver_threads;
+	struct http_addrinfo addrs;
+	if(http_resolve_cached(host, port, &addrs) == 0)
+	{
+		on_done(host, &addrs, data);
+		return 0;
+	}
+
+	struct http_resolve_waiter *waiter = (struct http_resolve_waiter*)malloc(sizeof(struct http_resolve_waiter));
+	if(waiter == NULL)
+		return -1;
+	waiter->port = port;
+	waiter->on_done = on_done;
+	waiter->data = data;
+
+	/* Join a lookup of the host that has not finished yet */
+	http_mutex_lock(&pool->lock);
+	struct http_resolve_job *job = http_resolve_job_find(pool->queued, host);
+	if(job == NULL)
+		job = http_resolve_job_find(pool->running, host);
+	if(job != NULL)
+	{
+		waiter->next = job->waiters;
+		job->waiters = waiter;
+		job->count++;
+		http_mutex_unlock(&pool->lock);
+		return 0;
+	}
+
+	/* Or queue a new one */
+	job = (struct http_resolve_job*)malloc(sizeof(struct http_resolve_job));
+	if(job == NULL || (job->host = http_heap_strdup(host)) == NULL)
+	{
+		http_mutex_unlock(&pool->lock);
+		free(job);
+		free(waiter);
+		return -1;
+	}
+	waiter->next = NULL;
+	job->waiters = waiter;
+	job->count = 1;
+	job->next = NULL;
+	if(pool->idle == 0 && pool->threads < HTTP_RESOLVER_THREADS && http_resolver_start_thread(pool) < 0 && pool->threads == 0)
+	{
+		http_mutex_unlock(&pool->lock);
+		free(job->host);
+		free(job);
+		free(waiter);
+		return -1;
+	}
+	if(pool->queued_tail != NULL)
+		pool->queued_tail->next = job;
+	else
+		pool->queued = job;
+	pool->queued_tail = job;
+	http_cond_signal(&pool->ready);
+	http_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/*
+	Represents a caller of http_resolve_within waiting for a lookup. Shared
+	with the resolver thread, the last of the two to let go frees it.
+*/
+struct http_resolve_wait
+{
+	http_mutex lock;
+	http_cond done;
+	int refs;
+	int finished;
+	int ok;
+	struct http_addrinfo addrs;
+};
+
+void http_resolve_wait_release(struct http_resolve_wait *wait)
+{
+	int refs = --wait->refs;
+	http_mutex_unlock(&wait->lock);
+	if(refs == 0)
+		free(wait);
+}
+
+void http_resolve_wait_done(const char *host, struct http_addrinfo *addrs, void *data)
+{
+	struct http_resolve_wait *wait = (struct http_resolve_wait*)data;
+	(void)host;
+	http_mutex_lock(&wait->lock);
+	wait->finished = 1;
+	wait->ok = addrs != NULL;
+	if(addrs != NULL)
+		wait->addrs = *addrs;
+	http_cond_signal(&wait->done);
+	http_resolve_wait_release(wait);
+}
+
+/*
+	Resolves a host like http_resolve, but waits at most wait_ms for a host
+	that is not cached, -1 for no limit. The lookup runs on a resolver
+	thread and is left to finish there and fill the cache when the wait
+	runs out. Returns 0, -1 if the host did not resolve, or -2 if it took
+	too long.
+*/
+int http_resolve_within(const char *host, int port, struct http_addrinfo *out, int wait_ms)
+{
+	if(wait_ms < 0)
+		return http_resolve(host, port, out);
+	if(http_resolve_cached(host, port, out) == 0)
+		return 0;
+
+	struct http_resolve_wait *wait = (struct http_resolve_wait*)calloc(1, sizeof(struct http_resolve_wait));
+	if(wait == NULL)
+		return -1;
+	wait->lock = (http_mutex)HTTP_MUTEX_INIT;
+	wait->done = (http_cond)HTTP_COND_INIT;
+	wait->refs = 2;
+	if(http_resolve_async(host, port, http_resolve_wait_done, wait) < 0)
+	{
+		/* No resolver thread, look it up here */
+		free(wait);
+		return http_resolve(host, port, out);
+	}
+
+	long long until = http_now_ms() + wait_ms;
+	http_mutex_lock(&wait->lock);
+	while(!wait->finished)
+	{
+		long long left = until - http_now_ms();
+		if(left <= 0)
+			break;
+		http_cond_wait_ms(&wait->done, &wait->lock, (int)left);
+	}
+	int result = !wait->finished ? -2 : wait->ok ? 0 : -1;
+	if(result == 0)
+		*out = wait->addrs;
+	http_resolve_wait_release(wait);
+	return result;
+}
@@ -0,0 +1,187 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+
+/*
+	Finds line ends and colons for the response parser 64 bytes at a time.
+	On x86 the bytes are compared 16 or 32 at once with SSE2 or AVX2, and
+	the result is a bit mask the parser walks line by line, so each byte is
+	looked at once however many lines it has. The best instruction set the
+	CPU has is picked on first use. Without one, or with HTTP_NO_SIMD
+	defined, the parser searches each line with memchr instead.
+*/
+#if !defined(HTTP_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)))
+	#define HTTP_HAVE_SSE2
+	#include <emmintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+	#if defined(__GNUC__) || defined(__clang__)
+		#define HTTP_HAVE_AVX2
+		#include <immintrin.h>
+	#endif
+#endif
+
+#define HTTP_SCAN_BLOCK 64
+
+/*
+	Instruction sets the scanner can use
+*/
+enum http_simd
+{
+	HTTP_SIMD_NONE,
+	HTTP_SIMD_SSE2,
+	HTTP_SIMD_AVX2
+};
+
+/*
+	Represents the scanner in use. block is NULL when lines are searched
+	with memchr.
+*/
+struct http_scanner
+{
+	enum http_simd simd;
+	int selected;
+	void (*block)(const char *p, unsigned long long *newlines, unsigned long long *colons);
+};
+
+struct http_scanner http_scanner = { HTTP_SIMD_NONE, 0, NULL };
+
+/*
+	Returns the index of the lowest set bit of a non-zero mask
+*/
+int http_lowest_bit64(unsigned long long mask)
+{
+	#ifdef _MSC_VER
+		unsigned long index;
+		#ifdef _M_X64
+			_BitScanForward64(&index, mask);
+		#else
+			if(_BitScanForward(&index, (unsigned long)mask) == 0)
+			{
+				_BitScanForward(&index, (unsigned long)(mask >> 32));
+				index += 32;
+			}
+		#endif
+		return (int)index;
+	#else
+		return __builtin_ctzll(mask);
+	#endif
+}
+
+#ifdef HTTP_HAVE_SSE2
+/*
+	Sets bit i of newlines where p[i] is '\n' and of colons where it is ':',
+	for the HTTP_SCAN_BLOCK bytes at p
+*/
+void http_scan_block_sse2(const char *p, unsigned long long *newlines, unsigned long long *colons)
+{
+	__m128i nl = _mm_set1_epi8('\n');
+	__m128i colon = _mm_set1_epi8(':');
+	unsigned long long n = 0, c = 0;
+	int i;
+	for(i = 0; i < HTTP_SCAN_BLOCK; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		n |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << i;
+		c |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon)) << i;
+	}
+	*newlines = n;
+	*colons = c;
+}
+#endif
+
+#ifdef HTTP_HAVE_AVX2
+__attribute__((target("avx2")))
+void http_scan_block_avx2(const char *p, unsigned long long *newlines, unsigned long long *colons)
+{
+	__m256i nl = _mm256_set1_epi8('\n');
+	__m256i colon = _mm256_set1_epi8(':');
+	__m256i lo = _mm256_loadu_si256((const __m256i*)p);
+	__m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+	*newlines = (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+		| (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+	*colons = (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, colon))
+		| (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, colon)) << 32;
+}
+#endif
+
+/*
+	Tells whether the CPU supports an instruction set
+*/
+int http_simd_supported(enum http_simd simd)
+{
+	switch(simd)
+	{
+		case HTTP_SIMD_NONE:
+			return 1;
+		#ifdef HTTP_HAVE_SSE2
+		case HTTP_SIMD_SSE2:
+			return 1;
+		#endif
+		#ifdef HTTP_HAVE_AVX2
+		case HTTP_SIMD_AVX2:
+			return __builtin_cpu_supports("avx2");
+		#endif
+		default:
+			return 0;
+	}
+}
+
+/*
+	Switches the scanner to an instruction set, for testing and benchmarks.
+	Returns -1 if the CPU does not support it.
+*/
+int http_scanner_use(enum http_simd simd)
+{
+	if(!http_simd_supported(simd))
+		return -1;
+	http_scanner.block = NULL;
+	#ifdef HTTP_HAVE_SSE2
+		if(simd == HTTP_SIMD_SSE2)
+			http_scanner.block = http_scan_block_sse2;
+	#endif
+	#ifdef HTTP_HAVE_AVX2
+		if(simd == HTTP_SIMD_AVX2)
+			http_scanner.block = http_scan_block_avx2;
+	#endif
+	http_scanner.simd = simd;
+	http_scanner.selected = 1;
+	return 0;
+}
+
+/*
+	Picks the best instruction set the CPU supports, once. Threads racing
+	here all pick the same one.
+*/
+void http_scanner_select()
+{
+	if(http_scanner.selected)
+		return;
+	if(http_scanner_use(HTTP_SIMD_AVX2) < 0 && http_scanner_use(HTTP_SIMD_SSE2) < 0)
+		http_scanner_use(HTTP_SIMD_NONE);
+}
@@ -54,6 +54,35 @@ int str_contains(const char *haystack, const char *needle)
 		return 0;
 }
 
+/*
+	Compares the start of a string with a prefix, ignoring case
+*/
+int str_starts_with_nocase(const char *str, const char *prefix)
+{
+	while(*prefix)
+	{
+		if(tolower((unsigned char)*str) != tolower((unsigned char)*prefix))
+			return 0;
+		str++;
+		prefix++;
+	}
+	return 1;
+}
+
+/*
+	Compares len bytes of two strings, ignoring case
+*/
+int str_equal_nocase(const char *a, const char *b, size_t len)
+{
+	size_t i;
+	for(i = 0; i < len; i++)
+	{
+		if(a[i] != b[i] && tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+			return 0;
+	}
+	return 1;
+}
+
 /*
 	Removes last character from string
 */
@@ -77,39 +106,100 @@ char* trim_end(char *string, char to_trim)
 */
 char* str_cat(char *a, char *b)
 {
-	char *target = (char*)malloc(strlen(a) + strlen(b) + 1);
+	char *target = (char*)http_malloc(strlen(a) + strlen(b) + 1);
 	strcpy(target, a);
 	strcat(target, b);
 	return target;
 }
 
-/* 
-	Converts an integer value to its hex character
+/*
+	Represents a growable, binary safe byte buffer. data is kept NUL terminated
+	so a buffer holding text can be used as a string directly.
+*/
+struct str_buffer
+{
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/*
+	Initializes an empty buffer
+*/
+void str_buffer_init(struct str_buffer *buf)
+{
+	buf->data = NULL;
+	buf->len = 0;
+	buf->cap = 0;
+}
+
+/*
+	Makes room for at least extra more bytes, doubling the capacity as needed
 */
-char to_hex(char code) 
+int str_buffer_reserve(struct str_buffer *buf, size_t extra)
 {
-	static char hex[] = "0123456789abcdef";
-	return hex[code & 15];
+	size_t needed = buf->len + extra + 1;
+	if(needed <= buf->cap)
+		return 0;
+	size_t cap = buf->cap > 0 ? buf->cap : 64;
+	while(cap < needed)
+		cap *= 2;
+	char *data = (char*)http_realloc(buf->data, cap);
+	if(data == NULL)
+		return -1;
+	buf->data = data;
+	buf->cap = cap;
+	return 0;
 }
 
 /*
-	URL encodes a string
+	Marks len bytes written directly into the spare capacity as used
 */
-char *urlencode(char *str) 
+void str_buffer_commit(struct str_buffer *buf, size_t len)
 {
-	char *pstr = str, *buf = (char*)malloc(strlen(str) * 3 + 1), *pbuf = buf;
-  	while (*pstr) 
-	{
-    	if (isalnum(*pstr) || *pstr == '-' || *pstr == '_' || *pstr == '.' || *pstr == '~') 
-      		*pbuf++ = *pstr;
-    	else if (*pstr == ' ') 
-      		*pbuf++ = '+';
-    	else 
-      		*pbuf++ = '%', *pbuf++ = to_hex(*pstr >> 4), *pbuf++ = to_hex(*pstr & 15);
-    	pstr++;
-  	}
-  	*pbuf = '\0';
-  	return buf;
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+/*
+	Appends len bytes to the buffer
+*/
+int str_buffer_append(struct str_buffer *buf, const char *data, size_t len)
+{
+	if(str_buffer_reserve(buf, len) < 0)
+		return -1;
+	memcpy(buf->data + buf->len, data, len);
+	str_buffer_commit(buf, len);
+	return 0;
+}
+
+/*
+	Appends a NUL terminated string to the buffer
+*/
+int str_buffer_append_str(struct str_buffer *buf, const char *str)
+{
+	return str_buffer_append(buf, str, strlen(str));
+}
+
+/*
+	Drops the first len bytes of the buffer, keeping its capacity
+*/
+void str_buffer_consume(struct str_buffer *buf, size_t len)
+{
+	if(len == 0)
+		return;
+	memmove(buf->data, buf->data + len, buf->len - len);
+	buf->len -= len;
+	buf->data[buf->len] = '\0';
+}
+
+/*
+	Releases the memory of a buffer
+*/
+void str_buffer_free(struct str_buffer *buf)
+{
+	http_free(buf->data);
+	str_buffer_init(buf);
 }
 
 /*
@@ -118,7 +208,7 @@ char *urlencode(char *str)
 char *str_ndup (const char *str, size_t max)
 {
     size_t len = strnlen (str, max);
-    char *res = (char*)malloc (len + 1);
+    char *res = (char*)http_malloc (len + 1);
     if (res)
     {
         memcpy (res, str, len);
@@ -132,7 +222,7 @@ char *str_ndup (const char *str, size_t max)
 */
 char *str_dup(const char *src)
 {
-   char *tmp = (char*)malloc(strlen(src) + 1);
+   char *tmp = (char*)http_malloc(strlen(src) + 1);
    if(tmp)
        strcpy(tmp, src);
    return tmp;
@@ -143,24 +233,26 @@ char *str_dup(const char *src)
 */
 char *str_replace(char *search , char *replace , char *subject)
 {
-	char  *p = NULL , *old = NULL , *new_subject = NULL ;
-	int c = 0 , search_size;
+	char  *p = NULL , *old = NULL , *new_subject = NULL , *out = NULL ;
+	size_t c = 0 , search_size , replace_size;
 	search_size = strlen(search);
+	replace_size = strlen(replace);
 	for(p = strstr(subject , search) ; p != NULL ; p = strstr(p + search_size , search))
 	{
 		c++;
 	}	
-	c = ( strlen(replace) - search_size )*c + strlen(subject);
-	new_subject = (char*)malloc( c );
-	strcpy(new_subject , "");
+	new_subject = (char*)http_malloc( strlen(subject) - search_size * c + replace_size * c + 1 );
+	out = new_subject;
 	old = subject;	
 	for(p = strstr(subject , search) ; p != NULL ; p = strstr(p + search_size , search))
 	{
-		strncpy(new_subject + strlen(new_subject) , old , p - old);
-		strcpy(new_subject + strlen(new_subject) , replace);
+		memcpy(out , old , p - old);
+		out += p - old;
+		memcpy(out , replace , replace_size);
+		out += replace_size;
 		old = p + search_size;
 	}
-	strcpy(new_subject + strlen(new_subject) , old);	
+	strcpy(out , old);	
 	return new_subject;
 }
 
@@ -172,99 +264,3 @@ char* get_until(char *haystack, char *until)
 	int offset = str_index_of(haystack, until);
 	return str_ndup(haystack, offset);
 }
-
-
-/* decodeblock - decode 4 '6-bit' characters into 3 8-bit binary bytes */
-void decodeblock(unsigned char in[], char *clrstr) 
-{
-  	unsigned char out[4];
-	out[0] = in[0] << 2 | in[1] >> 4;
-	out[1] = in[1] << 4 | in[2] >> 2;
-	out[2] = in[2] << 6 | in[3] >> 0;
-	out[3] = '\0';
-	strncat((char *)clrstr, (char *)out, sizeof(out));
-}
-
-/*
-	Decodes a Base64 string
-*/
-char* base64_decode(char *b64src) 
-{
-	char *clrdst = (char*)malloc( ((strlen(b64src) - 1) / 3 ) * 4 + 4 + 50);
-	char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	int c, phase, i;
-	unsigned char in[4];
-	char *p;
-	clrdst[0] = '\0';
-	phase = 0; i=0;
-	while(b64src[i]) 
-	{
-		c = (int) b64src[i];
-		if(c == '=') 
-		{
-			decodeblock(in, clrdst); 
-			break;
-		}
-		p = strchr(b64, c);
-		if(p) 
-		{
-			in[phase] = p - b64;
-			phase = (phase + 1) % 4;
-			if(phase == 0) 
-			{
-				decodeblock(in, clrdst);
-				in[0]=in[1]=in[2]=in[3]=0;
-			}
-		}
-		i++;
-	}
-	clrdst = (char*)realloc(clrdst, strlen(clrdst) + 1);
-	return clrdst;
-}
-
-/* encodeblock - encode 3 8-bit binary bytes as 4 '6-bit' characters */
-void encodeblock( unsigned char in[], char b64str[], int len ) 
-{
-	char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    unsigned char out[5];
-    out[0] = b64[ in[0] >> 2 ];
-    out[1] = b64[ ((in[0] & 0x03) << 4) | ((in[1] & 0xf0) >> 4) ];
-    out[2] = (unsigned char) (len > 1 ? b64[ ((in[1] & 0x0f) << 2) |
-             ((in[2] & 0xc0) >> 6) ] : '=');
-    out[3] = (unsigned char) (len > 2 ? b64[ in[2] & 0x3f ] : '=');
-    out[4] = '\0';
-    strncat((char *)b64str, (char *)out, sizeof(out));
-}
-
-/* 
-	Encodes a string with Base64
-*/
-char* base64_encode(char *clrstr) 
-{
-	char *b64dst = (char*)malloc(strlen(clrstr) + 50);
-	char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	unsigned char in[3];
-	int i, len = 0;
-	int j = 0;
-
-	b64dst[0] = '\0';
-	while(clrstr[j]) 
-	{
-		len = 0;
-		for(i=0; i<3; i++) 
-		{
-			in[i] = (unsigned char) clrstr[j];
-			if(clrstr[j]) 
-			{
-				len++; j++;
-			}
-			else in[i] = 0;
-		}
-		if( len ) 
-		{
-			encodeblock( in, b64dst, len );
-		}
-	}
-	b64dst = (char*)realloc(b64dst, strlen(b64dst) + 1);
-	return b64dst;
-}
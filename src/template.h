@@ -0,0 +1,171 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Represents a request that is made over and over: the url is parsed, and
+	the request line and headers rendered, once. Every request made from it
+	only adds its query and body. The host is looked up like for any other
+	request, from the DNS cache while its answer lasts.
+*/
+struct http_template
+{
+	struct parsed_url *purl;
+	char *head;						/* method and path, up to where a query goes */
+	size_t head_len;
+	int has_query;					/* the url of the template has a query already */
+	char *tail;						/* from the protocol version to the last fixed header */
+	size_t tail_len;
+};
+
+/*
+	Renders a request template for the given method and url with fixed
+	custom headers, NULL for none. Returns NULL with http_last_error set if
+	the url can not be parsed or memory runs out. The template is kept out
+	of any active arena, it outlives the requests made from it.
+*/
+struct http_template* http_template_new(const char *method, const char *url, char *custom_headers)
+{
+	struct http_arena *arena = http_current_arena;
+	http_current_arena = NULL;
+
+	struct http_template *tpl = (struct http_template*)http_calloc(1, sizeof(struct http_template));
+	if(tpl == NULL)
+	{
+		http_set_error(HTTP_ERR_MEMORY);
+		http_current_arena = arena;
+		return NULL;
+	}
+	tpl->purl = parse_url(url);
+	if(tpl->purl == NULL)
+	{
+		http_free(tpl);
+		http_current_arena = arena;
+		return NULL;
+	}
+
+	/* Render once and split where the query goes, dropping the blank line */
+	char *rendered = http_build_request(method, tpl->purl, custom_headers);
+	const char *version = rendered != NULL ? strstr(rendered, " HTTP/1.1\r\n") : NULL;
+	if(version != NULL)
+	{
+		size_t len = strlen(rendered);
+		tpl->head_len = version - rendered;
+		tpl->head = str_ndup(rendered, tpl->head_len);
+		tpl->tail_len = len - tpl->head_len - 2;
+		tpl->tail = str_ndup(version, tpl->tail_len);
+		tpl->has_query = tpl->purl->query != NULL;
+	}
+	http_free(rendered);
+	if(tpl->head == NULL || tpl->tail == NULL)
+	{
+		/* Out of memory, or no request line to split */
+		http_set_error(rendered == NULL || version != NULL ? HTTP_ERR_MEMORY : HTTP_ERR_URL);
+		parsed_url_free(tpl->purl);
+		http_free(tpl->head);
+		http_free(tpl->tail);
+		http_free(tpl);
+		http_current_arena = arena;
+		return NULL;
+	}
+	http_current_arena = arena;
+	return tpl;
+}
+
+/*
+	Renders the request headers for one request from a template, with a
+	query (without the '?') appended to the path and a Content-Length when
+	body_len is not negative. The caller frees the result.
+*/
+char* http_template_render(struct http_template *tpl, const char *query, long long body_len)
+{
+	char length[64];
+	size_t length_len = 0;
+	size_t query_len = query != NULL ? strlen(query) : 0;
+	if(body_len >= 0)
+		length_len = sprintf(length, "Content-Length:%lld\r\n", body_len);
+
+	char *http_headers = (char*)http_malloc(tpl->head_len + 1 + query_len + tpl->tail_len + length_len + 3);
+	if(http_headers == NULL)
+		return NULL;
+	char *out = http_headers;
+	memcpy(out, tpl->head, tpl->head_len);
+	out += tpl->head_len;
+	if(query_len > 0)
+	{
+		*out++ = tpl->has_query ? '&' : '?';
+		memcpy(out, query, query_len);
+		out += query_len;
+	}
+	memcpy(out, tpl->tail, tpl->tail_len);
+	out += tpl->tail_len;
+	memcpy(out, length, length_len);
+	out += length_len;
+	memcpy(out, "\r\n", 3);
+	return http_headers;
+}
+
+/*
+	Makes a request from a template, within the timeouts of opts. query is
+	added to the path of the template, NULL for none; body is sent with a
+	Content-Length when it is not NULL and stays owned by the caller.
+	Redirects are not followed. Safe to call from several threads at once.
+*/
+struct http_response* http_template_req_opts(struct http_template *tpl, const char *query, const char *body, size_t body_len, const struct http_request_opts *opts)
+{
+	char *http_headers = http_template_render(tpl, query, body != NULL ? (long long)body_len : -1);
+	if(http_headers == NULL)
+	{
+		http_set_error(HTTP_ERR_MEMORY);
+		return NULL;
+	}
+
+	/* The response shares the parsed url of the template */
+	parsed_url_retain(tpl->purl);
+	return http_req_opts(http_headers, body, body_len, tpl->purl, opts);
+}
+
+/*
+	Makes a request from a template
+*/
+struct http_response* http_template_req(struct http_template *tpl, const char *query, const char *body, size_t body_len)
+{
+	return http_template_req_opts(tpl, query, body, body_len, NULL);
+}
+
+/*
+	Free memory of a template. Responses made from it stay valid.
+*/
+void http_template_free(struct http_template *tpl)
+{
+	if(tpl != NULL)
+	{
+		parsed_url_free(tpl->purl);
+		http_free(tpl->head);
+		http_free(tpl->tail);
+		http_free(tpl);
+	}
+}
@@ -0,0 +1,381 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+/*
+	Represents a TLS implementation that https requests run over. Calls do
+	not block: one that has to wait returns -1, or 0 for handshake, and sets
+	events to what the socket must be polled for, POLLIN or POLLOUT. A call
+	that failed returns -1 with events 0. recv returns 0 once the server
+	closed the session with close_notify, and HTTP_TLS_TRUNCATED when the
+	connection ended without it, which only ends a body read until close.
+*/
+#define HTTP_TLS_TRUNCATED -2
+
+struct http_transport
+{
+	void* (*open)(int sock, const char *host, int port);	/* client session on a connected socket, NULL on failure */
+	int (*handshake)(void *tls, short *events);				/* 1 once done */
+	int (*resumed)(void *tls);								/* the handshake resumed an earlier session */
+	long (*send)(void *tls, const char *data, size_t len, short *events);
+	long (*recv)(void *tls, char *data, size_t len, short *events);	/* 0 once the server closed */
+	void (*close)(void *tls);
+};
+
+#ifdef HTTP_USE_OPENSSL
+	#include <openssl/ssl.h>
+	#include <openssl/err.h>
+	#include <openssl/x509v3.h>
+
+/*
+	Number of hosts whose TLS session is kept for resumption
+*/
+#define HTTP_TLS_SESSIONS 64
+
+/*
+	Represents the session last handed out by a host, to resume the next
+	connection to it without a full handshake
+*/
+struct http_tls_session
+{
+	char *key;						/* host:port */
+	SSL_SESSION *session;
+	struct http_tls_session *next;
+};
+
+/*
+	Represents the state of the OpenSSL transport, shared by all threads
+*/
+struct http_openssl
+{
+	SSL_CTX *ctx;
+	BIO_METHOD *bio_method;
+	struct http_tls_session *sessions;
+	http_mutex lock;
+};
+
+struct http_openssl http_openssl_state = { NULL, NULL, NULL, HTTP_MUTEX_INIT };
+
+/*
+	Socket BIO that sends with HTTP_SEND_FLAGS, so a server that went away
+	does not kill the process with SIGPIPE
+*/
+int http_openssl_bio_write(BIO *bio, const char *data, int len)
+{
+	int n = (int)send((int)(long)BIO_get_data(bio), data, len, HTTP_SEND_FLAGS);
+	BIO_clear_retry_flags(bio);
+	if(n < 0 && HTTP_WOULD_BLOCK())
+		BIO_set_retry_write(bio);
+	return n;
+}
+
+int http_openssl_bio_read(BIO *bio, char *data, int len)
+{
+	int n = (int)recv((int)(long)BIO_get_data(bio), data, len, 0);
+	BIO_clear_retry_flags(bio);
+	if(n < 0 && HTTP_WOULD_BLOCK())
+		BIO_set_retry_read(bio);
+	if(n == 0)
+		BIO_set_flags(bio, BIO_FLAGS_IN_EOF);
+	return n;
+}
+
+long http_openssl_bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+	(void)num;
+	(void)ptr;
+	/* OpenSSL asks for the end of input to tell a close from an error */
+	if(cmd == BIO_CTRL_EOF)
+		return BIO_test_flags(bio, BIO_FLAGS_IN_EOF) != 0;
+	return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+}
+
+int http_openssl_bio_create(BIO *bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+/*
+	Keeps the newest session of a host. Called by OpenSSL once a server
+	issued one, which for TLS 1.3 is after the handshake.
+*/
+int http_openssl_new_session(SSL *ssl, SSL_SESSION *session)
+{
+	const char *key = (const char*)SSL_get_app_data(ssl);
+	int count = 0;
+	if(key == NULL)
+		return 0;
+	http_mutex_lock(&http_openssl_state.lock);
+	struct http_tls_session **link = &http_openssl_state.sessions;
+	while(*link != NULL)
+	{
+		struct http_tls_session *cur = *link;
+		if(strcmp(cur->key, key) == 0 || ++count >= HTTP_TLS_SESSIONS)
+		{
+			/* Replaced, or the oldest beyond the limit */
+			*link = cur->next;
+			SSL_SESSION_free(cur->session);
+			free(cur->key);
+			free(cur);
+			continue;
+		}
+		link = &cur->next;
+	}
+	struct http_tls_session *entry = (struct http_tls_session*)malloc(sizeof(struct http_tls_session));
+	if(entry != NULL && (entry->key = http_heap_strdup(key)) != NULL)
+	{
+		entry->session = session;
+		entry->next = http_openssl_state.sessions;
+		http_openssl_state.sessions = entry;
+	}
+	else
+	{
+		free(entry);
+		entry = NULL;
+	}
+	http_mutex_unlock(&http_openssl_state.lock);
+	return entry != NULL;
+}
+
+/*
+	Forgets all kept TLS sessions, so the next connection to every host does
+	a full handshake
+*/
+void http_tls_flush_sessions()
+{
+	http_mutex_lock(&http_openssl_state.lock);
+	struct http_tls_session *cur = http_openssl_state.sessions;
+	http_openssl_state.sessions = NULL;
+	http_mutex_unlock(&http_openssl_state.lock);
+	while(cur != NULL)
+	{
+		struct http_tls_session *next = cur->next;
+		SSL_SESSION_free(cur->session);
+		free(cur->key);
+		free(cur);
+		cur = next;
+	}
+}
+
+/*
+	Sets how servers are verified. Certificates are checked against the
+	certificates in ca_file, or the system store when it is NULL, unless
+	verify is 0. Connections made before keep their settings. Returns -1 if
+	ca_file can not be loaded.
+*/
+int http_tls_configure(const char *ca_file, int verify)
+{
+	SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+	if(ctx == NULL)
+		return -1;
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_verify(ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+	if((ca_file != NULL ? SSL_CTX_load_verify_locations(ctx, ca_file, NULL) : SSL_CTX_set_default_verify_paths(ctx)) != 1)
+	{
+		SSL_CTX_free(ctx);
+		return -1;
+	}
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, http_openssl_new_session);
+
+	http_mutex_lock(&http_openssl_state.lock);
+	if(http_openssl_state.ctx != NULL)
+		SSL_CTX_free(http_openssl_state.ctx);
+	http_openssl_state.ctx = ctx;
+	http_mutex_unlock(&http_openssl_state.lock);
+	return 0;
+}
+
+/*
+	Starts a client session on a connected socket: server name, the checks
+	of the certificate, and the session of the last connection to the host
+*/
+void* http_openssl_open(int sock, const char *host, int port)
+{
+	if(http_openssl_state.ctx == NULL && http_tls_configure(NULL, 1) < 0)
+		return NULL;
+
+	char key[300];
+	snprintf(key, sizeof(key), "%s:%d", host, port);
+	char *app_key = http_heap_strdup(key);
+	BIO *bio = NULL;
+	SSL *ssl = NULL;
+	http_mutex_lock(&http_openssl_state.lock);
+	if(http_openssl_state.bio_method == NULL && (http_openssl_state.bio_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "http socket")) != NULL)
+	{
+		BIO_meth_set_write(http_openssl_state.bio_method, http_openssl_bio_write);
+		BIO_meth_set_read(http_openssl_state.bio_method, http_openssl_bio_read);
+		BIO_meth_set_ctrl(http_openssl_state.bio_method, http_openssl_bio_ctrl);
+		BIO_meth_set_create(http_openssl_state.bio_method, http_openssl_bio_create);
+	}
+	if(app_key != NULL && http_openssl_state.bio_method != NULL)
+		ssl = SSL_new(http_openssl_state.ctx);
+	if(ssl != NULL)
+	{
+		struct http_tls_session *cur;
+		for(cur = http_openssl_state.sessions; cur != NULL; cur = cur->next)
+		{
+			if(strcmp(cur->key, key) == 0)
+			{
+				SSL_set_session(ssl, cur->session);
+				break;
+			}
+		}
+		bio = BIO_new(http_openssl_state.bio_method);
+	}
+	http_mutex_unlock(&http_openssl_state.lock);
+	if(bio == NULL)
+	{
+		SSL_free(ssl);
+		free(app_key);
+		return NULL;
+	}
+	BIO_set_data(bio, (void*)(long)sock);
+	SSL_set_bio(ssl, bio, bio);
+	SSL_set_app_data(ssl, app_key);
+	SSL_set_connect_state(ssl);
+	SSL_set_alpn_protos(ssl, (const unsigned char*)"\x08http/1.1", 9);
+
+	/* Names get SNI and a host name check, addresses an address check */
+	unsigned char addr[16];
+	if(inet_pton(AF_INET, host, addr) == 1 || inet_pton(AF_INET6, host, addr) == 1)
+	{
+		X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);
+	}
+	else
+	{
+		SSL_set_tlsext_host_name(ssl, host);
+		SSL_set1_host(ssl, host);
+	}
+	return ssl;
+}
+
+/*
+	Tells the socket events an OpenSSL call is waiting for, 0 for a failure
+*/
+short http_openssl_events(SSL *ssl, int ret)
+{
+	switch(SSL_get_error(ssl, ret))
+	{
+		case SSL_ERROR_WANT_READ: return POLLIN;
+		case SSL_ERROR_WANT_WRITE: return POLLOUT;
+	}
+	return 0;
+}
+
+int http_openssl_handshake(void *tls, short *events)
+{
+	ERR_clear_error();
+	int ret = SSL_do_handshake((SSL*)tls);
+	if(ret == 1)
+		return 1;
+	*events = http_openssl_events((SSL*)tls, ret);
+	return *events != 0 ? 0 : -1;
+}
+
+int http_openssl_resumed(void *tls)
+{
+	return SSL_session_reused((SSL*)tls);
+}
+
+long http_openssl_send(void *tls, const char *data, size_t len, short *events)
+{
+	ERR_clear_error();
+	int ret = SSL_write((SSL*)tls, data, len < 0x40000000 ? (int)len : 0x40000000);
+	if(ret > 0)
+		return ret;
+	*events = http_openssl_events((SSL*)tls, ret);
+	return -1;
+}
+
+long http_openssl_recv(void *tls, char *data, size_t len, short *events)
+{
+	ERR_clear_error();
+	int ret = SSL_read((SSL*)tls, data, len < 0x40000000 ? (int)len : 0x40000000);
+	if(ret > 0)
+		return ret;
+
+	int error = SSL_get_error((SSL*)tls, ret);
+	if(error == SSL_ERROR_ZERO_RETURN)
+		return 0;
+
+	/* A close without close_notify, OpenSSL 1.1 reports it as a syscall error */
+	if(error == SSL_ERROR_SYSCALL && ret == 0 && ERR_peek_error() == 0)
+		return HTTP_TLS_TRUNCATED;
+	#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+		if(error == SSL_ERROR_SSL && ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING)
+			return HTTP_TLS_TRUNCATED;
+	#endif
+	*events = http_openssl_events((SSL*)tls, ret);
+	return -1;
+}
+
+/*
+	Ends a session, telling the server when the socket takes it
+*/
+void http_openssl_close(void *tls)
+{
+	SSL *ssl = (SSL*)tls;
+	ERR_clear_error();
+	SSL_shutdown(ssl);
+	free(SSL_get_app_data(ssl));
+	SSL_free(ssl);
+}
+
+struct http_transport http_openssl_transport =
+{
+	http_openssl_open,
+	http_openssl_handshake,
+	http_openssl_resumed,
+	http_openssl_send,
+	http_openssl_recv,
+	http_openssl_close
+};
+
+struct http_transport *http_tls_transport = &http_openssl_transport;
+#else
+struct http_transport *http_tls_transport = NULL;
+#endif
+
+/*
+	Replaces the TLS implementation, NULL disables https. Set it before
+	making requests.
+*/
+void http_set_tls_transport(struct http_transport *transport)
+{
+	http_tls_transport = transport;
+}
+
+/*
+	Ends the TLS session of a connection, if it has one
+*/
+void http_tls_close(void *tls)
+{
+	if(tls != NULL && http_tls_transport != NULL)
+		http_tls_transport->close(tls);
+}
@@ -0,0 +1,313 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+
+	Warning:
+	This library does not tend to work that stable nor does it fully implent the
+	standards described by IETF. For more information on the precise implentation of the
+	Hyper Text Transfer Protocol:
+
+	http://www.ietf.org/rfc/rfc2616.txt
+*/
+
+
+/*
+	Percent-encoding for urls and form bodies. Bytes are classified through
+	a table, and on x86 runs of 16 bytes that need no change are found and
+	copied with SSE2. Encoding and decoding write into buffers the caller
+	provides; a query string is built by appending encoded pairs to a
+	str_buffer. With form set, a space is '+' like in
+	application/x-www-form-urlencoded, otherwise it is %20.
+*/
+const char url_hex_digits[] = "0123456789ABCDEF";
+
+/*
+	1 for the bytes that are left as they are: letters, digits and -._~
+*/
+const unsigned char url_unreserved[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0
+};
+
+/*
+	The value of each hex digit, -1 for anything else
+*/
+const signed char url_hex_values[256] =
+{
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+	Returns how many characters encoding len bytes writes at most
+*/
+size_t url_encoded_max(size_t len)
+{
+	return len * 3;
+}
+
+#ifdef HTTP_HAVE_SSE2
+/*
+	Returns a mask with a bit set for each of the 16 bytes at p that is
+	not unreserved
+*/
+unsigned int url_reserved_mask_sse2(const char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i dash_dot = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('-' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('.' + 1)));
+	__m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')), _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+	__m128i keep = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_or_si128(dash_dot, other));
+	return ~(unsigned int)_mm_movemask_epi8(keep) & 0xffff;
+}
+#endif
+
+/*
+	Writes the encoding of one byte to out, returns the number of characters
+*/
+size_t url_encode_byte(char *out, unsigned char c, int form)
+{
+	if(url_unreserved[c])
+	{
+		*out = (char)c;
+		return 1;
+	}
+	if(c == ' ' && form)
+	{
+		*out = '+';
+		return 1;
+	}
+	out[0] = '%';
+	out[1] = url_hex_digits[c >> 4];
+	out[2] = url_hex_digits[c & 15];
+	return 3;
+}
+
+#ifdef HTTP_HAVE_SSE2
+/*
+	Copies a run of fewer than 16 bytes. When at least 16 bytes are readable
+	at src a whole vector is moved, the output has room for it then.
+*/
+void url_copy_run(char *out, const char *src, size_t run, size_t readable)
+{
+	if(readable >= 16)
+		_mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)src));
+	else
+		while(run-- > 0)
+			*out++ = *src++;
+}
+#endif
+
+/*
+	Encodes len bytes of src into dst, which must have room for
+	url_encoded_max(len) characters. dst is not terminated. Returns the
+	number of characters written.
+*/
+size_t url_encode_to(char *dst, const char *src, size_t len, int form)
+{
+	const unsigned char *in = (const unsigned char*)src;
+	char *out = dst;
+	size_t i = 0;
+	#ifdef HTTP_HAVE_SSE2
+		http_scanner_select();
+		if(http_scanner.simd != HTTP_SIMD_NONE)
+		{
+			/* Blocks without anything to encode are copied whole */
+			for(; len - i >= 16; i += 16)
+			{
+				unsigned int mask = url_reserved_mask_sse2(src + i);
+				if(mask == 0)
+				{
+					_mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)(src + i)));
+					out += 16;
+					continue;
+				}
+				/* Copy the runs between the bytes to encode */
+				size_t from = 0;
+				while(mask != 0)
+				{
+					size_t at = (size_t)http_lowest_bit64(mask);
+					url_copy_run(out, src + i + from, at - from, len - i - from);
+					out += at - from;
+					out += url_encode_byte(out, in[i + at], form);
+					from = at + 1;
+					mask &= mask - 1;
+				}
+				url_copy_run(out, src + i + from, 16 - from, len - i - from);
+				out += 16 - from;
+			}
+		}
+	#endif
+	for(; i < len; i++)
+		out += url_encode_byte(out, in[i], form);
+	return out - dst;
+}
+
+/*
+	Decodes len characters of src into dst, which must have room for len
+	bytes and may be src itself. With form set, '+' decodes to a space.
+	Returns the number of bytes written, or -1 if a '%' is not followed by
+	two hex digits.
+*/
+long url_decode_to(char *dst, const char *src, size_t len, int form)
+{
+	char *out = dst;
+	size_t i = 0;
+	#ifdef HTTP_HAVE_SSE2
+		int vector = (http_scanner_select(), http_scanner.simd != HTTP_SIMD_NONE);
+		__m128i percent = _mm_set1_epi8('%');
+		__m128i plus = _mm_set1_epi8(form ? '+' : '%');
+	#endif
+	while(i < len)
+	{
+		#ifdef HTTP_HAVE_SSE2
+			/* Move the bytes up to the next escape, 16 at a time */
+			if(vector && len - i >= 16)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+				unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, plus)));
+				if(mask == 0)
+				{
+					_mm_storeu_si128((__m128i*)out, v);
+					out += 16;
+					i += 16;
+					continue;
+				}
+				size_t run = (size_t)http_lowest_bit64(mask);
+				while(run-- > 0)
+					*out++ = src[i++];
+			}
+		#endif
+		char c = src[i];
+		if(c == '%')
+		{
+			int hi, lo;
+			if(len - i < 3 || (hi = url_hex_values[(unsigned char)src[i + 1]]) < 0 || (lo = url_hex_values[(unsigned char)src[i + 2]]) < 0)
+				return -1;
+			*out++ = (char)(hi << 4 | lo);
+			i += 3;
+		}
+		else
+		{
+			*out++ = c == '+' && form ? ' ' : c;
+			i++;
+		}
+	}
+	return (long)(out - dst);
+}
+
+/*
+	Appends the encoding of len bytes to a buffer, returns -1 when out of
+	memory
+*/
+int str_buffer_append_urlencoded(struct str_buffer *buf, const char *src, size_t len, int form)
+{
+	if(str_buffer_reserve(buf, url_encoded_max(len)) < 0)
+		return -1;
+	str_buffer_commit(buf, url_encode_to(buf->data + buf->len, src, len, form));
+	return 0;
+}
+
+/*
+	Appends key=value to a query string being built in buf, both encoded
+	as form values and separated from what is there by '&' unless the
+	buffer is empty or ends with '?' or '&'. A NULL value appends only the
+	key. Returns -1 when out of memory.
+*/
+int url_query_add_len(struct str_buffer *buf, const char *key, size_t key_len, const char *value, size_t value_len)
+{
+	if(str_buffer_reserve(buf, 2 + url_encoded_max(key_len) + url_encoded_max(value_len)) < 0)
+		return -1;
+	char *out = buf->data + buf->len;
+	if(buf->len > 0 && out[-1] != '?' && out[-1] != '&')
+		*out++ = '&';
+	out += url_encode_to(out, key, key_len, 1);
+	if(value != NULL)
+	{
+		*out++ = '=';
+		out += url_encode_to(out, value, value_len, 1);
+	}
+	str_buffer_commit(buf, out - (buf->data + buf->len));
+	return 0;
+}
+
+/*
+	Appends key=value to a query string, like url_query_add_len for NUL
+	terminated strings
+*/
+int url_query_add(struct str_buffer *buf, const char *key, const char *value)
+{
+	return url_query_add_len(buf, key, strlen(key), value, value != NULL ? strlen(value) : 0);
+}
+
+/*
+	Encodes a string for use in a url or form body, spaces become '+'.
+	The caller frees the result.
+*/
+char *urlencode(char *str)
+{
+	size_t len = strlen(str);
+	char *buf = (char*)http_malloc(url_encoded_max(len) + 1);
+	if(buf == NULL)
+		return NULL;
+	buf[url_encode_to(buf, str, len, 1)] = '\0';
+	return buf;
+}
+
+/*
+	Decodes a string encoded by urlencode, '+' becomes a space. Returns NULL
+	if it has a malformed escape. The caller frees the result.
+*/
+char *urldecode(const char *str)
+{
+	size_t len = strlen(str);
+	char *buf = (char*)http_malloc(len + 1);
+	if(buf == NULL)
+		return NULL;
+	long decoded = url_decode_to(buf, str, len, 1);
+	if(decoded < 0)
+	{
+		http_free(buf);
+		return NULL;
+	}
+	buf[decoded] = '\0';
+	return buf;
+}
@@ -33,47 +33,65 @@ struct parsed_url
 	char *uri;					/* mandatory */
     char *scheme;               /* mandatory */
     char *host;                 /* mandatory */
-	char *ip; 					/* mandatory */
+	char *ip; 					/* not filled in, see hostname_to_ip */
     char *port;                 /* optional */
     char *path;                 /* optional */
     char *query;                /* optional */
     char *fragment;             /* optional */
     char *username;             /* optional */
     char *password;             /* optional */
+	int refs;					/* owners besides the first, see parsed_url_retain */
 };
 
+/*
+	Adds an owner to a parsed url, which is then freed by the last of its
+	owners to call parsed_url_free. Safe to call from several threads.
+*/
+void parsed_url_retain(struct parsed_url *purl)
+{
+	http_atomic_add(&purl->refs, 1);
+}
+
 /*
 	Free memory of parsed url
 */
 void parsed_url_free(struct parsed_url *purl)
 {
-    if ( NULL != purl ) 
+    if ( NULL != purl && http_atomic_add(&purl->refs, -1) < 0 ) 
 	{
-        if ( NULL != purl->scheme ) free(purl->scheme);
-        if ( NULL != purl->host ) free(purl->host);
-        if ( NULL != purl->port ) free(purl->port);
-        if ( NULL != purl->path )  free(purl->path);
-        if ( NULL != purl->query ) free(purl->query);
-        if ( NULL != purl->fragment ) free(purl->fragment);
-        if ( NULL != purl->username ) free(purl->username);
-        if ( NULL != purl->password ) free(purl->password);
-        free(purl);
+        if ( NULL != purl->uri ) http_free(purl->uri);
+        if ( NULL != purl->scheme ) http_free(purl->scheme);
+        if ( NULL != purl->host ) http_free(purl->host);
+        if ( NULL != purl->ip ) http_free(purl->ip);
+        if ( NULL != purl->port ) http_free(purl->port);
+        if ( NULL != purl->path )  http_free(purl->path);
+        if ( NULL != purl->query ) http_free(purl->query);
+        if ( NULL != purl->fragment ) http_free(purl->fragment);
+        if ( NULL != purl->username ) http_free(purl->username);
+        if ( NULL != purl->password ) http_free(purl->password);
+        http_free(purl);
     }
 }
 
 /*
-	Retrieves the IP adress of a hostname
+	Retrieves the IP adress of a hostname, the caller frees it: the address
+	the next connection to it starts at. Returns NULL with http_last_error
+	set to HTTP_ERR_RESOLVE if the host does not resolve.
 */
 char* hostname_to_ip(char *hostname)
 {
-	char *ip = "0.0.0.0";
-	struct hostent *h;
-	if ((h=gethostbyname(hostname)) == NULL) 
-	{  
-		printf("gethostbyname");
+	struct http_addrinfo addrs;
+	char ip[INET6_ADDRSTRLEN];
+	if(http_resolve_peek(hostname, 0, &addrs) < 0)
+	{
+		http_set_error(HTTP_ERR_RESOLVE);
 		return NULL;
 	}
-	return inet_ntoa(*((struct in_addr *)h->h_addr));
+	if(addrs.addrs[0].ss_family == AF_INET)
+		inet_ntop(AF_INET, &((struct sockaddr_in*)&addrs.addrs[0])->sin_addr, ip, sizeof(ip));
+	else
+		inet_ntop(AF_INET6, &((struct sockaddr_in6*)&addrs.addrs[0])->sin6_addr, ip, sizeof(ip));
+	return str_dup(ip);
 }
 
 /*
@@ -85,318 +103,270 @@ int is_scheme_char(int c)
 }
 
 /*
-	Parses a specified URL and returns the structure named 'parsed_url'
-	Implented according to:
-	RFC 1738 - http://www.ietf.org/rfc/rfc1738.txt
-	RFC 3986 -  http://www.ietf.org/rfc/rfc3986.txt
+	A piece of an url, as an offset and a length into the url string
 */
-struct parsed_url *parse_url(const char *url)
+struct url_span
 {
-	
-	/* Define variable */
-    struct parsed_url *purl;
-    const char *tmpstr;
-    const char *curstr;
-    int len;
-    int i;
-    int userpass_flag;
-    int bracket_flag;
-
-    /* Allocate the parsed url storage */
-    purl = (struct parsed_url*)malloc(sizeof(struct parsed_url));
-    if ( NULL == purl ) 
-	{
-        return NULL;
-    }
-    purl->scheme = NULL;
-    purl->host = NULL;
-    purl->port = NULL;
-    purl->path = NULL;
-    purl->query = NULL;
-    purl->fragment = NULL;
-    purl->username = NULL;
-    purl->password = NULL;
-    curstr = url;
+	unsigned int off;
+	unsigned int len;
+};
 
-    /*
-     * <scheme>:<scheme-specific-part>
-     * <scheme> := [a-z\+\-\.]+
-     *             upper case = lower case for resiliency
-     */
-    /* Read scheme */
-    tmpstr = strchr(curstr, ':');
-    if ( NULL == tmpstr ) 
-	{
-        parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-		
-        return NULL;
-    }
+#define URL_HAS_USERNAME	0x01
+#define URL_HAS_PASSWORD	0x02
+#define URL_HAS_PORT		0x04
+#define URL_HAS_PATH		0x08
+#define URL_HAS_QUERY		0x10
+#define URL_HAS_FRAGMENT	0x20
+#define URL_HOST_IPV6		0x40		/* host is a bracketed IPv6 literal */
 
-    /* Get the scheme length */
-    len = tmpstr - curstr;
+/*
+	Represents an url without copying it: the parts point into url, and
+	flags tells which of the optional ones are present. Spans are laid out
+	like the fields of parsed_url, so path has no leading '/', query no '?'
+	and fragment no '#'. The scheme is not lower cased.
+*/
+struct url_view
+{
+	const char *url;
+	struct url_span scheme;
+	struct url_span username;
+	struct url_span password;
+	struct url_span host;				/* brackets included for IPv6 */
+	struct url_span port;
+	struct url_span path;
+	struct url_span query;
+	struct url_span fragment;
+	unsigned int flags;
+	int port_number;					/* the explicit port, or 443 for https and 80 otherwise */
+};
 
-    /* Check restrictions */
-    for ( i = 0; i < len; i++ ) 
-	{
-        if (is_scheme_char(curstr[i]) == 0) 
-		{
-            /* Invalid format */
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-    }
-    /* Copy the scheme to the storage */
-    purl->scheme = (char*)malloc(sizeof(char) * (len + 1));
-    if ( NULL == purl->scheme ) 
-	{
-        parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-		
-        return NULL;
-    }
+/*
+	Returns where a span of a view starts. It is not terminated.
+*/
+const char* url_span_ptr(const struct url_view *view, struct url_span span)
+{
+	return view->url + span.off;
+}
 
-    (void)strncpy(purl->scheme, curstr, len);
-    purl->scheme[len] = '\0';
+/*
+	Returns a terminated copy of a span of a view, the caller frees it
+*/
+char* url_span_dup(const struct url_view *view, struct url_span span)
+{
+	char *out = (char*)http_malloc(span.len + 1);
+	if(out == NULL)
+		return NULL;
+	memcpy(out, view->url + span.off, span.len);
+	out[span.len] = '\0';
+	return out;
+}
 
-    /* Make the character to lower if it is upper case. */
-    for ( i = 0; i < len; i++ ) 
-	{
-        purl->scheme[i] = tolower(purl->scheme[i]);
-    }
+/*
+	Parses the first len bytes of url into view, in a single pass and
+	without allocating or resolving the host. Returns 0, or -1 if url is not
+	of the form scheme://[user[:password]@]host[:port][/path][?query][#fragment].
+*/
+int url_parse(const char *url, size_t len, struct url_view *view)
+{
+	const char *p = url;
+	const char *end = url + len;
+	memset(view, 0, sizeof(*view));
+	view->url = url;
+	if(len >= 0xFFFFFFFFu)
+		return -1;
 
-    /* Skip ':' */
-    tmpstr++;
-    curstr = tmpstr;
+	/* Scheme, followed by "//" */
+	while(p < end && (is_scheme_char((unsigned char)*p) || (p > url && isdigit((unsigned char)*p))))
+		p++;
+	if(p == url || end - p < 3 || p[0] != ':' || p[1] != '/' || p[2] != '/')
+		return -1;
+	view->scheme.len = (unsigned int)(p - url);
+	p += 3;
 
-    /*
-     * //<user>:<password>@<host>:<port>/<url-path>
-     * Any ":", "@" and "/" must be encoded.
-     */
-    /* Eat "//" */
-    for ( i = 0; i < 2; i++ ) 
+	/* The authority runs to the path, query or fragment, the last '@' ends the user info */
+	const char *authority = p;
+	const char *at = NULL;
+	const char *user_colon = NULL;
+	const char *colon = NULL;
+	for(; p < end; p++)
 	{
-        if ( '/' != *curstr ) 
+		char c = *p;
+		if(c == '/' || c == '?' || c == '#')
+			break;
+		if(c == '@')
 		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        curstr++;
-    }
-
-    /* Check if the user (and password) are specified. */
-    userpass_flag = 0;
-    tmpstr = curstr;
-    while ( '\0' != *tmpstr ) 
+			if(user_colon == NULL)
+				user_colon = colon;
+			at = p;
+			colon = NULL;
+		}
+		else if(c == ':' && colon == NULL)
+			colon = p;
+	}
+	const char *host = authority;
+	if(at != NULL)
 	{
-        if ( '@' == *tmpstr ) 
-		{
-            /* Username and password are specified */
-            userpass_flag = 1;
-            break;
-        } 
-		else if ( '/' == *tmpstr ) 
+		const char *user_end = user_colon != NULL ? user_colon : at;
+		view->username.off = (unsigned int)(authority - url);
+		view->username.len = (unsigned int)(user_end - authority);
+		view->flags |= URL_HAS_USERNAME;
+		if(user_colon != NULL)
 		{
-            /* End of <host>:<port> specification */
-            userpass_flag = 0;
-            break;
-        }
-        tmpstr++;
-    }
+			view->password.off = (unsigned int)(user_colon + 1 - url);
+			view->password.len = (unsigned int)(at - user_colon - 1);
+			view->flags |= URL_HAS_PASSWORD;
+		}
+		host = at + 1;
+	}
 
-    /* User and password specification */
-    tmpstr = curstr;
-    if ( userpass_flag ) 
+	/* Host, then an optional port */
+	const char *host_end = colon != NULL ? colon : p;
+	if(host < p && *host == '[')
 	{
-        /* Read username */
-        while ( '\0' != *tmpstr && ':' != *tmpstr && '@' != *tmpstr ) 
-		{
-            tmpstr++;
-        }
-        len = tmpstr - curstr;
-        purl->username = (char*)malloc(sizeof(char) * (len + 1));
-        if ( NULL == purl->username ) 
-		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        (void)strncpy(purl->username, curstr, len);
-        purl->username[len] = '\0';
-
-        /* Proceed current pointer */
-        curstr = tmpstr;
-        if ( ':' == *curstr ) 
+		host_end = (const char*)memchr(host, ']', p - host);
+		if(host_end == NULL)
+			return -1;
+		host_end++;
+		if(host_end < p && *host_end != ':')
+			return -1;
+		view->flags |= URL_HOST_IPV6;
+	}
+	if(host_end == host)
+		return -1;
+	view->host.off = (unsigned int)(host - url);
+	view->host.len = (unsigned int)(host_end - host);
+	view->port_number = view->scheme.len == 5 && str_equal_nocase(url, "https", 5) ? 443 : 80;
+	if(host_end < p)
+	{
+		const char *digits = host_end + 1;
+		int number = 0;
+		if(p - digits > 5)
+			return -1;
+		for(; digits < p; digits++)
 		{
-            /* Skip ':' */
-            curstr++;
-            
-            /* Read password */
-            tmpstr = curstr;
-            while ( '\0' != *tmpstr && '@' != *tmpstr ) 
-			{
-                tmpstr++;
-            }
-            len = tmpstr - curstr;
-            purl->password = (char*)malloc(sizeof(char) * (len + 1));
-            if ( NULL == purl->password ) 
-			{
-                parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-                return NULL;
-            }
-            (void)strncpy(purl->password, curstr, len);
-            purl->password[len] = '\0';
-            curstr = tmpstr;
-        }
-        /* Skip '@' */
-        if ( '@' != *curstr ) 
+			if(!isdigit((unsigned char)*digits))
+				return -1;
+			number = number * 10 + (*digits - '0');
+		}
+		if(number > 65535)
+			return -1;
+		view->port.off = (unsigned int)(host_end + 1 - url);
+		view->port.len = (unsigned int)(p - host_end - 1);
+		if(view->port.len > 0)
 		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        curstr++;
-    }
+			view->port_number = number;
+			view->flags |= URL_HAS_PORT;
+		}
+	}
 
-    if ( '[' == *curstr ) 
-	{
-        bracket_flag = 1;
-    } 
-	else 
+	/* Path, query and fragment */
+	if(p < end && *p == '/')
 	{
-        bracket_flag = 0;
-    }
-    /* Proceed on by delimiters with reading host */
-    tmpstr = curstr;
-    while ( '\0' != *tmpstr ) {
-        if ( bracket_flag && ']' == *tmpstr )
- 		{
-            /* End of IPv6 address. */
-            tmpstr++;
-            break;
-        } 
-		else if ( !bracket_flag && (':' == *tmpstr || '/' == *tmpstr) ) 
-		{
-            /* Port number is specified. */
-            break;
-        }
-        tmpstr++;
-    }
-    len = tmpstr - curstr;
-    purl->host = (char*)malloc(sizeof(char) * (len + 1));
-    if ( NULL == purl->host || len <= 0 ) 
-	{
-        parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-        return NULL;
-    }
-    (void)strncpy(purl->host, curstr, len);
-    purl->host[len] = '\0';
-    curstr = tmpstr;
-
-    /* Is port number specified? */
-    if ( ':' == *curstr ) 
+		const char *path = ++p;
+		while(p < end && *p != '?' && *p != '#')
+			p++;
+		view->path.off = (unsigned int)(path - url);
+		view->path.len = (unsigned int)(p - path);
+		view->flags |= URL_HAS_PATH;
+	}
+	if(p < end && *p == '?')
 	{
-        curstr++;
-        /* Read port number */
-        tmpstr = curstr;
-        while ( '\0' != *tmpstr && '/' != *tmpstr ) 
-		{
-            tmpstr++;
-        }
-        len = tmpstr - curstr;
-        purl->port = (char*)malloc(sizeof(char) * (len + 1));
-        if ( NULL == purl->port ) 
-		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        (void)strncpy(purl->port, curstr, len);
-        purl->port[len] = '\0';
-        curstr = tmpstr;
-    }
-	else
+		const char *query = ++p;
+		while(p < end && *p != '#')
+			p++;
+		view->query.off = (unsigned int)(query - url);
+		view->query.len = (unsigned int)(p - query);
+		view->flags |= URL_HAS_QUERY;
+	}
+	if(p < end && *p == '#')
 	{
-		purl->port = "80";
+		p++;
+		view->fragment.off = (unsigned int)(p - url);
+		view->fragment.len = (unsigned int)(end - p);
+		view->flags |= URL_HAS_FRAGMENT;
 	}
-	
-	/* Get ip */
-	char *ip = hostname_to_ip(purl->host);
-	purl->ip = ip;
-	
-	/* Set uri */
-	purl->uri = (char*)url;
+	return 0;
+}
 
-    /* End of the string */
-    if ( '\0' == *curstr ) 
+/*
+	Resolves the host of a view to its addresses, with the port of the view
+	filled in, in the order a connection to it would try them. Returns 0,
+	or -1 if the host can not be resolved.
+*/
+int url_resolve(const struct url_view *view, struct http_addrinfo *addrs)
+{
+	char host[256];
+	const char *name = url_span_ptr(view, view->host);
+	size_t len = view->host.len;
+	if(view->flags & URL_HOST_IPV6)
 	{
-        return purl;
-    }
+		name++;
+		len -= 2;
+	}
+	if(len >= sizeof(host))
+		return -1;
+	memcpy(host, name, len);
+	host[len] = '\0';
+	return http_resolve(host, view->port_number, addrs);
+}
 
-    /* Skip '/' */
-    if ( '/' != *curstr ) 
+/*
+	Parses a specified URL and returns the structure named 'parsed_url', with
+	the scheme lower cased and the port defaulted. The host is not looked
+	up, that happens when a connection is made. Returns NULL with
+	http_last_error set to HTTP_ERR_URL for an invalid url, or to
+	HTTP_ERR_MEMORY. Use url_parse for a view that needs no allocations.
+	Implented according to:
+	RFC 1738 - http://www.ietf.org/rfc/rfc1738.txt
+	RFC 3986 -  http://www.ietf.org/rfc/rfc3986.txt
+*/
+struct parsed_url *parse_url(const char *url)
+{
+	struct url_view view;
+	size_t i;
+	if(url_parse(url, strlen(url), &view) < 0)
 	{
-        parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-        return NULL;
-    }
-    curstr++;
+		http_set_error(HTTP_ERR_URL);
+		return NULL;
+	}
 
-    /* Parse path */
-    tmpstr = curstr;
-    while ( '\0' != *tmpstr && '#' != *tmpstr  && '?' != *tmpstr ) 
-	{
-        tmpstr++;
-    }
-    len = tmpstr - curstr;
-    purl->path = (char*)malloc(sizeof(char) * (len + 1));
-    if ( NULL == purl->path ) 
+	struct parsed_url *purl = (struct parsed_url*)http_calloc(1, sizeof(struct parsed_url));
+	if(purl == NULL)
 	{
-        parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-        return NULL;
-    }
-    (void)strncpy(purl->path, curstr, len);
-    purl->path[len] = '\0';
-    curstr = tmpstr;
-
-    /* Is query specified? */
-    if ( '?' == *curstr ) 
+		http_set_error(HTTP_ERR_MEMORY);
+		return NULL;
+	}
+	purl->uri = str_dup(url);
+	purl->scheme = url_span_dup(&view, view.scheme);
+	purl->host = url_span_dup(&view, view.host);
+	if(view.flags & URL_HAS_PORT)
+		purl->port = url_span_dup(&view, view.port);
+	else
+		purl->port = str_dup(view.port_number == 443 ? "443" : "80");
+	if(view.flags & URL_HAS_USERNAME)
+		purl->username = url_span_dup(&view, view.username);
+	if(view.flags & URL_HAS_PASSWORD)
+		purl->password = url_span_dup(&view, view.password);
+	if(view.flags & URL_HAS_PATH)
+		purl->path = url_span_dup(&view, view.path);
+	if(view.flags & URL_HAS_QUERY)
+		purl->query = url_span_dup(&view, view.query);
+	if(view.flags & URL_HAS_FRAGMENT)
+		purl->fragment = url_span_dup(&view, view.fragment);
+	if(purl->uri == NULL || purl->scheme == NULL || purl->host == NULL || purl->port == NULL
+		|| ((view.flags & URL_HAS_USERNAME) && purl->username == NULL)
+		|| ((view.flags & URL_HAS_PASSWORD) && purl->password == NULL)
+		|| ((view.flags & URL_HAS_PATH) && purl->path == NULL)
+		|| ((view.flags & URL_HAS_QUERY) && purl->query == NULL)
+		|| ((view.flags & URL_HAS_FRAGMENT) && purl->fragment == NULL))
 	{
-        /* Skip '?' */
-        curstr++;
-        /* Read query */
-        tmpstr = curstr;
-        while ( '\0' != *tmpstr && '#' != *tmpstr ) 
-		{
-            tmpstr++;
-        }
-        len = tmpstr - curstr;
-        purl->query = (char*)malloc(sizeof(char) * (len + 1));
-        if ( NULL == purl->query ) 
-		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        (void)strncpy(purl->query, curstr, len);
-        purl->query[len] = '\0';
-        curstr = tmpstr;
-    }
+		parsed_url_free(purl);
+		http_set_error(HTTP_ERR_MEMORY);
+		return NULL;
+	}
+	for(i = 0; i < view.scheme.len; i++)
+		purl->scheme[i] = tolower((unsigned char)purl->scheme[i]);
 
-    /* Is fragment specified? */
-    if ( '#' == *curstr ) 
-	{
-        /* Skip '#' */
-        curstr++;
-        /* Read fragment */
-        tmpstr = curstr;
-        while ( '\0' != *tmpstr ) 
-		{
-            tmpstr++;
-        }
-        len = tmpstr - curstr;
-        purl->fragment = (char*)malloc(sizeof(char) * (len + 1));
-        if ( NULL == purl->fragment )
- 		{
-            parsed_url_free(purl); fprintf(stderr, "Error on line %d (%s)\n", __LINE__, __FILE__);
-            return NULL;
-        }
-        (void)strncpy(purl->fragment, curstr, len);
-        purl->fragment[len] = '\0';
-        curstr = tmpstr;
-    }
+	/* The host is resolved when a connection to it is made */
 	return purl;
-}
\ No newline at end of file
+}
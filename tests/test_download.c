@@ -0,0 +1,470 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Downloads from a loopback server into temporary files: bodies spliced to
+	a regular file and written to one splice can not write to, resumes
+	answered with a matching 206, a 206 for the wrong range, a 200 for an
+	object that changed, and a transfer cut short and resumed within the
+	call. Streams that abort fail with their own error.
+*/
+#include "http-client-c.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+#define OBJECT_SIZE (1024 * 1024 + 123)
+
+/*
+	How the server answers a Range request with a matching If-Range
+*/
+enum range_mode
+{
+	RANGE_OK,						/* 206 from where the client asked */
+	RANGE_WRONG,					/* 206 from the wrong offset */
+	RANGE_CHANGED					/* 200 with a new version of the object */
+};
+
+/*
+	Represents the test server and what it saw of the last request
+*/
+struct dl_server
+{
+	int listener;
+	int port;
+	char object[2][OBJECT_SIZE];	/* the versions of the object */
+	int version;
+	enum range_mode mode;
+	long long cut_after;			/* body bytes the next response stops after, 0 for all */
+	http_mutex lock;
+	int requests;
+	char range[64];					/* Range and If-Range of the last request, "" for none */
+	char if_range[64];
+};
+
+static struct dl_server server;
+
+/*
+	Copies the value of a request header, "" when it is missing
+*/
+static void request_header(const char *request, const char *name, char *out, size_t out_len)
+{
+	const char *line = strstr(request, "\r\n");
+	size_t name_len = strlen(name);
+	out[0] = '\0';
+	while(line != NULL && line[2] != '\r')
+	{
+		line += 2;
+		const char *end = strstr(line, "\r\n");
+		if(end != NULL && strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+		{
+			const char *value = line + name_len + 1;
+			while(*value == ' ')
+				value++;
+			size_t len = end - value < (long)out_len - 1 ? (size_t)(end - value) : out_len - 1;
+			memcpy(out, value, len);
+			out[len] = '\0';
+			return;
+		}
+		line = end;
+	}
+}
+
+/*
+	Answers one request and closes the connection. The head goes out on its
+	own, so the body arrives after the client has parsed it.
+*/
+static void* serve(void *data)
+{
+	int sock = (int)(long)data;
+	char request[4096], head[512], etag[16];
+	size_t len = 0;
+	while(len + 1 < sizeof(request))
+	{
+		ssize_t n = recv(sock, request + len, sizeof(request) - len - 1, 0);
+		if(n <= 0)
+			break;
+		len += n;
+		request[len] = '\0';
+		if(strstr(request, "\r\n\r\n") != NULL)
+			break;
+	}
+
+	http_mutex_lock(&server.lock);
+	server.requests++;
+	request_header(request, "Range", server.range, sizeof(server.range));
+	request_header(request, "If-Range", server.if_range, sizeof(server.if_range));
+	int version = server.version;
+	snprintf(etag, sizeof(etag), "\"v%d\"", version + 1);
+	long long start = 0;
+	if(strncmp(server.range, "bytes=", 6) == 0 && strcmp(server.if_range, etag) == 0)
+	{
+		start = atoll(server.range + 6);
+		if(server.mode == RANGE_WRONG)
+			start++;
+		else if(server.mode == RANGE_CHANGED)
+			start = -1;
+	}
+	if(start < 0)
+	{
+		/* The object changed since the client got its first part */
+		version = server.version = 1;
+		snprintf(etag, sizeof(etag), "\"v%d\"", version + 1);
+		start = 0;
+	}
+	long long cut_after = server.cut_after;
+	server.cut_after = 0;
+	http_mutex_unlock(&server.lock);
+
+	if(start > 0)
+		snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%d/%d\r\nContent-Length: %lld\r\nETag: %s\r\nConnection: close\r\n\r\n",
+			start, OBJECT_SIZE - 1, OBJECT_SIZE, OBJECT_SIZE - start, etag);
+	else
+		snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nETag: %s\r\nConnection: close\r\n\r\n", OBJECT_SIZE, etag);
+	send(sock, head, strlen(head), HTTP_SEND_FLAGS);
+	usleep(20000);
+	long long body_len = OBJECT_SIZE - start;
+	if(cut_after > 0 && cut_after < body_len)
+		body_len = cut_after;
+	const char *body = server.object[version] + start;
+	while(body_len > 0)
+	{
+		ssize_t n = send(sock, body, (size_t)body_len, HTTP_SEND_FLAGS);
+		if(n <= 0)
+			break;
+		body += n;
+		body_len -= n;
+	}
+	close(sock);
+	return NULL;
+}
+
+static void* accept_loop(void *data)
+{
+	(void)data;
+	while(1)
+	{
+		int sock = accept(server.listener, NULL, NULL);
+		if(sock < 0)
+			continue;
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, serve, (void*)(long)sock) == 0)
+			pthread_detach(thread);
+		else
+			close(sock);
+	}
+	return NULL;
+}
+
+static int start_server()
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int i;
+	for(i = 0; i < OBJECT_SIZE; i++)
+	{
+		server.object[0][i] = (char)(i * 7 % 251);
+		server.object[1][i] = (char)(i * 13 % 241);
+	}
+	pthread_mutex_init(&server.lock, NULL);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(server.listener < 0 || bind(server.listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server.listener, 16) < 0)
+		return -1;
+	getsockname(server.listener, (struct sockaddr*)&addr, &addr_len);
+	server.port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, accept_loop, NULL) != 0)
+		return -1;
+	pthread_detach(thread);
+	return 0;
+}
+
+/*
+	Sets the object and the way ranges are answered for the next test
+*/
+static void reset_server(enum range_mode mode, long long cut_after)
+{
+	http_mutex_lock(&server.lock);
+	server.version = 0;
+	server.mode = mode;
+	server.cut_after = cut_after;
+	server.requests = 0;
+	http_mutex_unlock(&server.lock);
+}
+
+/*
+	Opens an empty temporary file, with flags added to O_RDWR
+*/
+static int temp_file(int flags)
+{
+	char path[] = "/tmp/http-client-c-test-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+		return -1;
+	unlink(path);
+	if(flags != 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | flags);
+	return fd;
+}
+
+/*
+	Tells whether a file holds exactly the given bytes
+*/
+static int file_equals(int fd, const char *data, long long len)
+{
+	static char buf[OBJECT_SIZE + 1];
+	if(http_file_size(fd) != len || lseek(fd, 0, SEEK_SET) != 0)
+		return 0;
+	long long got = 0;
+	while(got < len)
+	{
+		ssize_t n = read(fd, buf + got, (size_t)(len - got));
+		if(n <= 0)
+			return 0;
+		got += n;
+	}
+	return memcmp(buf, data, (size_t)len) == 0;
+}
+
+static void url(char *out, size_t len)
+{
+	snprintf(out, len, "http://127.0.0.1:%d/object", server.port);
+}
+
+/*
+	Counts the body bytes that were written rather than spliced
+*/
+static long long written_by_write;
+
+static int count_on_body(const char *chunk, size_t len, void *data)
+{
+	struct http_download *dl = (struct http_download*)data;
+	if(dl->sink.active)
+		written_by_write += len;
+	return http_download_on_body(chunk, len, data);
+}
+
+/*
+	Fetches the object into fd through a sink the way a download does, and
+	returns how many bytes were spliced
+*/
+static long long fetch_to_sink(int fd, int *splice_kept)
+{
+	struct http_download dl;
+	struct http_stream stream;
+	char target[128];
+	memset(&dl, 0, sizeof(dl));
+	dl.sink.fd = fd;
+	dl.sink.splice = 1;
+	stream.data = &dl;
+	stream.on_headers = http_download_on_headers;
+	stream.on_body = count_on_body;
+	written_by_write = 0;
+	url(target, sizeof(target));
+	struct parsed_url *purl = parse_url(target);
+	struct http_response *hresp = http_req_run(http_build_request("GET", purl, NULL), NULL, 0, purl, &stream, &dl.sink, NULL);
+	CHECK(hresp != NULL);
+	CHECK(dl.sink.written == OBJECT_SIZE);
+	http_response_free(hresp);
+	http_free(dl.validator);
+	*splice_kept = dl.sink.splice;
+	return dl.sink.written - written_by_write;
+}
+
+static void test_splice()
+{
+	#if defined(__linux__) && !defined(HTTP_HAVE_SPLICE)
+		fprintf(stderr, "built without splice, _GNU_SOURCE is missing\n");
+		failures++;
+	#endif
+	int splice_kept;
+	int fd = temp_file(0);
+	reset_server(RANGE_OK, 0);
+	long long spliced = fetch_to_sink(fd, &splice_kept);
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	#ifdef HTTP_HAVE_SPLICE
+		CHECK(splice_kept);
+		CHECK(spliced > 0);
+	#endif
+	close(fd);
+
+	/* splice does not write to files opened for appending, write does */
+	fd = temp_file(O_APPEND);
+	reset_server(RANGE_OK, 0);
+	spliced = fetch_to_sink(fd, &splice_kept);
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	#ifdef HTTP_HAVE_SPLICE
+		CHECK(!splice_kept);
+	#endif
+	(void)spliced;
+	close(fd);
+}
+
+/*
+	A file with the first part of the object and the validator of that
+	version
+*/
+static int partial_file(long long len)
+{
+	int fd = temp_file(0);
+	http_write_all(fd, server.object[0], (size_t)len);
+	return fd;
+}
+
+static void test_resume()
+{
+	char target[128];
+	url(target, sizeof(target));
+
+	/* A matching 206 carries on where the file ends */
+	int fd = partial_file(1000);
+	char *validator = str_dup("\"v1\"");
+	reset_server(RANGE_OK, 0);
+	struct http_response *hresp = http_download_resume(target, NULL, fd, &validator);
+	CHECK(hresp != NULL && hresp->status_code_int == 206);
+	CHECK(strcmp(server.range, "bytes=1000-") == 0);
+	CHECK(strcmp(server.if_range, "\"v1\"") == 0);
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	CHECK(validator != NULL && strcmp(validator, "\"v1\"") == 0);
+	http_response_free(hresp);
+	http_free(validator);
+	close(fd);
+
+	/* A 206 that starts anywhere else is not appended */
+	fd = partial_file(1000);
+	validator = str_dup("\"v1\"");
+	reset_server(RANGE_WRONG, 0);
+	hresp = http_download_resume(target, NULL, fd, &validator);
+	CHECK(hresp == NULL);
+	CHECK(http_last_error() == HTTP_ERR_PROTOCOL);
+	CHECK(http_file_size(fd) == 1000);
+	http_free(validator);
+	close(fd);
+
+	/* A 200 for an object that changed starts the file over */
+	fd = partial_file(1000);
+	validator = str_dup("\"v1\"");
+	reset_server(RANGE_CHANGED, 0);
+	hresp = http_download_resume(target, NULL, fd, &validator);
+	CHECK(hresp != NULL && hresp->status_code_int == 200);
+	CHECK(file_equals(fd, server.object[1], OBJECT_SIZE));
+	CHECK(validator != NULL && strcmp(validator, "\"v2\"") == 0);
+	http_response_free(hresp);
+	http_free(validator);
+	close(fd);
+
+	/* A weak ETag can not go in If-Range, so the file starts over */
+	fd = partial_file(1000);
+	validator = str_dup("W/\"v1\"");
+	reset_server(RANGE_OK, 0);
+	hresp = http_download_resume(target, NULL, fd, &validator);
+	CHECK(hresp != NULL && hresp->status_code_int == 200);
+	CHECK(server.range[0] == '\0');
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	http_response_free(hresp);
+	http_free(validator);
+	close(fd);
+
+	/* Without a validator a plain download starts over too */
+	fd = partial_file(1000);
+	reset_server(RANGE_OK, 0);
+	hresp = http_download(target, NULL, fd);
+	CHECK(hresp != NULL && hresp->status_code_int == 200);
+	CHECK(server.range[0] == '\0');
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	http_response_free(hresp);
+	close(fd);
+}
+
+/*
+	A transfer cut short is resumed from where the file got to
+*/
+static void test_cut_short()
+{
+	char target[128];
+	url(target, sizeof(target));
+	int fd = temp_file(0);
+	reset_server(RANGE_OK, 300000);
+	struct http_response *hresp = http_download(target, NULL, fd);
+	CHECK(hresp != NULL && hresp->status_code_int == 206);
+	CHECK(server.requests == 2);
+	CHECK(strcmp(server.range, "bytes=300000-") == 0);
+	CHECK(strcmp(server.if_range, "\"v1\"") == 0);
+	CHECK(file_equals(fd, server.object[0], OBJECT_SIZE));
+	http_response_free(hresp);
+	close(fd);
+}
+
+static int abort_on_headers(struct http_response *hresp, void *data)
+{
+	(void)hresp;
+	return *(int*)data == 0;
+}
+
+static int abort_on_body(const char *chunk, size_t len, void *data)
+{
+	(void)chunk;
+	(void)len;
+	return *(int*)data == 1;
+}
+
+/*
+	A stream callback that aborts fails the request with HTTP_ERR_ABORTED,
+	not as a response that could not be parsed
+*/
+static void test_abort()
+{
+	struct http_stream stream;
+	char target[128];
+	int which;
+	url(target, sizeof(target));
+	reset_server(RANGE_OK, 0);
+	stream.data = &which;
+	stream.on_headers = abort_on_headers;
+	stream.on_body = abort_on_body;
+	for(which = 0; which < 3; which++)
+	{
+		struct parsed_url *purl = parse_url(target);
+		struct http_response *hresp = http_req_stream(http_build_request("GET", purl, NULL), purl, &stream);
+		CHECK(which == 2 ? hresp != NULL : hresp == NULL && http_last_error() == HTTP_ERR_ABORTED);
+		http_response_free(hresp);
+	}
+}
+
+int main()
+{
+	if(start_server() < 0)
+	{
+		fprintf(stderr, "could not start the server\n");
+		return 1;
+	}
+	test_splice();
+	test_resume();
+	test_cut_short();
+	test_abort();
+	if(failures > 0)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures > 0;
+}
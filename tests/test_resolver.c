@@ -0,0 +1,335 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Checks that connections to a host with several cached addresses take
+	them in turn, that looking at the addresses does not move the turn on,
+	and that asynchronous lookups share a few resolver threads. The host is
+	a made up name cached with two loopback addresses, and a server
+	listening on all of them tells which one each connection came in on.
+	Lookups that take too long give up within the timeouts of the request.
+*/
+#include "http-client-c.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+#define TEST_HOST "rr.test"
+
+/*
+	Represents the test server
+*/
+struct rr_server
+{
+	int listener;
+	int port;
+	http_mutex lock;
+	int connections;
+	char local[64][INET_ADDRSTRLEN];	/* the address each connection came in on */
+};
+
+static struct rr_server server = { -1, 0, HTTP_MUTEX_INIT, 0, { { 0 } } };
+
+/*
+	Answers every connection with one response and closes it, so each
+	request makes a connection of its own
+*/
+static void* serve(void *data)
+{
+	const char reply[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+	(void)data;
+	while(1)
+	{
+		char buf[4096];
+		size_t len = 0;
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		int sock = accept(server.listener, NULL, NULL);
+		if(sock < 0)
+			continue;
+		getsockname(sock, (struct sockaddr*)&addr, &addr_len);
+		http_mutex_lock(&server.lock);
+		if(server.connections < 64)
+			inet_ntop(AF_INET, &addr.sin_addr, server.local[server.connections++], INET_ADDRSTRLEN);
+		http_mutex_unlock(&server.lock);
+		while(len + 1 < sizeof(buf))
+		{
+			ssize_t n = recv(sock, buf + len, sizeof(buf) - len - 1, 0);
+			if(n <= 0)
+				break;
+			len += n;
+			buf[len] = '\0';
+			if(strstr(buf, "\r\n\r\n") != NULL)
+			{
+				send(sock, reply, sizeof(reply) - 1, HTTP_SEND_FLAGS);
+				break;
+			}
+		}
+		close(sock);
+	}
+	return NULL;
+}
+
+static int start_server()
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	server.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(server.listener < 0 || bind(server.listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server.listener, 16) < 0)
+		return -1;
+	getsockname(server.listener, (struct sockaddr*)&addr, &addr_len);
+	server.port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, serve, NULL) != 0)
+		return -1;
+	pthread_detach(thread);
+	return 0;
+}
+
+/*
+	Puts the made up host in the resolver cache with the given addresses
+*/
+static void seed_cache(const char **ips, int count)
+{
+	struct http_dns_entry *entry = (struct http_dns_entry*)calloc(1, sizeof(struct http_dns_entry));
+	int i;
+	entry->host = http_heap_strdup(TEST_HOST);
+	for(i = 0; i < count; i++)
+	{
+		struct sockaddr_in *addr = (struct sockaddr_in*)&entry->addrs.addrs[i];
+		addr->sin_family = AF_INET;
+		inet_pton(AF_INET, ips[i], &addr->sin_addr);
+		entry->addrs.addrlens[i] = sizeof(struct sockaddr_in);
+	}
+	entry->addrs.count = count;
+	entry->expires = http_now_ms() + 60000;
+	http_mutex_lock(&http_dns_cache.lock);
+	entry->next = http_dns_cache.entries;
+	http_dns_cache.entries = entry;
+	http_mutex_unlock(&http_dns_cache.lock);
+}
+
+/*
+	Makes a request to the made up host, returns the address the server
+	saw it come in on
+*/
+static const char* request()
+{
+	static char local[INET_ADDRSTRLEN];
+	char url[128];
+	snprintf(url, sizeof(url), "http://" TEST_HOST ":%d/", server.port);
+	int before = server.connections;
+	struct http_response *hresp = http_get(url, NULL);
+	CHECK(hresp != NULL);
+	if(hresp == NULL)
+		return "";
+	CHECK(hresp->timing.reused == 0);
+	http_response_free(hresp);
+	http_mutex_lock(&server.lock);
+	CHECK(server.connections == before + 1);
+	strcpy(local, server.connections > 0 ? server.local[server.connections - 1] : "");
+	http_mutex_unlock(&server.lock);
+	return local;
+}
+
+static void test_connects_alternate()
+{
+	const char *ips[] = { "127.0.0.1", "127.0.0.2" };
+	char previous[INET_ADDRSTRLEN];
+	int i;
+	seed_cache(ips, 2);
+	strcpy(previous, request());
+	CHECK(strcmp(previous, ips[0]) == 0 || strcmp(previous, ips[1]) == 0);
+	for(i = 0; i < 6; i++)
+	{
+		/* Looking at the addresses shows the next one, and leaves it next */
+		char *ip = hostname_to_ip(TEST_HOST);
+		CHECK(ip != NULL && strcmp(ip, previous) != 0);
+		const char *local = request();
+		CHECK(ip != NULL && strcmp(local, ip) == 0);
+		CHECK(strcmp(local, previous) != 0);
+		strcpy(previous, local);
+		http_free(ip);
+	}
+}
+
+static struct http_response *loop_responses[4];
+
+static void on_loop_done(struct http_response *hresp, void *data)
+{
+	loop_responses[(long)data] = hresp;
+}
+
+/*
+	The event loop takes the addresses in turn just the same
+*/
+static void test_loop_alternates()
+{
+	struct http_loop *loop = http_loop_new();
+	char url[128];
+	long i;
+	CHECK(loop != NULL);
+	if(loop == NULL)
+		return;
+	snprintf(url, sizeof(url), "http://" TEST_HOST ":%d/", server.port);
+	int before = server.connections;
+	for(i = 0; i < 4; i++)
+	{
+		struct parsed_url *purl = parse_url(url);
+		CHECK(http_loop_submit(loop, http_build_request("GET", purl, NULL), purl, on_loop_done, (void*)i) == 0);
+		http_loop_run(loop);
+		CHECK(loop_responses[i] != NULL);
+		http_response_free(loop_responses[i]);
+	}
+	http_loop_free(loop);
+	http_mutex_lock(&server.lock);
+	CHECK(server.connections == before + 4);
+	for(i = before + 1; i < server.connections; i++)
+		CHECK(strcmp(server.local[i], server.local[i - 1]) != 0);
+	http_mutex_unlock(&server.lock);
+}
+
+static int lookups_done = 0;
+static int lookups_ok = 0;
+
+static void on_lookup(const char *host, struct http_addrinfo *addrs, void *data)
+{
+	(void)host;
+	(void)data;
+	if(addrs != NULL)
+		__sync_fetch_and_add(&lookups_ok, 1);
+	__sync_fetch_and_add(&lookups_done, 1);
+}
+
+static int cache_entries(const char *host)
+{
+	struct http_dns_entry *entry;
+	int count = 0;
+	http_mutex_lock(&http_dns_cache.lock);
+	for(entry = http_dns_cache.entries; entry != NULL; entry = entry->next)
+	{
+		if(strcmp(entry->host, host) == 0)
+			count++;
+	}
+	http_mutex_unlock(&http_dns_cache.lock);
+	return count;
+}
+
+/*
+	Many asynchronous lookups of hosts that are not cached share a few
+	resolver threads, and those of the same host share one lookup
+*/
+static void test_async_lookups()
+{
+	char host[32];
+	int i;
+	http_resolver_flush();
+	for(i = 0; i < 300; i++)
+	{
+		snprintf(host, sizeof(host), "127.0.0.%d", i < 200 ? 1 : i - 190);
+		CHECK(http_resolve_async(host, 80, on_lookup, NULL) == 0);
+	}
+	for(i = 0; i < 10000 && __sync_fetch_and_add(&lookups_done, 0) < 300; i++)
+		usleep(1000);
+	CHECK(lookups_done == 300);
+	CHECK(lookups_ok == 300);
+	CHECK(http_resolver_threads.threads >= 1 && http_resolver_threads.threads <= HTTP_RESOLVER_THREADS);
+	CHECK(cache_entries("127.0.0.1") == 1);
+	CHECK(cache_entries("127.0.0.20") == 1);
+}
+
+static int hold_threads = 0;
+static int threads_held = 0;
+
+static void on_held_lookup(const char *host, struct http_addrinfo *addrs, void *data)
+{
+	(void)host;
+	(void)addrs;
+	(void)data;
+	__sync_fetch_and_add(&threads_held, 1);
+	while(__sync_fetch_and_add(&hold_threads, 0))
+		usleep(1000);
+}
+
+/*
+	A lookup that does not finish in time gives up within the connect
+	timeout or the deadline. Every resolver thread is kept busy handing out
+	answers meanwhile, so lookups queued after them can not finish.
+*/
+static void test_lookup_bounded()
+{
+	struct http_request_opts opts = http_default_opts;
+	struct http_addrinfo addrs;
+	char host[32];
+	int i;
+	http_resolver_flush();
+	hold_threads = 1;
+	for(i = 0; i < HTTP_RESOLVER_THREADS; i++)
+	{
+		snprintf(host, sizeof(host), "127.0.1.%d", i + 1);
+		CHECK(http_resolve_async(host, 80, on_held_lookup, NULL) == 0);
+	}
+
+	long long start = http_now_ms();
+	CHECK(http_resolve_within("127.0.1.9", 80, &addrs, 100) == -2);
+	long long took = http_now_ms() - start;
+	CHECK(took >= 100 && took < 2000);
+
+	opts.connect_timeout_ms = 100;
+	CHECK(http_get_opts("http://127.0.1.9:1/", NULL, &opts) == NULL);
+	CHECK(http_last_error() == HTTP_ERR_CONNECT_TIMEOUT);
+	opts.connect_timeout_ms = 0;
+	opts.total_timeout_ms = 100;
+	start = http_now_ms();
+	CHECK(http_get_opts("http://127.0.1.10:1/", NULL, &opts) == NULL);
+	CHECK(http_last_error() == HTTP_ERR_TIMEOUT);
+	CHECK(http_now_ms() - start < 2000);
+	http_mutex_lock(&http_resolver_threads.lock);
+	CHECK(__sync_fetch_and_add(&threads_held, 0) == http_resolver_threads.threads);
+	http_mutex_unlock(&http_resolver_threads.lock);
+
+	/* The lookups left behind still fill the cache */
+	__sync_fetch_and_sub(&hold_threads, 1);
+	for(i = 0; i < 2000 && (cache_entries("127.0.1.9") == 0 || cache_entries("127.0.1.10") == 0); i++)
+		usleep(1000);
+	CHECK(cache_entries("127.0.1.9") == 1 && cache_entries("127.0.1.10") == 1);
+	CHECK(http_resolve_within("127.0.1.9", 80, &addrs, 0) == 0);
+}
+
+int main()
+{
+	if(start_server() < 0)
+	{
+		fprintf(stderr, "could not start the server\n");
+		return 1;
+	}
+	test_connects_alternate();
+	test_loop_alternates();
+	test_async_lookups();
+	test_lookup_bounded();
+	if(failures > 0)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures > 0;
+}
@@ -0,0 +1,679 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Forces each instruction set the CPU has on the code with SIMD paths and
+	checks what it gives against scalar code and generated inputs: lengths
+	around the 64 byte block and line ends split across blocks included, and
+	for url encoding runs across the 16 byte blocks.
+*/
+#include "http-client-c.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+static const char *simd_names[] = { "scalar", "sse2", "avx2" };
+
+/*
+	Fixed seed xorshift, so a failure shows up the same way every run
+*/
+static unsigned long long rng_state = 0x9E3779B97F4A7C15ULL;
+
+static unsigned int rng()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (unsigned int)(rng_state >> 16);
+}
+
+static unsigned int rng_below(unsigned int n)
+{
+	return n > 0 ? rng() % n : 0;
+}
+
+/*
+	Block masks
+*/
+static void test_scan_block(enum http_simd simd)
+{
+	char block[HTTP_SCAN_BLOCK];
+	const char alphabet[] = "\n\r: aZ";
+	int round, i;
+	if(http_scanner.block == NULL)
+		return;
+	for(round = 0; round < 10000; round++)
+	{
+		unsigned long long newlines = 0, colons = 0, got_newlines, got_colons;
+		for(i = 0; i < HTTP_SCAN_BLOCK; i++)
+		{
+			block[i] = round % 2 ? alphabet[rng_below(sizeof(alphabet) - 1)] : (char)rng();
+			if(block[i] == '\n')
+				newlines |= 1ULL << i;
+			if(block[i] == ':')
+				colons |= 1ULL << i;
+		}
+		http_scanner.block(block, &got_newlines, &got_colons);
+		if(got_newlines != newlines || got_colons != colons)
+		{
+			fprintf(stderr, "%s: block masks differ in round %d\n", simd_names[simd], round);
+			failures++;
+			return;
+		}
+	}
+}
+
+/*
+	A generated response and what parsing it has to give
+*/
+#define TEST_MAX_HEADERS 16
+
+struct test_response
+{
+	struct str_buffer raw;
+	int header_count;
+	char *names[TEST_MAX_HEADERS];
+	char *values[TEST_MAX_HEADERS];
+	struct str_buffer body;
+};
+
+/*
+	What the parser reported
+*/
+struct test_parsed
+{
+	int header_count;
+	int headers_ok;
+	const struct test_response *expected;
+	struct str_buffer body;
+};
+
+static void random_token(char *out, size_t len)
+{
+	const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+	size_t i;
+	for(i = 0; i < len; i++)
+		out[i] = chars[rng_below(sizeof(chars) - 1)];
+	out[len] = '\0';
+}
+
+/*
+	A header value: printable, colons and inner blanks included, no blanks
+	at either end since those are trimmed
+*/
+static void random_value(char *out, size_t len)
+{
+	const char chars[] = "abc:XYZ019 ;,=/\t\"";
+	size_t i;
+	for(i = 0; i < len; i++)
+		out[i] = chars[rng_below(sizeof(chars) - 1)];
+	if(len > 0)
+	{
+		out[0] = 'v';
+		out[len - 1] = 'e';
+	}
+	out[len] = '\0';
+}
+
+static void add_line(struct test_response *res, const char *line, int crlf)
+{
+	str_buffer_append_str(&res->raw, line);
+	str_buffer_append_str(&res->raw, crlf ? "\r\n" : "\n");
+}
+
+/*
+	Generates a response. pad_to, when not 0, sizes the first header so the
+	line end of it lands on that offset of the response: its CR there with
+	crlf, its LF there without.
+*/
+static void make_response(struct test_response *res, size_t pad_to, int crlf)
+{
+	char line[512], name[64], value[256];
+	int i;
+	str_buffer_init(&res->raw);
+	str_buffer_init(&res->body);
+	snprintf(line, sizeof(line), "HTTP/1.1 200 %.*s", (int)rng_below(20), "Everything is fine here");
+	add_line(res, line, crlf);
+
+	res->header_count = (int)rng_below(TEST_MAX_HEADERS - 1) + 1;
+	for(i = 0; i < res->header_count; i++)
+	{
+		size_t name_len = rng_below(20) + 1;
+		size_t value_len = rng_below(120);
+		random_token(name, name_len);
+		name[0] = 'X';
+		if(i == 0 && pad_to > 0)
+		{
+			/* "X: " and the value, up to the line end at pad_to */
+			size_t used = res->raw.len + 3;
+			name[1] = '\0';
+			value_len = pad_to > used + 1 ? pad_to - used : 1;
+		}
+		random_value(value, value_len);
+		snprintf(line, sizeof(line), "%s: %s", name, value);
+		add_line(res, line, crlf);
+		if(i == 0 && pad_to > 0)
+			CHECK(res->raw.data[pad_to] == (crlf ? '\r' : '\n'));
+		res->names[i] = str_dup(name);
+		res->values[i] = str_dup(value);
+	}
+
+	/* A body with line ends and colons of its own, framed either way */
+	size_t body_len = rng_below(300);
+	for(i = 0; i < (int)body_len; i++)
+	{
+		char c = rng_below(4) == 0 ? "\r\n:"[rng_below(3)] : (char)rng();
+		str_buffer_append(&res->body, &c, 1);
+	}
+	if(rng_below(2) == 0)
+	{
+		snprintf(line, sizeof(line), "Content-Length: %zu", body_len);
+		add_line(res, line, crlf);
+		add_line(res, "", crlf);
+		if(body_len > 0)
+			str_buffer_append(&res->raw, res->body.data, res->body.len);
+	}
+	else
+	{
+		add_line(res, "Transfer-Encoding: chunked", crlf);
+		add_line(res, "", crlf);
+		size_t at = 0;
+		while(at < body_len)
+		{
+			size_t chunk = rng_below((unsigned int)(body_len - at)) + 1;
+			snprintf(line, sizeof(line), "%zx", chunk);
+			add_line(res, line, crlf);
+			str_buffer_append(&res->raw, res->body.data + at, chunk);
+			add_line(res, "", crlf);
+			at += chunk;
+		}
+		add_line(res, "0", crlf);
+		add_line(res, "", crlf);
+	}
+}
+
+static void free_response(struct test_response *res)
+{
+	int i;
+	for(i = 0; i < res->header_count; i++)
+	{
+		http_free(res->names[i]);
+		http_free(res->values[i]);
+	}
+	str_buffer_free(&res->raw);
+	str_buffer_free(&res->body);
+}
+
+static int on_header(struct http_parser *parser, const char *buf, struct http_span name, struct http_span value)
+{
+	struct test_parsed *parsed = (struct test_parsed*)parser->data;
+	int i = parsed->header_count++;
+	if(i >= parsed->expected->header_count)
+		return 0;
+	if(strlen(parsed->expected->names[i]) != name.len || memcmp(parsed->expected->names[i], buf + name.off, name.len) != 0
+		|| strlen(parsed->expected->values[i]) != value.len || memcmp(parsed->expected->values[i], buf + value.off, value.len) != 0)
+		parsed->headers_ok = 0;
+	return 0;
+}
+
+static int on_body(struct http_parser *parser, const char *buf, struct http_span chunk)
+{
+	struct test_parsed *parsed = (struct test_parsed*)parser->data;
+	str_buffer_append(&parsed->body, buf + chunk.off, chunk.len);
+	return 0;
+}
+
+/*
+	Parses a response fed in random pieces, the way it comes off a socket,
+	from a buffer that ends where the data does so reads past it are caught
+	by the sanitizers. Returns 0 when the result is what was generated.
+*/
+static int parse_matches(const struct test_response *res, int one_piece)
+{
+	struct http_parser parser;
+	struct test_parsed parsed;
+	char *buf = (char*)malloc(res->raw.len);
+	size_t fed = 0;
+	enum http_parser_state state = HTTP_PARSE_STATUS_LINE;
+	memcpy(buf, res->raw.data, res->raw.len);
+	memset(&parsed, 0, sizeof(parsed));
+	parsed.headers_ok = 1;
+	parsed.expected = res;
+	str_buffer_init(&parsed.body);
+	http_parser_init(&parser, 0);
+	parser.on_header = on_header;
+	parser.on_body = on_body;
+	parser.data = &parsed;
+	while(fed < res->raw.len && state < HTTP_PARSE_DONE)
+	{
+		fed += one_piece ? res->raw.len : rng_below((unsigned int)(res->raw.len - fed)) % 70 + 1;
+		if(fed > res->raw.len)
+			fed = res->raw.len;
+		state = http_parser_execute(&parser, buf, fed);
+	}
+	int ok = state == HTTP_PARSE_DONE && parser.status_code == 200 && parser.pos == res->raw.len
+		&& parsed.headers_ok && parsed.header_count == res->header_count + 1
+		&& parsed.body.len == res->body.len && (res->body.len == 0 || memcmp(parsed.body.data, res->body.data, res->body.len) == 0);
+	str_buffer_free(&parsed.body);
+	free(buf);
+	return ok ? 0 : -1;
+}
+
+static void test_parser(enum http_simd simd)
+{
+	int round;
+	for(round = 0; round < 4000; round++)
+	{
+		struct test_response res;
+		int crlf = round % 4 != 3;
+
+		/* Line ends on and either side of the block boundaries */
+		size_t pad_to = 0;
+		if(round % 2 == 0)
+			pad_to = (size_t)(63 + rng_below(3)) + 64 * rng_below(3);
+		make_response(&res, pad_to, crlf);
+		if(parse_matches(&res, round % 3 == 0) < 0)
+		{
+			fprintf(stderr, "%s: parse differs in round %d (pad_to %zu, %s)\n", simd_names[simd], round, pad_to, crlf ? "crlf" : "lf");
+			failures++;
+			free_response(&res);
+			return;
+		}
+		free_response(&res);
+	}
+}
+
+/*
+	Heads exactly 63, 64 and 65 bytes long, so the blank line ending them
+	meets the end of the first block
+*/
+static void test_parser_head_lengths(enum http_simd simd)
+{
+	size_t head_len;
+	for(head_len = 60; head_len <= 68; head_len++)
+	{
+		struct test_response res;
+		const char *status = "HTTP/1.1 200 OK\r\n";
+		const char *end = "Content-Length: 0\r\n\r\n";
+		size_t value_len = head_len - strlen(status) - strlen("X: \r\n") - strlen(end);
+		char value[64];
+		char line[128];
+		random_value(value, value_len);
+		str_buffer_init(&res.raw);
+		str_buffer_init(&res.body);
+		snprintf(line, sizeof(line), "%sX: %s\r\n%s", status, value, end);
+		str_buffer_append_str(&res.raw, line);
+		res.header_count = 1;
+		res.names[0] = str_dup("X");
+		res.values[0] = str_dup(value);
+		CHECK(res.raw.len == head_len);
+		if(parse_matches(&res, 1) < 0 || parse_matches(&res, 0) < 0)
+		{
+			fprintf(stderr, "%s: a %zu byte head does not parse\n", simd_names[simd], head_len);
+			failures++;
+		}
+		free_response(&res);
+	}
+}
+
+/*
+	Base64 the plain way, one character at a time, to check against
+*/
+static size_t reference_base64(char *dst, const unsigned char *src, size_t len)
+{
+	const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i, out = 0;
+	for(i = 0; i < len; i += 3)
+	{
+		unsigned int triple = (unsigned int)src[i] << 16 | (i + 1 < len ? (unsigned int)src[i + 1] << 8 : 0) | (i + 2 < len ? src[i + 2] : 0);
+		dst[out++] = alphabet[triple >> 18];
+		dst[out++] = alphabet[(triple >> 12) & 0x3f];
+		dst[out++] = i + 1 < len ? alphabet[(triple >> 6) & 0x3f] : '=';
+		dst[out++] = i + 2 < len ? alphabet[triple & 0x3f] : '=';
+	}
+	return out;
+}
+
+static void test_base64_vectors(enum http_simd simd)
+{
+	const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+	const char *encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+	char out[16];
+	int i;
+	(void)simd;
+	for(i = 0; i < 7; i++)
+	{
+		size_t len = base64_encode_to(out, plain[i], strlen(plain[i]));
+		CHECK(len == strlen(encoded[i]) && memcmp(out, encoded[i], len) == 0);
+		long decoded = base64_decode_to(out, encoded[i], strlen(encoded[i]));
+		CHECK(decoded == (long)strlen(plain[i]) && memcmp(out, plain[i], decoded) == 0);
+	}
+}
+
+/*
+	Encodes and decodes random data, from and into buffers of the exact
+	size, and checks that input with a character that is not base64 in it
+	fails wherever that character is
+*/
+static void test_base64(enum http_simd simd)
+{
+	int round;
+	for(round = 0; round < 3000; round++)
+	{
+		/* Every length up to 200, then random ones, often next to a block */
+		size_t len = round <= 200 ? (size_t)round : (size_t)(rng_below(4) == 0 ? 63 + rng_below(3) + 96 * rng_below(4) : rng_below(1000));
+		unsigned char *src = (unsigned char*)malloc(len + 1);
+		size_t i;
+		for(i = 0; i < len; i++)
+			src[i] = (unsigned char)rng();
+		size_t encoded_len = base64_encoded_len(len);
+		char *expected = (char*)malloc(encoded_len + 1);
+		char *encoded = (char*)malloc(encoded_len + 1);
+		size_t written = base64_encode_to(encoded, src, len);
+		CHECK(reference_base64(expected, src, len) == encoded_len);
+		if(written != encoded_len || memcmp(encoded, expected, encoded_len) != 0)
+		{
+			fprintf(stderr, "%s: encoding %zu bytes differs\n", simd_names[simd], len);
+			failures++;
+		}
+
+		/* With and without the padding */
+		size_t unpadded = encoded_len;
+		while(unpadded > 0 && expected[unpadded - 1] == '=')
+			unpadded--;
+		unsigned char *decoded = (unsigned char*)malloc(base64_decoded_max(encoded_len) + 1);
+		long n = base64_decode_to(decoded, expected, encoded_len);
+		if(n != (long)len || memcmp(decoded, src, len) != 0)
+		{
+			fprintf(stderr, "%s: decoding %zu characters differs\n", simd_names[simd], encoded_len);
+			failures++;
+		}
+		n = base64_decode_to(decoded, expected, unpadded);
+		if(n != (long)len || memcmp(decoded, src, len) != 0)
+		{
+			fprintf(stderr, "%s: decoding %zu characters without padding differs\n", simd_names[simd], unpadded);
+			failures++;
+		}
+
+		/* One bad character anywhere fails the whole input */
+		if(unpadded > 0)
+		{
+			const char bad[] = "!=-_ \n\r.\x80\xff";
+			size_t at = rng_below((unsigned int)unpadded);
+			char saved = expected[at];
+			expected[at] = bad[rng_below(sizeof(bad) - 1)];
+			if(expected[at] == '=' && at + 2 >= unpadded)
+				expected[at] = '!';	/* that would be padding */
+			if(base64_decode_to(decoded, expected, unpadded) != -1)
+			{
+				fprintf(stderr, "%s: '%c' at %zu of %zu characters decodes\n", simd_names[simd], expected[at], at, unpadded);
+				failures++;
+			}
+			expected[at] = saved;
+		}
+		free(decoded);
+		free(encoded);
+		free(expected);
+		free(src);
+	}
+}
+
+/*
+	Percent-encoding the plain way, one byte at a time, to check against
+*/
+static size_t reference_url_encode(char *dst, const unsigned char *src, size_t len, int form)
+{
+	size_t i, out = 0;
+	for(i = 0; i < len; i++)
+	{
+		unsigned char c = src[i];
+		if(isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+			dst[out++] = (char)c;
+		else if(c == ' ' && form)
+			dst[out++] = '+';
+		else
+			out += sprintf(dst + out, "%%%02X", c);
+	}
+	return out;
+}
+
+static long reference_url_decode(unsigned char *dst, const char *src, size_t len, int form)
+{
+	size_t i, out = 0;
+	for(i = 0; i < len; i++)
+	{
+		if(src[i] == '%')
+		{
+			if(i + 2 >= len || !isxdigit((unsigned char)src[i + 1]) || !isxdigit((unsigned char)src[i + 2]))
+				return -1;
+			char hex[3] = { src[i + 1], src[i + 2], '\0' };
+			dst[out++] = (unsigned char)strtol(hex, NULL, 16);
+			i += 2;
+		}
+		else
+		{
+			dst[out++] = src[i] == '+' && form ? ' ' : (unsigned char)src[i];
+		}
+	}
+	return (long)out;
+}
+
+/*
+	Random bytes for url encoding: long runs that need no change, so blocks
+	are copied whole, broken up by bytes to encode, spaces, '+' and '%'
+*/
+static void random_url_bytes(unsigned char *out, size_t len)
+{
+	const char plain[] = "abcXYZ019-._~";
+	size_t i;
+	unsigned int odd = 2 + rng_below(40);
+	for(i = 0; i < len; i++)
+	{
+		if(rng_below(odd) != 0)
+			out[i] = (unsigned char)plain[rng_below(sizeof(plain) - 1)];
+		else
+			out[i] = rng_below(2) == 0 ? (unsigned char)" +%/="[rng_below(5)] : (unsigned char)rng();
+	}
+}
+
+/*
+	A length around the 16 byte blocks most of the time
+*/
+static size_t random_url_length()
+{
+	return rng_below(3) == 0 ? (size_t)rng_below(200) : (size_t)(15 + rng_below(3) + 16 * rng_below(5));
+}
+
+/*
+	Encodes random bytes into a buffer of the exact size and checks the
+	result against the plain encoder
+*/
+static void test_url_encode(enum http_simd simd)
+{
+	int round;
+	for(round = 0; round < 100000; round++)
+	{
+		size_t len = random_url_length();
+		int form = round % 2;
+		unsigned char *src = (unsigned char*)malloc(len + 1);
+		char *expected = (char*)malloc(url_encoded_max(len) + 1);
+		char *encoded = (char*)malloc(url_encoded_max(len) + 1);
+		random_url_bytes(src, len);
+		size_t expected_len = reference_url_encode(expected, src, len, form);
+		size_t written = url_encode_to(encoded, (const char*)src, len, form);
+		if(written != expected_len || memcmp(encoded, expected, written) != 0)
+		{
+			fprintf(stderr, "%s: url encoding %zu bytes differs (%s)\n", simd_names[simd], len, form ? "form" : "url");
+			failures++;
+			round = 100000;
+		}
+		free(encoded);
+		free(expected);
+		free(src);
+	}
+}
+
+/*
+	Decodes random input, into a separate buffer and in place, with and
+	without form set, and checks it against the plain decoder. The input
+	mixes escapes, literal '+' and bytes that are left alone, and sometimes
+	ends in an incomplete escape or has a bad one.
+*/
+static void test_url_decode(enum http_simd simd)
+{
+	int round;
+	for(round = 0; round < 100000; round++)
+	{
+		size_t raw_len = random_url_length();
+		unsigned char *raw = (unsigned char*)malloc(raw_len + 1);
+		char *src = (char*)malloc(url_encoded_max(raw_len) + 3);
+		random_url_bytes(raw, raw_len);
+
+		/* Encoded with or without form, '+' and '%' partly left raw */
+		size_t len = 0, i;
+		for(i = 0; i < raw_len; i++)
+		{
+			if((raw[i] == '+' || raw[i] == ' ') && rng_below(2) == 0)
+				src[len++] = (char)raw[i];
+			else
+				len += reference_url_encode(src + len, raw + i, 1, rng_below(2));
+		}
+		switch(rng_below(8))
+		{
+			case 0:
+				/* '%' at the very end, or one digit short */
+				src[len++] = '%';
+				if(rng_below(2) == 0)
+					src[len++] = 'A';
+				break;
+			case 1:
+				/* A '%' that does not start an escape */
+				if(len > 0)
+				{
+					size_t at = rng_below((unsigned int)len);
+					src[at] = '%';
+					if(at + 1 < len && rng_below(2) == 0)
+						src[at + 1] = 'g';
+				}
+				break;
+		}
+
+		int form = round % 2;
+		unsigned char *expected = (unsigned char*)malloc(len + 1);
+		char *decoded = (char*)malloc(len + 1);
+		long expected_len = reference_url_decode(expected, src, len, form);
+		long n = url_decode_to(decoded, src, len, form);
+		if(n != expected_len || (n > 0 && memcmp(decoded, expected, n) != 0))
+		{
+			fprintf(stderr, "%s: url decoding %zu characters differs (%s)\n", simd_names[simd], len, form ? "form" : "url");
+			failures++;
+			round = 100000;
+		}
+
+		/* In place, from a buffer of the exact size */
+		char *in_place = (char*)malloc(len + 1);
+		if(len > 0)
+			memcpy(in_place, src, len);
+		n = url_decode_to(in_place, in_place, len, form);
+		if(n != expected_len || (n > 0 && memcmp(in_place, expected, n) != 0))
+		{
+			fprintf(stderr, "%s: url decoding %zu characters in place differs (%s)\n", simd_names[simd], len, form ? "form" : "url");
+			failures++;
+			round = 100000;
+		}
+		free(in_place);
+		free(decoded);
+		free(expected);
+		free(src);
+		free(raw);
+	}
+}
+
+/*
+	Builds query strings from random pairs and checks them against the
+	pairs encoded the plain way
+*/
+static void test_url_query(enum http_simd simd)
+{
+	int round;
+	for(round = 0; round < 20000; round++)
+	{
+		struct str_buffer query, expected;
+		const char *starts[] = { "", "/path?", "/path?a=1&", "/path?a=1" };
+		const char *start = starts[rng_below(4)];
+		int pairs = (int)rng_below(4) + 1, i;
+		str_buffer_init(&query);
+		str_buffer_init(&expected);
+		str_buffer_append_str(&query, start);
+		str_buffer_append_str(&expected, start);
+		for(i = 0; i < pairs; i++)
+		{
+			unsigned char key[200], value[200];
+			char encoded[600];
+			size_t key_len = random_url_length(), value_len = random_url_length();
+			int has_value = rng_below(5) != 0;
+			random_url_bytes(key, key_len);
+			random_url_bytes(value, value_len);
+			CHECK(url_query_add_len(&query, (const char*)key, key_len, has_value ? (const char*)value : NULL, value_len) == 0);
+			if(expected.len > 0 && expected.data[expected.len - 1] != '?' && expected.data[expected.len - 1] != '&')
+				str_buffer_append(&expected, "&", 1);
+			str_buffer_append(&expected, encoded, reference_url_encode(encoded, key, key_len, 1));
+			if(has_value)
+			{
+				str_buffer_append(&expected, "=", 1);
+				str_buffer_append(&expected, encoded, reference_url_encode(encoded, value, value_len, 1));
+			}
+		}
+		if(query.len != expected.len || memcmp(query.data, expected.data, query.len) != 0)
+		{
+			fprintf(stderr, "%s: query of %d pairs differs\n", simd_names[simd], pairs);
+			failures++;
+			round = 20000;
+		}
+		str_buffer_free(&query);
+		str_buffer_free(&expected);
+	}
+}
+
+int main()
+{
+	int simd;
+	for(simd = HTTP_SIMD_NONE; simd <= HTTP_SIMD_AVX2; simd++)
+	{
+		if(http_scanner_use((enum http_simd)simd) < 0)
+		{
+			printf("%s: not supported, skipped\n", simd_names[simd]);
+			continue;
+		}
+		test_scan_block((enum http_simd)simd);
+		test_parser((enum http_simd)simd);
+		test_parser_head_lengths((enum http_simd)simd);
+		test_base64_vectors((enum http_simd)simd);
+		test_base64((enum http_simd)simd);
+		test_url_encode((enum http_simd)simd);
+		test_url_decode((enum http_simd)simd);
+		test_url_query((enum http_simd)simd);
+		printf("%s: checked\n", simd_names[simd]);
+	}
+	if(failures > 0)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures > 0;
+}
@@ -0,0 +1,297 @@
+/*
+	http-client-c
+	Copyright (C) 2012-2013  Swen Kooij
+
+	This file is part of http-client-c.
+
+    http-client-c is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    http-client-c is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with http-client-c. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Runs https requests against a local TLS server with a self-signed
+	certificate made on the fly: the handshake, keep-alive reuse of a pooled
+	connection, session resumption on a new one, and bodies cut short by a
+	close without close_notify.
+*/
+#include "http-client-c.h"
+#include <openssl/x509.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+/*
+	Represents the test server
+*/
+struct tls_server
+{
+	int listener;
+	int port;
+	SSL_CTX *ctx;
+	int connections;				/* accepted so far */
+};
+
+static struct tls_server server;
+
+/*
+	Makes a key and a certificate for 127.0.0.1, signed by the key itself
+*/
+static int make_certificate(EVP_PKEY **key, X509 **cert)
+{
+	*key = EVP_EC_gen("P-256");
+	*cert = X509_new();
+	if(*key == NULL || *cert == NULL)
+		return -1;
+	X509_set_version(*cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(*cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(*cert), -60);
+	X509_gmtime_adj(X509_getm_notAfter(*cert), 3600);
+	X509_set_pubkey(*cert, *key);
+	X509_NAME *name = X509_get_subject_name(*cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"127.0.0.1", -1, -1, 0);
+	X509_set_issuer_name(*cert, name);
+
+	X509V3_CTX v3;
+	X509V3_set_ctx_nodb(&v3);
+	X509V3_set_ctx(&v3, *cert, *cert, NULL, NULL, 0);
+	X509_EXTENSION *san = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name, "IP:127.0.0.1");
+	if(san == NULL)
+		return -1;
+	X509_add_ext(*cert, san, -1);
+	X509_EXTENSION_free(san);
+	return X509_sign(*cert, *key, EVP_sha256()) > 0 ? 0 : -1;
+}
+
+/*
+	Reads a request up to the end of its headers, returns its path
+*/
+static int read_request(SSL *ssl, char *path, size_t path_len)
+{
+	char buf[4096];
+	size_t len = 0;
+	while(len + 1 < sizeof(buf))
+	{
+		int n = SSL_read(ssl, buf + len, (int)(sizeof(buf) - len - 1));
+		if(n <= 0)
+			return -1;
+		len += n;
+		buf[len] = '\0';
+		if(strstr(buf, "\r\n\r\n") != NULL)
+			return sscanf(buf, "GET %255s", path) == 1 && strlen(path) < path_len ? 0 : -1;
+	}
+	return -1;
+}
+
+/*
+	Serves one connection, keeping it alive until the client closes it or a
+	response ends it. The paths that cut a body close the socket without
+	close_notify.
+*/
+static void* serve(void *data)
+{
+	int sock = (int)(long)data;
+	SSL *ssl = SSL_new(server.ctx);
+	char path[256];
+	SSL_set_fd(ssl, sock);
+	if(SSL_accept(ssl) == 1)
+	{
+		while(read_request(ssl, path, sizeof(path)) == 0)
+		{
+			const char *reply;
+			int cut = 1;
+			if(strcmp(path, "/ok") == 0)
+			{
+				reply = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+				cut = 0;
+			}
+			else if(strcmp(path, "/length-cut") == 0)
+				reply = "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nonly ten b";
+			else if(strcmp(path, "/chunked-cut") == 0)
+				reply = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n";
+			else
+				reply = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nuntil close";
+			SSL_write(ssl, reply, (int)strlen(reply));
+			if(cut)
+				break;
+		}
+	}
+	else
+	{
+		SSL_shutdown(ssl);
+	}
+
+	/* Freed without SSL_shutdown, so no close_notify goes out */
+	SSL_free(ssl);
+	close(sock);
+	return NULL;
+}
+
+static void* accept_loop(void *data)
+{
+	(void)data;
+	while(1)
+	{
+		int sock = accept(server.listener, NULL, NULL);
+		if(sock < 0)
+			continue;
+		__sync_fetch_and_add(&server.connections, 1);
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, serve, (void*)(long)sock) == 0)
+			pthread_detach(thread);
+		else
+			close(sock);
+	}
+	return NULL;
+}
+
+/*
+	Starts the server on a free port and points the client at its
+	certificate
+*/
+static int start_server()
+{
+	EVP_PKEY *key;
+	X509 *cert;
+	if(make_certificate(&key, &cert) < 0)
+		return -1;
+
+	char ca_file[] = "/tmp/http-client-c-test-XXXXXX";
+	int fd = mkstemp(ca_file);
+	FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if(out == NULL)
+		return -1;
+	PEM_write_X509(out, cert);
+	fclose(out);
+	int configured = http_tls_configure(ca_file, 1);
+	unlink(ca_file);
+	if(configured < 0)
+		return -1;
+
+	server.ctx = SSL_CTX_new(TLS_server_method());
+	if(server.ctx == NULL || SSL_CTX_use_certificate(server.ctx, cert) != 1 || SSL_CTX_use_PrivateKey(server.ctx, key) != 1)
+		return -1;
+	X509_free(cert);
+	EVP_PKEY_free(key);
+
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(server.listener < 0 || bind(server.listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server.listener, 16) < 0)
+		return -1;
+	getsockname(server.listener, (struct sockaddr*)&addr, &addr_len);
+	server.port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, accept_loop, NULL) != 0)
+		return -1;
+	pthread_detach(thread);
+	return 0;
+}
+
+static struct http_response* get(const char *path)
+{
+	char url[128];
+	snprintf(url, sizeof(url), "https://127.0.0.1:%d%s", server.port, path);
+	return http_get(url, NULL);
+}
+
+static void test_handshake()
+{
+	struct http_response *hresp = get("/ok");
+	CHECK(hresp != NULL);
+	if(hresp == NULL)
+		return;
+	CHECK(strcmp(hresp->status_code, "200") == 0);
+	CHECK(hresp->body_len == 5 && memcmp(hresp->body, "hello", 5) == 0);
+	CHECK(hresp->timing.reused == 0);
+	CHECK(hresp->timing.tls_resumed == 0);
+	CHECK(hresp->timing.tls > 0);
+	http_response_free(hresp);
+}
+
+static void test_keep_alive()
+{
+	int connections = server.connections;
+	struct http_response *hresp = get("/ok");
+	CHECK(hresp != NULL);
+	if(hresp == NULL)
+		return;
+	CHECK(hresp->timing.reused == 1);
+	CHECK(server.connections == connections);
+	http_response_free(hresp);
+}
+
+static void test_resumption()
+{
+	/* A new connection, the session of the first one is offered */
+	http_pool_flush();
+	int connections = server.connections;
+	struct http_response *hresp = get("/ok");
+	CHECK(hresp != NULL);
+	if(hresp == NULL)
+		return;
+	CHECK(hresp->timing.reused == 0);
+	CHECK(hresp->timing.tls_resumed == 1);
+	CHECK(server.connections == connections + 1);
+	http_response_free(hresp);
+
+	/* Without the kept sessions it is a full handshake again */
+	http_pool_flush();
+	http_tls_flush_sessions();
+	hresp = get("/ok");
+	CHECK(hresp != NULL);
+	if(hresp == NULL)
+		return;
+	CHECK(hresp->timing.tls_resumed == 0);
+	http_response_free(hresp);
+}
+
+static void test_truncation()
+{
+	struct http_response *hresp = get("/length-cut");
+	CHECK(hresp == NULL);
+	CHECK(http_last_error() == HTTP_ERR_RECV);
+	http_response_free(hresp);
+
+	hresp = get("/chunked-cut");
+	CHECK(hresp == NULL);
+	CHECK(http_last_error() == HTTP_ERR_RECV);
+	http_response_free(hresp);
+
+	/* A body read until close has nothing else to end it */
+	hresp = get("/until-close");
+	CHECK(hresp != NULL);
+	if(hresp != NULL)
+		CHECK(hresp->body_len == 11 && memcmp(hresp->body, "until close", 11) == 0);
+	http_response_free(hresp);
+}
+
+int main()
+{
+	if(start_server() < 0)
+	{
+		fprintf(stderr, "could not start the TLS server\n");
+		return 1;
+	}
+	test_handshake();
+	test_keep_alive();
+	test_resumption();
+	test_truncation();
+	if(failures > 0)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures > 0;
+}